@@ -0,0 +1,83 @@
+// Measures building documents, key lookups and iteration. Built twice, as BSONPP_AccessBenchmark
+// with the normal checks and as BSONPP_TrustedAccessBenchmark with BSONPP_TRUSTED_INPUT defined.
+// Usage: BSONPP_AccessBenchmark [iterations]
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <BSONPP.h>
+
+constexpr int32_t kDocumentSize = 1024;
+constexpr int32_t kFields = 24;
+
+#ifdef BSONPP_TRUSTED_INPUT
+static const char *kMode = "trusted";
+#else
+static const char *kMode = "checked";
+#endif
+
+static const char *kKeys[kFields] = {
+    "deviceId", "timestamp", "sequenceNumber", "online", "temperature", "humidity", "pressure", "battery",
+    "latitude", "longitude", "altitude", "speed", "heading", "satellites", "signal", "uptime",
+    "firmware", "errors", "warnings", "resets", "memoryFree", "memoryUsed", "load", "checksum"
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *name, double seconds, int64_t operations) {
+    printf("%-8s %-12s %8.3f s %14.0f ops/s\n", kMode, name, seconds, operations / seconds);
+}
+
+static void build(BSONPP *doc, int32_t i) {
+    doc->clear();
+    for (int32_t field = 0; field < kFields; field++) {
+        if (field % 3 == 0) {
+            doc->append(kKeys[field], "value");
+        } else if (field % 3 == 1) {
+            doc->append(kKeys[field], i + field);
+        } else {
+            doc->append(kKeys[field], static_cast<int64_t>(i) * field);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int32_t iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+    uint8_t buffer[kDocumentSize];
+    BSONPP doc(buffer, sizeof(buffer));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < iterations; i++) {
+        build(&doc, i);
+    }
+    report("append", secondsSince(start), static_cast<int64_t>(iterations) * kFields);
+
+    // Keys later in the document skip more elements.
+    int64_t checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < iterations; i++) {
+        int32_t value = 0;
+        if (doc.get(kKeys[(i % (kFields / 3)) * 3 + 1], &value) == BSONPP_SUCCESS) {
+            checksum += value;
+        }
+    }
+    report("get", secondsSince(start), iterations);
+
+    start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < iterations; i++) {
+        int32_t offset = 0;
+        BSONPPElement element;
+        while (doc.nextElement(&offset, &element) == BSONPP_SUCCESS) {
+            checksum += element.valueSize;
+        }
+    }
+    report("iterate", secondsSince(start), static_cast<int64_t>(iterations) * kFields);
+
+    // Keeps the loops from being optimised away.
+    printf("checksum %lld\n", static_cast<long long>(checksum));
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Compares BSONPPAsyncReader/Writer against synchronous per document IO on a local file.
+// Usage: BSONPP_AsyncBenchmark [document count] [file path]
+
+#include <chrono>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <BSONPP.h>
+#include <BSONPPAsync.h>
+#include <BSONPPStream.h>
+
+constexpr int32_t kBufferSize = 64 * 1024;
+constexpr int32_t kBufferCount = 16;
+constexpr int32_t kDocumentSize = 256;
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *name, double seconds, int32_t documents, int64_t bytes) {
+    printf("%-24s %8.3f s %12.0f docs/s %10.1f MB/s\n", name, seconds, documents / seconds, bytes / seconds / (1024 * 1024));
+}
+
+static void makeDocument(BSONPP *doc, int32_t i) {
+    doc->clear();
+    doc->append("id", i);
+    doc->append("ts", int64_t{1563464196213} + i, true);
+    doc->append("value", i * 0.5);
+    doc->append("name", "telemetry sample with a medium length string");
+}
+
+static void countDocument(BSONPP *doc, void *context) {
+    int32_t id = 0;
+    if (BSONPP_SUCCESS == doc->get("id", &id)) {
+        (*static_cast<int64_t *>(context))++;
+    }
+}
+
+int main(int argc, char **argv) {
+    int32_t documents = argc > 1 ? atoi(argv[1]) : 500000;
+    const char *path = argc > 2 ? argv[2] : "bsonpp_async_benchmark.bson";
+
+    uint8_t docBuffer[kDocumentSize];
+    BSONPP doc(docBuffer, sizeof(docBuffer));
+    uint8_t *pool = new uint8_t[kBufferSize * kBufferCount];
+    uint8_t carry[kDocumentSize];
+
+    // Synchronous write, one write call per document.
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open");
+        return 1;
+    }
+    int64_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < documents; i++) {
+        makeDocument(&doc, i);
+        if (write(fd, doc.getBuffer(), doc.getSize()) != doc.getSize()) {
+            perror("write");
+            return 1;
+        }
+        bytes += doc.getSize();
+    }
+    fsync(fd);
+    report("sync write", secondsSince(start), documents, bytes);
+
+    for (int32_t forceSync = 0; forceSync < 2; forceSync++) {
+        BSONPPAsyncWriter writer(pool, kBufferSize, kBufferCount);
+        writer.init(forceSync);
+        if (ftruncate(fd, 0) != 0) {
+            perror("ftruncate");
+            return 1;
+        }
+        start = std::chrono::steady_clock::now();
+        writer.begin(fd, 0);
+        for (int32_t i = 0; i < documents; i++) {
+            makeDocument(&doc, i);
+            writer.write(&doc);
+        }
+        if (writer.flush() != BSONPP_SUCCESS) {
+            fprintf(stderr, "Async write failed\n");
+            return 1;
+        }
+        fsync(fd);
+        report(writer.isAsync() ? "async write (io_uring)" : "async write (fallback)", secondsSince(start), documents, bytes);
+    }
+
+    // Synchronous read through the stream reader.
+    start = std::chrono::steady_clock::now();
+    lseek(fd, 0, SEEK_SET);
+    BSONPPStreamReader streamReader(pool, kBufferSize);
+    int64_t count = 0;
+    while (streamReader.fill(fd) > 0) {
+        BSONPP parsed;
+        while (BSONPP_SUCCESS == streamReader.next(&parsed)) {
+            countDocument(&parsed, &count);
+        }
+    }
+    report("sync read", secondsSince(start), count, bytes);
+
+    for (int32_t forceSync = 0; forceSync < 2; forceSync++) {
+        BSONPPAsyncReader reader(pool, kBufferSize, kBufferCount, carry, sizeof(carry));
+        reader.init(forceSync);
+        count = 0;
+        start = std::chrono::steady_clock::now();
+        if (reader.read(fd, 0, countDocument, &count) != BSONPP_SUCCESS || count != documents) {
+            fprintf(stderr, "Async read failed\n");
+            return 1;
+        }
+        report(reader.isAsync() ? "async read (io_uring)" : "async read (fallback)", secondsSince(start), count, bytes);
+    }
+
+    close(fd);
+    unlink(path);
+    delete[] pool;
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Measures the size and speed of the key dictionary codec, alone and followed by block compression,
+// on a stream of telemetry-like documents.
+// Usage: BSONPP_CodecBenchmark [document count]
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <BSONPP.h>
+#include <BSONPPCodec.h>
+
+constexpr int32_t kDocumentSize = 256;
+constexpr int32_t kBlockSize = 16 * 1024;
+constexpr int32_t kTableBits = 12;
+constexpr int32_t kMaxKeys = 64;
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *name, double seconds, int32_t documents, int64_t rawBytes, int64_t bytes) {
+    printf("%-24s %8.3f s %12.0f docs/s %10.1f MB/s  ratio %5.2f\n", name, seconds, documents / seconds,
+        rawBytes / seconds / (1024 * 1024), static_cast<double>(rawBytes) / bytes);
+}
+
+static void makeDocument(BSONPP *doc, BSONPP *child, int32_t i) {
+    doc->clear();
+    child->clear();
+    child->append("temperature", 20.0 + (i % 50) * 0.1);
+    child->append("humidity", 40 + i % 20);
+    child->append("batteryVoltage", 3.3 - (i % 10) * 0.01);
+    doc->append("deviceId", "sensor-0042");
+    doc->append("timestamp", int64_t{1563464196213} + i * 1000, true);
+    doc->append("sequenceNumber", i);
+    doc->append("online", true);
+    doc->append("measurements", child);
+}
+
+struct Dictionary {
+    char storage[1024];
+    uint16_t offsets[kMaxKeys];
+    uint16_t slots[kMaxKeys * 2];
+    BSONPPKeyDictionary dictionary = BSONPPKeyDictionary(storage, sizeof(storage), offsets, kMaxKeys, slots, kMaxKeys * 2);
+};
+
+int main(int argc, char **argv) {
+    int32_t documents = argc > 1 ? atoi(argv[1]) : 500000;
+
+    uint8_t docBuffer[kDocumentSize];
+    uint8_t childBuffer[kDocumentSize];
+    BSONPP doc(docBuffer, sizeof(docBuffer));
+    BSONPP child(childBuffer, sizeof(childBuffer));
+
+    // Encode everything up front so only the codec is timed.
+    int64_t rawBytes = 0;
+    uint8_t *raw = new uint8_t[static_cast<size_t>(documents) * kDocumentSize];
+    int32_t *rawOffsets = new int32_t[documents + 1];
+    for (int32_t i = 0; i < documents; i++) {
+        makeDocument(&doc, &child, i);
+        rawOffsets[i] = rawBytes;
+        memcpy(raw + rawBytes, doc.getBuffer(), doc.getSize());
+        rawBytes += doc.getSize();
+    }
+    rawOffsets[documents] = rawBytes;
+
+    // Key dictionary encoding.
+    Dictionary *encoderDictionary = new Dictionary();
+    BSONPPKeyEncoder encoder(&encoderDictionary->dictionary);
+    uint8_t *encoded = new uint8_t[rawBytes];
+    int64_t encodedBytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < documents; i++) {
+        BSONPP input(raw + rawOffsets[i], rawOffsets[i + 1] - rawOffsets[i], false);
+        int32_t written = 0;
+        if (encoder.encode(&input, encoded + encodedBytes, rawBytes - encodedBytes, &written) != BSONPP_SUCCESS) {
+            fprintf(stderr, "Encode failed\n");
+            return 1;
+        }
+        encodedBytes += written;
+    }
+    report("key encode", secondsSince(start), documents, rawBytes, encodedBytes);
+
+    Dictionary *decoderDictionary = new Dictionary();
+    BSONPPKeyDecoder decoder(&decoderDictionary->dictionary);
+    int64_t position = 0;
+    start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < documents; i++) {
+        BSONPP output;
+        int32_t consumed = 0;
+        if (decoder.decode(encoded + position, encodedBytes - position, docBuffer, sizeof(docBuffer), &output, &consumed) != BSONPP_SUCCESS) {
+            fprintf(stderr, "Decode failed\n");
+            return 1;
+        }
+        position += consumed;
+    }
+    report("key decode", secondsSince(start), documents, rawBytes, encodedBytes);
+
+    // Block compression of the encoded stream.
+    uint16_t table[1 << kTableBits];
+    uint8_t *compressed = new uint8_t[encodedBytes + encodedBytes / 255 + 16 * (encodedBytes / kBlockSize + 1)];
+    int32_t *blockSizes = new int32_t[encodedBytes / kBlockSize + 1];
+    int64_t compressedBytes = 0;
+    int32_t blocks = 0;
+    start = std::chrono::steady_clock::now();
+    for (int64_t offset = 0; offset < encodedBytes; offset += kBlockSize) {
+        int32_t length = encodedBytes - offset < kBlockSize ? encodedBytes - offset : kBlockSize;
+        int32_t size = BSONPPBlock::compress(encoded + offset, length, compressed + compressedBytes, kBlockSize * 2, table, kTableBits);
+        if (size < 0) {
+            fprintf(stderr, "Compress failed\n");
+            return 1;
+        }
+        blockSizes[blocks++] = size;
+        compressedBytes += size;
+    }
+    report("compress encoded", secondsSince(start), documents, rawBytes, compressedBytes);
+
+    uint8_t *decompressed = new uint8_t[kBlockSize];
+    position = 0;
+    start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < blocks; i++) {
+        if (BSONPPBlock::decompress(compressed + position, blockSizes[i], decompressed, kBlockSize) < 0) {
+            fprintf(stderr, "Decompress failed\n");
+            return 1;
+        }
+        position += blockSizes[i];
+    }
+    report("decompress", secondsSince(start), documents, rawBytes, compressedBytes);
+
+    delete[] raw;
+    delete[] rawOffsets;
+    delete[] encoded;
+    delete[] compressed;
+    delete[] blockSizes;
+    delete[] decompressed;
+    delete encoderDictionary;
+    delete decoderDictionary;
+
+    return 0;
+}
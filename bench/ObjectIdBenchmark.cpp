@@ -0,0 +1,42 @@
+// Measures ObjectId generation from one shared generator on an increasing number of threads.
+// Usage: BSONPP_ObjectIdBenchmark [ids per thread] [max threads]
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+#include <BSONPP.h>
+#include <BSONPPObjectId.h>
+
+static void generate(BSONPPObjectIdGenerator *generator, int32_t count, uint64_t *checksum) {
+    BSONPPObjectId id;
+    uint64_t sum = 0;
+    for (int32_t i = 0; i < count; i++) {
+        generator->next(&id);
+        sum += id.bytes[11];
+    }
+    *checksum = sum;
+}
+
+int main(int argc, char **argv) {
+    int32_t count = argc > 1 ? atoi(argv[1]) : 10000000;
+    int32_t maxThreads = argc > 2 ? atoi(argv[2]) : 4;
+
+    BSONPPObjectIdGenerator generator;
+    for (int32_t threads = 1; threads <= maxThreads; threads *= 2) {
+        std::thread workers[16];
+        uint64_t checksums[16];
+        auto start = std::chrono::steady_clock::now();
+        for (int32_t i = 0; i < threads && i < 16; i++) {
+            workers[i] = std::thread(generate, &generator, count, &checksums[i]);
+        }
+        for (int32_t i = 0; i < threads && i < 16; i++) {
+            workers[i].join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%2d threads %8.3f s %14.0f ids/s\n", threads, seconds, static_cast<double>(count) * threads / seconds);
+    }
+
+    return 0;
+}
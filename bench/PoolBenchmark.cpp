@@ -0,0 +1,73 @@
+// Measures building a document in a pooled buffer against allocating a buffer for each one.
+// Usage: BSONPP_PoolBenchmark [documents per thread] [threads]
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+#include <BSONPP.h>
+#include <BSONPPPool.h>
+
+constexpr int32_t kDocumentSize = 4096;
+
+static void fill(BSONPP *doc, int32_t i) {
+    doc->append("deviceId", "sensor-0042");
+    doc->append("sequenceNumber", i);
+    doc->append("online", true);
+}
+
+static void allocated(int32_t count) {
+    for (int32_t i = 0; i < count; i++) {
+        uint8_t *buffer = new uint8_t[kDocumentSize];
+        BSONPP doc(buffer, kDocumentSize);
+        fill(&doc, i);
+        delete[] buffer;
+    }
+}
+
+static void pooled(BSONPPBufferPool *pool, int32_t count) {
+    for (int32_t i = 0; i < count; i++) {
+        BSONPP doc;
+        if (pool->acquire(kDocumentSize, &doc) != BSONPP_SUCCESS) {
+            fprintf(stderr, "Acquire failed\n");
+            exit(1);
+        }
+        fill(&doc, i);
+        pool->release(&doc);
+    }
+}
+
+template<typename F>
+static double run(int32_t threads, F work) {
+    std::thread workers[64];
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < threads; i++) {
+        workers[i] = std::thread(work);
+    }
+    for (int32_t i = 0; i < threads; i++) {
+        workers[i].join();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+    int32_t count = argc > 1 ? atoi(argv[1]) : 2000000;
+    int32_t threads = argc > 2 ? atoi(argv[2]) : 4;
+    if (threads > 64) {
+        threads = 64;
+    }
+
+    double seconds = run(threads, [count]() { allocated(count); });
+    printf("%-10s %8.3f s %14.0f docs/s\n", "new[]", seconds, static_cast<double>(count) * threads / seconds);
+
+    BSONPPBufferPool pool;
+    seconds = run(threads, [&pool, count]() { pooled(&pool, count); });
+    printf("%-10s %8.3f s %14.0f docs/s\n", "pool", seconds, static_cast<double>(count) * threads / seconds);
+
+    BSONPPBufferPoolStats stats;
+    pool.getStats(&stats);
+    printf("hit rate %.4f, %llu allocations\n", static_cast<double>(stats.localHits + stats.sharedHits) / stats.acquires,
+        static_cast<unsigned long long>(stats.allocations));
+    return 0;
+}
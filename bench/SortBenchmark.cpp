@@ -0,0 +1,78 @@
+// Sorts synthetic documents by a datetime field with BSONPPSorter, in memory and spilling to disk,
+// on one thread and several.
+// Usage: BSONPP_SortBenchmark [document count] [temp directory]
+
+#include <chrono>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+
+#include <BSONPP.h>
+#include <BSONPPSort.h>
+
+constexpr int32_t kDocumentSize = 256;
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *name, double seconds, int32_t documents, int64_t bytes) {
+    printf("%-32s %8.3f s %12.0f docs/s %10.1f MB/s\n", name, seconds, documents / seconds, bytes / seconds / (1024 * 1024));
+}
+
+static void makeDocument(BSONPP *doc, int32_t i) {
+    doc->clear();
+    doc->append("id", i);
+    // Scrambled so the input is far from sorted.
+    doc->append("ts", int64_t{1563464196213} + (static_cast<int64_t>(i) * 2654435761LL) % 100000000, true);
+    doc->append("value", i * 0.5);
+    doc->append("name", "telemetry sample with a medium length string");
+}
+
+static int32_t run(const char *name, size_t budget, int32_t threads, int32_t documents, const char *tempDirectory) {
+    uint8_t docBuffer[kDocumentSize];
+    BSONPP doc(docBuffer, sizeof(docBuffer));
+    uint8_t *memory = new uint8_t[budget];
+    BSONPPSorter sorter(memory, budget, "ts", tempDirectory, threads);
+
+    int fd = open("/dev/null", O_WRONLY);
+    int64_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < documents; i++) {
+        makeDocument(&doc, i);
+        bytes += doc.getSize();
+        if (sorter.add(&doc) != BSONPP_SUCCESS) {
+            fprintf(stderr, "Add failed\n");
+            return 1;
+        }
+    }
+    int32_t runs = sorter.getRunCount();
+    if (sorter.finish(fd) != BSONPP_SUCCESS) {
+        fprintf(stderr, "Finish failed\n");
+        return 1;
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%s, %d runs", name, runs);
+    report(label, secondsSince(start), documents, bytes);
+
+    close(fd);
+    delete[] memory;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int32_t documents = argc > 1 ? atoi(argv[1]) : 1000000;
+    const char *tempDirectory = argc > 2 ? argv[2] : "/tmp";
+    int32_t threads = std::thread::hardware_concurrency();
+    threads = threads < 1 ? 1 : threads;
+
+    size_t everything = static_cast<size_t>(documents) * 128;
+    size_t small = everything / 16;
+    return run("in memory, 1 thread", everything, 1, documents, tempDirectory) ||
+        run("in memory, all threads", everything, threads, documents, tempDirectory) ||
+        run("external, 1 thread", small, 1, documents, tempDirectory) ||
+        run("external, all threads", small, threads, documents, tempDirectory);
+}
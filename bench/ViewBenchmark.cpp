@@ -0,0 +1,119 @@
+// Measures a rule set reading paths from nested documents, with findPath, with a BSONPPView reset for
+// each document so located sub-documents are reused between rules, and with repeated reads of the
+// same document through a view that has already located every path. A view must be reset for each
+// new document, the last figure only applies to reading one document again.
+// Usage: BSONPP_ViewBenchmark [documents]
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <BSONPP.h>
+#include <BSONPPView.h>
+
+constexpr int32_t kDocumentSize = 4096;
+constexpr int32_t kFields = 12;
+constexpr int32_t kRules = 24;
+constexpr int32_t kEntries = 128;
+
+static const char *kKeys[kFields] = {
+    "deviceId", "timestamp", "sequenceNumber", "online", "temperature", "humidity",
+    "pressure", "battery", "latitude", "longitude", "altitude", "speed"
+};
+
+// Rules mostly read the same few sub-documents, as a rule engine would.
+static const char *kPaths[kRules] = {
+    "sensors.environment.temperature", "sensors.environment.humidity", "sensors.environment.pressure",
+    "sensors.environment.speed", "sensors.power.battery", "sensors.power.altitude",
+    "sensors.power.speed", "sensors.power.latitude", "status.network.online",
+    "status.network.speed", "status.network.battery", "status.sequenceNumber",
+    "sensors.environment.longitude", "sensors.environment.latitude", "sensors.power.temperature",
+    "sensors.power.humidity", "status.network.pressure", "status.network.altitude",
+    "status.timestamp", "sensors.environment.battery", "sensors.power.pressure",
+    "status.network.temperature", "status.network.longitude", "status.speed"
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *name, double seconds, int64_t operations) {
+    printf("%-10s %8.3f s %14.0f paths/s\n", name, seconds, operations / seconds);
+}
+
+static void appendFields(BSONPP *doc, int32_t seed) {
+    for (int32_t field = 0; field < kFields; field++) {
+        doc->append(kKeys[field], seed + field);
+    }
+}
+
+// Two levels of sub-documents with a full set of fields at every level.
+static void build(BSONPP *doc) {
+    BSONPP group;
+    BSONPP leaf;
+    const char *groups[] = { "sensors", "status" };
+    const char *leaves[][2] = { { "environment", "power" }, { "network", "history" } };
+    appendFields(doc, 0);
+    for (int32_t i = 0; i < 2; i++) {
+        doc->beginDocument(groups[i], &group);
+        appendFields(&group, 100 * i);
+        for (int32_t j = 0; j < 2; j++) {
+            group.beginDocument(leaves[i][j], &leaf);
+            appendFields(&leaf, 100 * i + 10 * j);
+            group.endDocument(&leaf);
+        }
+        doc->endDocument(&group);
+    }
+}
+
+int main(int argc, char **argv) {
+    int32_t documents = argc > 1 ? atoi(argv[1]) : 200000;
+
+    uint8_t buffer[kDocumentSize];
+    BSONPP doc(buffer, sizeof(buffer));
+    build(&doc);
+
+    int64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < documents; i++) {
+        for (int32_t rule = 0; rule < kRules; rule++) {
+            BSONPP owner;
+            int32_t offset = 0;
+            int32_t value = 0;
+            if (doc.findPath(kPaths[rule], &owner, &offset) == BSONPP_SUCCESS && owner.getValue(offset, &value) == BSONPP_SUCCESS) {
+                checksum += value;
+            }
+        }
+    }
+    report("findPath", secondsSince(start), static_cast<int64_t>(documents) * kRules);
+
+    BSONPPViewEntry entries[kEntries];
+    BSONPPView view(&doc, entries, kEntries);
+    start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < documents; i++) {
+        view.reset(&doc);
+        for (int32_t rule = 0; rule < kRules; rule++) {
+            int32_t value = 0;
+            if (view.get(kPaths[rule], &value) == BSONPP_SUCCESS) {
+                checksum += value;
+            }
+        }
+    }
+    report("view", secondsSince(start), static_cast<int64_t>(documents) * kRules);
+
+    // The same document read again without a reset, everything is already located.
+    start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < documents; i++) {
+        for (int32_t rule = 0; rule < kRules; rule++) {
+            int32_t value = 0;
+            if (view.get(kPaths[rule], &value) == BSONPP_SUCCESS) {
+                checksum += value;
+            }
+        }
+    }
+    report("reread", secondsSince(start), static_cast<int64_t>(documents) * kRules);
+
+    // Keeps the loops from being optimised away.
+    printf("checksum %lld\n", static_cast<long long>(checksum));
+    return 0;
+}
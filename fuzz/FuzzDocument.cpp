@@ -0,0 +1,276 @@
+// Fuzz target for documents read from untrusted buffers. Every input must be rejected by validate or
+// survive each read path with consistent results, in time linear in its size. Links against libFuzzer,
+// or FuzzMain.cpp for AFL and corpus replay.
+//
+// BSONPP_FUZZ_BUDGET sets the time allowed per input byte in nanoseconds, on top of a fixed 10ms, so
+// a path that turns super-linear aborts on large inputs. Defaults to 1000, 0 turns it off.
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <BSONPP.h>
+#include <BSONPPCodec.h>
+#include <BSONPPView.h>
+
+#define FUZZ_BASE_BUDGET_NS (10000000)
+#define FUZZ_DICTIONARY_KEYS (64)
+#define FUZZ_VIEW_ENTRIES (16)
+// Larger inputs are skipped, they only slow fuzzing down.
+#define FUZZ_MAX_INPUT (1 << 22)
+
+static volatile uint64_t sink;
+
+static void fail(const char *what) {
+    fprintf(stderr, "BSONPP fuzz: %s\n", what);
+    abort();
+}
+
+static void exerciseDocument(BSONPP *doc);
+
+static void exerciseElement(BSONPP *doc, const BSONPPElement *element) {
+    uint64_t key = 0;
+    int32_t order = 0;
+    doc->getSortKey(element->offset, &key);
+    if (doc->compareValue(element->offset, doc, element->offset, &order) != BSONPP_SUCCESS || order != 0) {
+        fail("value differs from itself");
+    }
+    sink += key;
+
+    switch (element->type) {
+        case BSONPP_DOUBLE: {
+            double val = 0;
+            doc->getValue(element->offset, &val);
+            sink += static_cast<uint64_t>(val == val);
+            break;
+        }
+        case BSONPP_STRING: // Fallthrough
+        case BSONPP_JAVASCRIPT: // Fallthrough
+        case BSONPP_SYMBOL: {
+            char *val = nullptr;
+            int32_t length = 0;
+            // Only strings are readable as strings, the others share their layout.
+            if (doc->getValue(element->offset, &val, &length) == BSONPP_SUCCESS && (length < 0 || val[length] != 0x00)) {
+                fail("string length");
+            }
+            break;
+        }
+        case BSONPP_DOCUMENT: // Fallthrough
+        case BSONPP_ARRAY: {
+            BSONPP child;
+            if (doc->getValue(element->offset, &child) != BSONPP_SUCCESS) {
+                fail("sub-document");
+            }
+            exerciseDocument(&child);
+            break;
+        }
+        case BSONPP_BINARY: {
+            uint8_t *val = nullptr;
+            int32_t length = 0;
+            uint8_t subtype = 0;
+            doc->getValue(element->offset, &val, &length, &subtype);
+            sink += length > 0 ? val[length - 1] : subtype;
+            break;
+        }
+        case BSONPP_BOOLEAN: {
+            bool val = false;
+            doc->getValue(element->offset, &val);
+            sink += val;
+            break;
+        }
+        case BSONPP_INT32: {
+            int32_t val = 0;
+            doc->getValue(element->offset, &val);
+            sink += val;
+            break;
+        }
+        case BSONPP_DATETIME: // Fallthrough
+        case BSONPP_INT64: {
+            int64_t val = 0;
+            doc->getValue(element->offset, &val);
+            sink += val;
+            break;
+        }
+        case BSONPP_OBJECT_ID: {
+            BSONPPObjectId val;
+            doc->getValue(element->offset, &val);
+            sink += val.bytes[11];
+            break;
+        }
+        case BSONPP_TIMESTAMP: {
+            BSONPPTimestamp val;
+            doc->getValue(element->offset, &val);
+            sink += val.seconds;
+            break;
+        }
+        case BSONPP_DECIMAL128: {
+            BSONPPDecimal128 val;
+            doc->getValue(element->offset, &val);
+            sink += val.bytes[15];
+            break;
+        }
+        default:
+            sink += element->valueSize;
+    }
+}
+
+// Walks every element once, so nesting only adds the size of each sub-document.
+static void exerciseDocument(BSONPP *doc) {
+    int32_t count = 0;
+    int32_t visited = 0;
+    int32_t offset = 0;
+    BSONPPElement element;
+    doc->getKeyCount(&count);
+    while (doc->nextElement(&offset, &element) == BSONPP_SUCCESS) {
+        exerciseElement(doc, &element);
+        visited++;
+    }
+    if (visited != count || offset > doc->getSize()) {
+        fail("iteration and key count disagree");
+    }
+}
+
+// Key lookups and whole document operations, each a bounded number of passes.
+static void exerciseLookups(BSONPP *doc) {
+    int32_t number = 0;
+    char *string = nullptr;
+    BSONPP child;
+    BSONPP owner;
+    int32_t offset = 0;
+    doc->get("a", &number);
+    doc->get("_id", &string);
+    doc->get("0", &child);
+    sink += doc->exists("");
+    if (doc->findPath("a.b.0", &owner, &offset) == BSONPP_SUCCESS) {
+        exerciseDocument(&owner);
+    }
+
+    // The view must find what findPath does, from its cache the second time.
+    const char *paths[] = { "a.b.0", "a.b.1", "a", "0.0", "a.b.0" };
+    BSONPPViewEntry entries[FUZZ_VIEW_ENTRIES];
+    BSONPPView view(doc, entries, FUZZ_VIEW_ENTRIES);
+    for (const char *path : paths) {
+        BSONPP viewOwner;
+        int32_t viewOffset = 0;
+        int32_t res = doc->findPath(path, &owner, &offset);
+        if (view.find(path, &viewOwner, &viewOffset) != res
+            || (res == BSONPP_SUCCESS && (viewOwner.getBuffer() + viewOffset != owner.getBuffer() + offset))) {
+            fail("view and findPath disagree");
+        }
+    }
+
+    uint64_t hash = 0;
+    uint64_t unorderedHash = 0;
+    int32_t order = 0;
+    doc->hash(&hash);
+    doc->hash(&unorderedHash, true);
+    sink += hash ^ unorderedHash;
+    if (doc->compare(doc, &order) != BSONPP_SUCCESS || order != 0) {
+        fail("document differs from itself");
+    }
+}
+
+// Copying, patching and encoding a document must give back the same bytes.
+static void exerciseRoundTrips(BSONPP *doc) {
+    int32_t size = doc->getSize();
+    uint8_t *copyBuffer = new uint8_t[size];
+    BSONPP copy(copyBuffer, size);
+    if (copy.appendAllFrom(doc) != BSONPP_SUCCESS || memcmp(copyBuffer, doc->getBuffer(), size) != 0) {
+        fail("copy");
+    }
+
+    uint8_t patchBuffer[5];
+    BSONPP patch(patchBuffer, sizeof(patchBuffer));
+    if (patch.diff(doc, &copy) != BSONPP_SUCCESS || patch.getSize() != 5) {
+        fail("patch between equal documents");
+    }
+
+    char storage[1024];
+    uint16_t offsets[FUZZ_DICTIONARY_KEYS];
+    uint16_t slots[FUZZ_DICTIONARY_KEYS * 2];
+    BSONPPKeyDictionary encoderDictionary(storage, sizeof(storage), offsets, FUZZ_DICTIONARY_KEYS, slots, FUZZ_DICTIONARY_KEYS * 2);
+    BSONPPKeyEncoder encoder(&encoderDictionary);
+    int32_t encodedLength = size * 2 + 16;
+    uint8_t *encoded = new uint8_t[encodedLength];
+    int32_t written = 0;
+    // Deep nesting and non-sequential array keys aren't encodable.
+    if (encoder.encode(doc, encoded, encodedLength, &written) == BSONPP_SUCCESS) {
+        char decoderStorage[1024];
+        uint16_t decoderOffsets[FUZZ_DICTIONARY_KEYS];
+        BSONPPKeyDictionary decoderDictionary(decoderStorage, sizeof(decoderStorage), decoderOffsets, FUZZ_DICTIONARY_KEYS);
+        BSONPPKeyDecoder decoder(&decoderDictionary);
+        BSONPP decoded;
+        int32_t consumed = 0;
+        if (decoder.decode(encoded, written, copyBuffer, size, &decoded, &consumed) != BSONPP_SUCCESS
+            || consumed != written || memcmp(copyBuffer, doc->getBuffer(), size) != 0) {
+            fail("codec round trip");
+        }
+    }
+
+    delete[] encoded;
+    delete[] copyBuffer;
+}
+
+// The codec's decoders take untrusted input too, whatever they produce must validate.
+static void exerciseDecoders(const uint8_t *data, int32_t size) {
+    int32_t outLength = size * 4 + 64;
+    uint8_t *out = new uint8_t[outLength];
+
+    char storage[1024];
+    uint16_t offsets[FUZZ_DICTIONARY_KEYS];
+    BSONPPKeyDictionary dictionary(storage, sizeof(storage), offsets, FUZZ_DICTIONARY_KEYS);
+    BSONPPKeyDecoder decoder(&dictionary);
+    BSONPP decoded;
+    int32_t consumed = 0;
+    if (decoder.decode(data, size, out, outLength, &decoded, &consumed) == BSONPP_SUCCESS
+        && (consumed > size || decoded.validate() != BSONPP_SUCCESS)) {
+        fail("decoded document");
+    }
+
+    int32_t decompressed = BSONPPBlock::decompress(data, size, out, outLength);
+    if (decompressed > outLength) {
+        fail("decompressed size");
+    }
+
+    delete[] out;
+}
+
+static int64_t getBudget(size_t size) {
+    static int64_t perByte = -1;
+    if (perByte < 0) {
+        const char *budget = getenv("BSONPP_FUZZ_BUDGET");
+        perByte = budget == nullptr ? 1000 : atoll(budget);
+    }
+    return perByte == 0 ? 0 : FUZZ_BASE_BUDGET_NS + perByte * static_cast<int64_t>(size);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size > FUZZ_MAX_INPUT) {
+        return 0;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    // An exact copy so the sanitizers catch reads past the input.
+    uint8_t *buffer = new uint8_t[size];
+    if (size > 0) {
+        memcpy(buffer, data, size);
+    }
+    BSONPP doc(buffer, size, false);
+    if (doc.validate() == BSONPP_SUCCESS) {
+        exerciseDocument(&doc);
+        exerciseLookups(&doc);
+        exerciseRoundTrips(&doc);
+    }
+    exerciseDecoders(data, size);
+    delete[] buffer;
+
+    int64_t budget = getBudget(size);
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    if (budget > 0 && elapsed > budget) {
+        fprintf(stderr, "BSONPP fuzz: %zu byte input took %lld ns, budget %lld ns\n", size,
+            static_cast<long long>(elapsed), static_cast<long long>(budget));
+        abort();
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+// Standalone driver for the fuzz target when libFuzzer isn't available. Runs each file given, the files
+// in each directory given or, with no arguments, standard input, so it also works as an AFL target:
+// afl-fuzz -i fuzz/corpus -o findings -- BSONPP_FuzzRunner @@
+// Reports the slowest input, to compare against earlier runs.
+
+#include <chrono>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static int32_t inputs = 0;
+static double slowest = 0;
+static size_t slowestSize = 0;
+static std::string slowestName;
+
+static bool readAll(FILE *file, std::vector<uint8_t> *data) {
+    uint8_t chunk[4096];
+    size_t read = 0;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data->insert(data->end(), chunk, chunk + read);
+    }
+    return ferror(file) == 0;
+}
+
+static bool run(const std::string &name, FILE *file) {
+    std::vector<uint8_t> data;
+    if (!readAll(file, &data)) {
+        fprintf(stderr, "Couldn't read %s\n", name.c_str());
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+    double microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    if (microseconds > slowest) {
+        slowest = microseconds;
+        slowestSize = data.size();
+        slowestName = name;
+    }
+    inputs++;
+    return true;
+}
+
+static bool runPath(const std::string &path) {
+    DIR *dir = opendir(path.c_str());
+    if (dir != nullptr) {
+        bool ok = true;
+        struct dirent *entry = nullptr;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (entry->d_name[0] != '.') {
+                ok = runPath(path + "/" + entry->d_name) && ok;
+            }
+        }
+        closedir(dir);
+        return ok;
+    }
+
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Couldn't open %s\n", path.c_str());
+        return false;
+    }
+    bool ok = run(path, file);
+    fclose(file);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    bool ok = true;
+    if (argc < 2) {
+        ok = run("stdin", stdin);
+    }
+    for (int i = 1; i < argc; i++) {
+        ok = runPath(argv[i]) && ok;
+    }
+
+    printf("%d inputs, slowest %s took %.0f us for %zu bytes\n", inputs, slowestName.c_str(), slowest, slowestSize);
+    return ok ? 0 : 1;
+}
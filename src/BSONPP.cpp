@@ -1,5 +1,6 @@
 #include <string.h>
 #include "BSONPP.h"
+#include "BSONPPStats.h"
 #include "NetworkUtil.h"
 #include "IEEE754tools.h"
 
@@ -12,9 +13,10 @@ BSONPP::BSONPP(uint8_t *buffer, int32_t length, bool clear): m_buffer(buffer), m
 BSONPP::BSONPP(): m_buffer(nullptr), m_length(0) {}
 
 void BSONPP::clear() {
-    memset(m_buffer, 0x00, m_length);
-    // Default size, 4 length bytes and a 0x00 suffix.
+    // Default size, 4 length bytes and a 0x00 suffix. Appends write their own terminator so the rest
+    // of the buffer isn't touched.
     this->setSize(5);
+    m_buffer[4] = 0x00;
 }
 
 int32_t BSONPP::getSize() {
@@ -52,7 +54,7 @@ int32_t BSONPP::getKeyCount(int32_t *countOut) {
         // +1 null terminator
         offset += strlen(reinterpret_cast<char *>(m_buffer + offset)) + 1;
         int32_t size = BSONPP::getTypeSize(type, m_buffer + offset);
-        if (size < 0) {
+        if (BSONPP_CHECKED(size < 0)) {
             return BSONPP_INCORRECT_TYPE;
         }
         offset += size;
@@ -63,7 +65,7 @@ int32_t BSONPP::getKeyCount(int32_t *countOut) {
     return BSONPP_SUCCESS;
 }
 
-int32_t BSONPP::getKeyAt(int32_t index, char **key) {
+int32_t BSONPP::getKeyAt(int32_t index, char **key, int32_t *length) {
     int32_t offset = this->getOffset(index);
 
     if (BSONPP_INVALID_TYPE == BSONPP::getType(m_buffer + offset)) {
@@ -71,6 +73,9 @@ int32_t BSONPP::getKeyAt(int32_t index, char **key) {
     }
 
     *key = reinterpret_cast<char *>(m_buffer + offset + 1);
+    if (length != nullptr) {
+        *length = strlen(*key);
+    }
 
     return BSONPP_SUCCESS;
 }
@@ -117,8 +122,8 @@ int32_t BSONPP::append(const char *key, BSONPP *val, bool isArray) {
     return this->appendInternal(key, isArray ? BSONPP_ARRAY : BSONPP_DOCUMENT, val->getBuffer(), val->getSize());
 }
 
-int32_t BSONPP::append(const char *key, const uint8_t *data, const int32_t length) {
-    return this->appendInternal(key, BSONPP_BINARY, data, length);
+int32_t BSONPP::append(const char *key, const uint8_t *data, const int32_t length, uint8_t subtype) {
+    return this->appendInternal(key, BSONPP_BINARY, data, length, subtype);
 }
 
 int32_t BSONPP::append(const char *key, bool val) {
@@ -126,26 +131,326 @@ int32_t BSONPP::append(const char *key, bool val) {
     return this->appendInternal(key, BSONPP_BOOLEAN, &converted, 1);
 }
 
+int32_t BSONPP::append(const char *key, const BSONPPObjectId *val) {
+    return this->appendInternal(key, BSONPP_OBJECT_ID, val->bytes, sizeof(val->bytes));
+}
+
+int32_t BSONPP::append(const char *key, const BSONPPTimestamp *val) {
+    // Stored as a uint64 with the seconds in the high half.
+    uint64_t swapped = htole64((static_cast<uint64_t>(val->seconds) << 32) | val->increment);
+    return this->appendInternal(key, BSONPP_TIMESTAMP, reinterpret_cast<uint8_t *>(&swapped), sizeof(uint64_t));
+}
+
+int32_t BSONPP::append(const char *key, const BSONPPDecimal128 *val) {
+    return this->appendInternal(key, BSONPP_DECIMAL128, val->bytes, sizeof(val->bytes));
+}
+
 int32_t BSONPP::get(const char *key, int32_t *val) {
-    int32_t offset = this->getOffset(key, BSONPP_INT32);
+    int32_t keyLength = 0;
+    int32_t offset = this->getOffset(key, BSONPP_INVALID_TYPE, &keyLength);
+    return this->readValue(offset, this->getData(offset, keyLength), val);
+}
+
+int32_t BSONPP::get(const char *key, int64_t *val) {
+    int32_t keyLength = 0;
+    int32_t offset = this->getOffset(key, BSONPP_INVALID_TYPE, &keyLength);
+    return this->readValue(offset, this->getData(offset, keyLength), val);
+}
+
+int32_t BSONPP::get(const char *key, double *val) {
+    int32_t keyLength = 0;
+    int32_t offset = this->getOffset(key, BSONPP_INVALID_TYPE, &keyLength);
+    return this->readValue(offset, this->getData(offset, keyLength), val);
+}
+
+int32_t BSONPP::get(const char *key, BSONPP *val) {
+    int32_t keyLength = 0;
+    int32_t offset = this->getOffset(key, BSONPP_INVALID_TYPE, &keyLength);
+    return this->readValue(offset, this->getData(offset, keyLength), val);
+}
+
+int32_t BSONPP::get(const char *key, char **val, int32_t *length) {
+    int32_t keyLength = 0;
+    int32_t offset = this->getOffset(key, BSONPP_INVALID_TYPE, &keyLength);
+    return this->readValue(offset, this->getData(offset, keyLength), val, length);
+}
+
+int32_t BSONPP::get(const char *key, uint8_t **val, int32_t *length, uint8_t *subtype) {
+    int32_t keyLength = 0;
+    int32_t offset = this->getOffset(key, BSONPP_INVALID_TYPE, &keyLength);
+    return this->readValue(offset, this->getData(offset, keyLength), val, length, subtype);
+}
+
+int32_t BSONPP::get(const char *key, bool *val) {
+    int32_t keyLength = 0;
+    int32_t offset = this->getOffset(key, BSONPP_INVALID_TYPE, &keyLength);
+    return this->readValue(offset, this->getData(offset, keyLength), val);
+}
+
+int32_t BSONPP::get(const char *key, BSONPPObjectId *val) {
+    int32_t keyLength = 0;
+    int32_t offset = this->getOffset(key, BSONPP_INVALID_TYPE, &keyLength);
+    return this->readValue(offset, this->getData(offset, keyLength), val);
+}
+
+int32_t BSONPP::get(const char *key, BSONPPTimestamp *val) {
+    int32_t keyLength = 0;
+    int32_t offset = this->getOffset(key, BSONPP_INVALID_TYPE, &keyLength);
+    return this->readValue(offset, this->getData(offset, keyLength), val);
+}
+
+int32_t BSONPP::get(const char *key, BSONPPDecimal128 *val) {
+    int32_t keyLength = 0;
+    int32_t offset = this->getOffset(key, BSONPP_INVALID_TYPE, &keyLength);
+    return this->readValue(offset, this->getData(offset, keyLength), val);
+}
+
+#ifdef BSONPP_HAS_STRING_VIEW
+int32_t BSONPP::getKeyAt(int32_t index, std::string_view *key) {
+    char *data = nullptr;
+    int32_t length = 0;
+    int32_t res = this->getKeyAt(index, &data, &length);
+    if (res == BSONPP_SUCCESS) {
+        *key = std::string_view(data, length);
+    }
+    return res;
+}
+
+int32_t BSONPP::get(const char *key, std::string_view *val) {
+    char *data = nullptr;
+    int32_t length = 0;
+    int32_t res = this->get(key, &data, &length);
+    if (res == BSONPP_SUCCESS) {
+        *val = std::string_view(data, length);
+    }
+    return res;
+}
+
+int32_t BSONPP::getValue(int32_t offset, std::string_view *val) {
+    char *data = nullptr;
+    int32_t length = 0;
+    int32_t res = this->getValue(offset, &data, &length);
+    if (res == BSONPP_SUCCESS) {
+        *val = std::string_view(data, length);
+    }
+    return res;
+}
+#endif // BSONPP_HAS_STRING_VIEW
+
+int32_t BSONPP::nextElement(int32_t *offset, BSONPPElement *element) {
+    // Offset 0 means start at the first element, after the header.
+    int32_t current = *offset == 0 ? static_cast<int32_t>(sizeof(int32_t)) : *offset;
+    // Minus 1 for the object null terminator
+    if (current >= this->getSize() - 1) {
+        return BSONPP_KEY_NOT_FOUND;
+    }
+
+    BSONPP_COUNT(elementsVisited, 1);
+    element->offset = current;
+    element->type = m_buffer[current];
+    element->key = reinterpret_cast<char *>(m_buffer + current + 1);
+    element->keyLength = strlen(element->key);
+    // +1 for the type, +1 for the key null terminator
+    element->value = m_buffer + current + 1 + element->keyLength + 1;
+    element->valueSize = BSONPP::getTypeSize(element->type, element->value);
+    if (BSONPP_CHECKED(element->valueSize < 0)) {
+        return BSONPP_INCORRECT_TYPE;
+    }
+
+    *offset = element->value - m_buffer + element->valueSize;
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPP::appendElement(const BSONPPElement *element) {
+    return this->appendEncoded(element->type, element->key, element->keyLength, element->value, element->valueSize, true);
+}
+
+int32_t BSONPP::beginDocument(const char *key, BSONPP *child, bool isArray) {
+    if (m_buffer == nullptr) {
+        return BSONPP_NO_BUFFER;
+    }
+
+    int32_t keyLength = strlen(key);
+    // +1 for the type, +1 for the key null terminator
+    int32_t headerSize = 1 + keyLength + 1;
+    // The child needs room for at least an empty document.
+    if (this->getSize() + headerSize + 5 > m_length) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+    if (BSONPP_CHECKED(this->exists(key))) {
+        return BSONPP_DUPLICATE_KEY;
+    }
+
+    // The type goes over this document's null terminator so it's only written by endDocument, until
+    // then this document is unchanged and dropping the child discards it. It's kept in the last byte
+    // of the buffer, which the child can't reach.
+    int32_t offset = this->getSize();
+    m_buffer[m_length - 1] = isArray ? BSONPP_ARRAY : BSONPP_DOCUMENT;
+    memcpy(m_buffer + offset, key, keyLength + 1);
+    offset += keyLength + 1;
+
+    // Leave a byte at the end for this document's null terminator.
+    child->m_buffer = m_buffer + offset;
+    child->m_length = m_length - offset - 1;
+    child->setSize(5);
+    child->m_buffer[4] = 0x00;
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPP::endDocument(BSONPP *child) {
+    if (child->m_buffer <= m_buffer || child->m_buffer >= m_buffer + m_length) {
+        return BSONPP_INCORRECT_TYPE;
+    }
+
+    // Minus one for the null terminator of the BSON object
+    m_buffer[this->getSize() - 1] = m_buffer[m_length - 1];
+    int32_t offset = child->m_buffer - m_buffer + child->getSize();
+    m_buffer[offset] = 0x00;
+    // Plus one for the null terminator of the BSON object
+    this->setSize(offset + 1);
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPP::findPath(const char *path, BSONPP *owner, int32_t *offset) {
+    BSONPP current = *this;
+    while (true) {
+        const char *dot = strchr(path, '.');
+        int32_t length = dot == nullptr ? strlen(path) : dot - path;
+
+        int32_t next = 0;
+        BSONPPElement element;
+        int32_t res = BSONPP_SUCCESS;
+        while ((res = current.nextElement(&next, &element)) == BSONPP_SUCCESS) {
+            if (element.keyLength == length && memcmp(element.key, path, length) == 0) {
+                break;
+            }
+        }
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+
+        if (dot == nullptr) {
+            *owner = current;
+            *offset = element.offset;
+            return BSONPP_SUCCESS;
+        }
+        if (element.type != BSONPP_DOCUMENT && element.type != BSONPP_ARRAY) {
+            return BSONPP_KEY_NOT_FOUND;
+        }
+
+        BSONPP child;
+        current.getValue(element.offset, &child);
+        current = child;
+        path = dot + 1;
+    }
+}
+
+int32_t BSONPP::find(const BSONPPKeySet *keys, int32_t *offsets) {
+    if (!keys->isValid()) {
+        return BSONPP_INVALID_KEY_SET;
+    }
+
+    int32_t remaining = keys->getCount();
+    for (int32_t i = 0; i < remaining; i++) {
+        offsets[i] = BSONPP_KEY_NOT_FOUND;
+    }
+
+    BSONPP_TRACE_BEGIN(find, this->getSize());
+    BSONPP_COUNT(scans, 1);
+    BSONPP_RECORD_SIZE(this->getSize());
+
+    // Start at the end of the header.
+    int32_t offset = sizeof(int32_t);
+    // Minus 1 for the object null terminator
+    int32_t size = this->getSize() - 1;
+
+    while (offset < size && remaining > 0) {
+        BSONPP_COUNT(elementsVisited, 1);
+        uint8_t type = m_buffer[offset];
+        int32_t keyLength = 0;
+        // +1 to skip the type, hashing also finds the key length.
+        const char *key = reinterpret_cast<char *>(m_buffer + offset + 1);
+        int32_t index = keys->indexOf(key, keyLength, BSONPPKeySet::hash(key, &keyLength));
+        // Like getOffset the first occurrence of a key wins.
+        if (index >= 0 && offsets[index] == BSONPP_KEY_NOT_FOUND) {
+            offsets[index] = type == BSONPP_NULL ? BSONPP_NULL_VALUE : offset;
+            remaining--;
+        }
+
+        // +1 for the type, +1 for the key null terminator
+        int32_t dataSize = BSONPP::getTypeSize(type, m_buffer + offset + 1 + keyLength + 1);
+        if (BSONPP_CHECKED(dataSize < 0)) {
+            BSONPP_TRACE_END(find, BSONPP_INCORRECT_TYPE);
+            return BSONPP_INCORRECT_TYPE;
+        }
+        offset += 1 + keyLength + 1 + dataSize;
+    }
+
+    BSONPP_TRACE_END(find, BSONPP_SUCCESS);
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPP::getValue(int32_t offset, int32_t *val) {
+    return this->readValue(offset, this->getData(offset), val);
+}
+
+int32_t BSONPP::getValue(int32_t offset, int64_t *val) {
+    return this->readValue(offset, this->getData(offset), val);
+}
+
+int32_t BSONPP::getValue(int32_t offset, double *val) {
+    return this->readValue(offset, this->getData(offset), val);
+}
+
+int32_t BSONPP::getValue(int32_t offset, BSONPP *val) {
+    return this->readValue(offset, this->getData(offset), val);
+}
+
+int32_t BSONPP::getValue(int32_t offset, char **val, int32_t *length) {
+    return this->readValue(offset, this->getData(offset), val, length);
+}
+
+int32_t BSONPP::getValue(int32_t offset, uint8_t **val, int32_t *length, uint8_t *subtype) {
+    return this->readValue(offset, this->getData(offset), val, length, subtype);
+}
+
+int32_t BSONPP::getValue(int32_t offset, bool *val) {
+    return this->readValue(offset, this->getData(offset), val);
+}
+
+int32_t BSONPP::getValue(int32_t offset, BSONPPObjectId *val) {
+    return this->readValue(offset, this->getData(offset), val);
+}
+
+int32_t BSONPP::getValue(int32_t offset, BSONPPTimestamp *val) {
+    return this->readValue(offset, this->getData(offset), val);
+}
+
+int32_t BSONPP::getValue(int32_t offset, BSONPPDecimal128 *val) {
+    return this->readValue(offset, this->getData(offset), val);
+}
 
+// Private methods
+int32_t BSONPP::readValue(int32_t offset, uint8_t *data, int32_t *val) {
     if (offset < 0) {
         return offset;
     }
+    if (BSONPP_INT32 != BSONPP::getType(m_buffer + offset)) {
+        return BSONPP_INCORRECT_TYPE;
+    }
 
-    memcpy(val, BSONPP::getData(m_buffer + offset), sizeof(int32_t));
+    memcpy(val, data, sizeof(int32_t));
     *val = letoh32(*val);
 
     return BSONPP_SUCCESS;
 }
 
-int32_t BSONPP::get(const char *key, int64_t *val) {
-    int32_t offset = this->getOffset(key);
+int32_t BSONPP::readValue(int32_t offset, uint8_t *data, int64_t *val) {
     if (offset < 0) {
         return offset;
     }
-    uint8_t *data = BSONPP::getData(m_buffer + offset);
-
     switch (BSONPP::getType(m_buffer + offset)) {
         case BSONPP_INT32:
             int32_t val32;
@@ -162,13 +467,14 @@ int32_t BSONPP::get(const char *key, int64_t *val) {
     }
 }
 
-int32_t BSONPP::get(const char *key, double *val) {
-    int32_t offset = this->getOffset(key, BSONPP_DOUBLE);
+int32_t BSONPP::readValue(int32_t offset, uint8_t *data, double *val) {
     if (offset < 0) {
         return offset;
     }
+    if (BSONPP_DOUBLE != BSONPP::getType(m_buffer + offset)) {
+        return BSONPP_INCORRECT_TYPE;
+    }
 
-    uint8_t *data = BSONPP::getData(m_buffer + offset);
     if (sizeof(double) == 4) {
         *val = doublePacked2Float(data);
     } else {
@@ -177,8 +483,7 @@ int32_t BSONPP::get(const char *key, double *val) {
     return BSONPP_SUCCESS;
 }
 
-int32_t BSONPP::get(const char *key, BSONPP *val) {
-    int32_t offset = this->getOffset(key);
+int32_t BSONPP::readValue(int32_t offset, uint8_t *data, BSONPP *val) {
     if (offset < 0) {
         return offset;
     }
@@ -186,61 +491,185 @@ int32_t BSONPP::get(const char *key, BSONPP *val) {
     if (BSONPP_DOCUMENT != type && BSONPP_ARRAY != type) {
         return BSONPP_INCORRECT_TYPE;
     }
-    uint8_t *data = BSONPP::getData(m_buffer + offset);
     val->m_buffer = data;
     val->m_length = BSONPP::getTypeSize(BSONPP_DOCUMENT, data);
 
     return BSONPP_SUCCESS;
 }
 
-int32_t BSONPP::get(const char *key, char **val) {
-    int32_t offset = this->getOffset(key, BSONPP_STRING);
+int32_t BSONPP::readValue(int32_t offset, uint8_t *data, char **val, int32_t *length) {
     if (offset < 0) {
         return offset;
     }
+    if (BSONPP_STRING != BSONPP::getType(m_buffer + offset)) {
+        return BSONPP_INCORRECT_TYPE;
+    }
+
+    if (length != nullptr) {
+        // The stored length includes the null terminator.
+        memcpy(length, data, sizeof(int32_t));
+        *length = letoh32(*length) - 1;
+    }
 
     // +sizeof(int32_t) to skip length
-    *val = reinterpret_cast<char *>(BSONPP::getData(m_buffer + offset) + sizeof(int32_t));
+    *val = reinterpret_cast<char *>(data + sizeof(int32_t));
 
     return BSONPP_SUCCESS;
 }
 
-int32_t BSONPP::get(const char *key, uint8_t **val, int32_t *length) {
-    int32_t offset = this->getOffset(key, BSONPP_BINARY);
+int32_t BSONPP::readValue(int32_t offset, uint8_t *data, uint8_t **val, int32_t *length, uint8_t *subtype) {
     if (offset < 0) {
         return offset;
     }
-
-    uint8_t *data = BSONPP::getData(m_buffer + offset);
+    if (BSONPP_BINARY != BSONPP::getType(m_buffer + offset)) {
+        return BSONPP_INCORRECT_TYPE;
+    }
 
     if (length != nullptr) {
         memcpy(length, data, sizeof(int32_t));
         *length = letoh32(*length);
     }
 
+    if (subtype != nullptr) {
+        *subtype = data[sizeof(int32_t)];
+    }
+
     // +sizeof(int32_t) to skip length, +1 to skip subtype
     *val = reinterpret_cast<uint8_t *>(data + sizeof(int32_t)) + 1;
 
     return BSONPP_SUCCESS;
 }
 
-int32_t BSONPP::get(const char *key, bool *val) {
-    int32_t offset = this->getOffset(key, BSONPP_BOOLEAN);
+int32_t BSONPP::readValue(int32_t offset, uint8_t *data, bool *val) {
     if (offset < 0) {
         return offset;
     }
+    if (BSONPP_BOOLEAN != BSONPP::getType(m_buffer + offset)) {
+        return BSONPP_INCORRECT_TYPE;
+    }
 
-    *val = BSONPP::getData(m_buffer + offset)[0] == BSONPP_BOOLEAN_TRUE;
+    *val = data[0] == BSONPP_BOOLEAN_TRUE;
 
     return BSONPP_SUCCESS;
 }
 
-// Private methods
-int32_t BSONPP::appendInternal(const char *key, uint8_t type, const uint8_t *data, const int32_t length) {
+int32_t BSONPP::readValue(int32_t offset, uint8_t *data, BSONPPObjectId *val) {
+    if (offset < 0) {
+        return offset;
+    }
+    if (BSONPP_OBJECT_ID != BSONPP::getType(m_buffer + offset)) {
+        return BSONPP_INCORRECT_TYPE;
+    }
+
+    memcpy(val->bytes, data, sizeof(val->bytes));
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPP::readValue(int32_t offset, uint8_t *data, BSONPPTimestamp *val) {
+    if (offset < 0) {
+        return offset;
+    }
+    if (BSONPP_TIMESTAMP != BSONPP::getType(m_buffer + offset)) {
+        return BSONPP_INCORRECT_TYPE;
+    }
+
+    uint64_t cache = 0;
+    memcpy(&cache, data, sizeof(uint64_t));
+    cache = letoh64(cache);
+    val->increment = static_cast<uint32_t>(cache);
+    val->seconds = static_cast<uint32_t>(cache >> 32);
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPP::readValue(int32_t offset, uint8_t *data, BSONPPDecimal128 *val) {
+    if (offset < 0) {
+        return offset;
+    }
+    if (BSONPP_DECIMAL128 != BSONPP::getType(m_buffer + offset)) {
+        return BSONPP_INCORRECT_TYPE;
+    }
+
+    memcpy(val->bytes, data, sizeof(val->bytes));
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPP::appendInternal(const char *key, uint8_t type, const uint8_t *data, const int32_t length, uint8_t subtype) {
+    BSONPP_TRACE_BEGIN(append, length);
     if (m_buffer == nullptr) {
-        return BSONPP_NO_BUFFER;
+        return BSONPP_APPEND_DONE(BSONPP_NO_BUFFER);
+    }
+
+    int32_t headerSize = BSONPP::writeElementHeader(nullptr, key, type, length);
+    int32_t size = this->getSize();
+
+    if (size + headerSize + length > m_length) {
+        return BSONPP_APPEND_DONE(BSONPP_OUT_OF_SPACE);
+    }
+
+    if (BSONPP_CHECKED(this->exists(key))) {
+        return BSONPP_APPEND_DONE(BSONPP_DUPLICATE_KEY);
+    }
+
+    // Minus one for the null terminator of the BSON object
+    int32_t offset = size - 1;
+    offset += BSONPP::writeElementHeader(m_buffer + offset, key, type, length, subtype);
+
+    memcpy(m_buffer + offset, data, length);
+    offset += length;
+    BSONPP_COUNT(bytesCopied, headerSize + length);
+
+    m_buffer[offset] = 0x00;
+    // Plus one for the null terminator of the BSON object
+    this->setSize(offset + 1);
+
+    return BSONPP_APPEND_DONE(BSONPP_SUCCESS);
+}
+
+int32_t BSONPP::appendEncoded(uint8_t type, const char *key, int32_t keyLength, const uint8_t *value, int32_t size, bool checkDuplicate) {
+    BSONPP_TRACE_BEGIN(append, size);
+    if (m_buffer == nullptr) {
+        return BSONPP_APPEND_DONE(BSONPP_NO_BUFFER);
+    }
+
+    int32_t documentSize = this->getSize();
+    // +1 for the type, +1 for the key null terminator
+    if (documentSize + 1 + keyLength + 1 + size > m_length) {
+        return BSONPP_APPEND_DONE(BSONPP_OUT_OF_SPACE);
+    }
+
+    // Minus one for the null terminator of the BSON object
+    int32_t offset = documentSize - 1;
+    if (BSONPP_CHECKED(checkDuplicate)) {
+        int32_t current = 0;
+        BSONPPElement existing;
+        while (this->nextElement(&current, &existing) == BSONPP_SUCCESS) {
+            if (existing.keyLength == keyLength && memcmp(existing.key, key, keyLength) == 0) {
+                return BSONPP_APPEND_DONE(BSONPP_DUPLICATE_KEY);
+            }
+        }
+    }
+
+    m_buffer[offset++] = type;
+    memcpy(m_buffer + offset, key, keyLength);
+    offset += keyLength;
+    m_buffer[offset++] = 0x00;
+    if (size > 0) {
+        memcpy(m_buffer + offset, value, size);
+        offset += size;
     }
+    BSONPP_COUNT(bytesCopied, 1 + keyLength + 1 + size);
+
+    m_buffer[offset] = 0x00;
+    // Plus one for the null terminator of the BSON object
+    this->setSize(offset + 1);
 
+    return BSONPP_APPEND_DONE(BSONPP_SUCCESS);
+}
+
+int32_t BSONPP::writeElementHeader(uint8_t *out, const char *key, uint8_t type, int32_t length, uint8_t subtype) {
     bool includeLength = false;
     switch (type) {
         case BSONPP_STRING:
@@ -251,115 +680,164 @@ int32_t BSONPP::appendInternal(const char *key, uint8_t type, const uint8_t *dat
             break;
     }
 
-    // +1 for key null terminator
-    int32_t sizeAfter = this->getSize() + strlen(key) + 1 + sizeof(type) + length;
+    // +1 for the type, +1 for key null terminator
+    int32_t keyLength = strlen(key);
+    int32_t size = 1 + keyLength + 1;
     if (includeLength) {
-        sizeAfter += sizeof(int32_t);
+        size += sizeof(int32_t);
     }
-
-    if (sizeAfter > m_length) {
-        return BSONPP_OUT_OF_SPACE;
+    if (type == BSONPP_BINARY) {
+        size += 1;
     }
 
-    if (this->exists(key)) {
-        return BSONPP_DUPLICATE_KEY;
+    if (out == nullptr) {
+        return size;
     }
 
-    // Minus one for the null terminator of the BSON object
-    int32_t offset = this->getSize() - 1;
+    int32_t offset = 0;
     // Set the type.
-    m_buffer[offset++] = type;
+    out[offset++] = type;
 
     // Copy the key
-    memcpy(m_buffer + offset, key, strlen(key) + 1);
-    offset += strlen(key) + 1;
+    memcpy(out + offset, key, keyLength + 1);
+    offset += keyLength + 1;
 
     if (includeLength) {
         int32_t swapped = htole32(length);
-        memcpy(m_buffer + offset, &swapped, sizeof(int32_t));
+        memcpy(out + offset, &swapped, sizeof(int32_t));
         offset += sizeof(int32_t);
     }
 
     if (type == BSONPP_BINARY) {
-        m_buffer[offset++] = BSONPP_BINARY_SUBTYPE_GENERIC;
+        out[offset++] = subtype;
     }
 
-    memcpy(m_buffer + offset, data, length);
-    offset += length;
-
-    // Plus one for the null terminator of the BSON object
-    this->setSize(offset + 1);
-
-    return BSONPP_SUCCESS;
+    return offset;
 }
 
+// Value sizes indexed by type. Entries from BSONPP_TYPE_LENGTH_PREFIXED up to BSONPP_TYPE_CSTRINGS
+// are read from a 4 byte length prefix, adding the rest of the entry. -1 marks types that don't exist.
+#define BSONPP_TYPE_LENGTH_PREFIXED (0x40)
+// A regex's pattern and options, two null terminated strings.
+#define BSONPP_TYPE_CSTRINGS (0x7F)
+#define BSONPP_TYPE_TABLE_SIZE (0x20)
+// The last supported type before min and max key.
+#define BSONPP_TYPE_LAST (BSONPP_DECIMAL128)
+static const int8_t kTypeSizes[BSONPP_TYPE_TABLE_SIZE] = {
+    -1,                                                 // 0x00
+    8,                                                  // 0x01 double
+    BSONPP_TYPE_LENGTH_PREFIXED + sizeof(int32_t),      // 0x02 string, the prefix excludes itself
+    BSONPP_TYPE_LENGTH_PREFIXED,                        // 0x03 document, the prefix includes itself
+    BSONPP_TYPE_LENGTH_PREFIXED,                        // 0x04 array
+    BSONPP_TYPE_LENGTH_PREFIXED + sizeof(int32_t) + 1,  // 0x05 binary, +1 for the subtype
+    0,                                                  // 0x06 undefined
+    12,                                                 // 0x07 ObjectId
+    1,                                                  // 0x08 boolean
+    sizeof(int64_t),                                    // 0x09 datetime
+    0,                                                  // 0x0A null
+    BSONPP_TYPE_CSTRINGS,                               // 0x0B regex
+    BSONPP_TYPE_LENGTH_PREFIXED + sizeof(int32_t) + 12, // 0x0C DBPointer, a string and an ObjectId
+    BSONPP_TYPE_LENGTH_PREFIXED + sizeof(int32_t),      // 0x0D JavaScript, a string
+    BSONPP_TYPE_LENGTH_PREFIXED + sizeof(int32_t),      // 0x0E symbol, a string
+    BSONPP_TYPE_LENGTH_PREFIXED,                        // 0x0F JavaScript with scope, the prefix includes itself
+    sizeof(int32_t),                                    // 0x10 int32
+    sizeof(uint64_t),                                   // 0x11 timestamp
+    sizeof(int64_t),                                    // 0x12 int64
+    16,                                                 // 0x13 decimal128
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,         // 0x14 - 0x1E
+    0                                                   // 0x7F max key and 0xFF min key, masked to 0x1F
+};
+
 int32_t BSONPP::getTypeSize(uint8_t type, uint8_t *data) {
-    int32_t cache = 0;
-    switch (type) {
-        case BSONPP_DOUBLE:
-            return 8;
-        case BSONPP_STRING: // Fallthrough
-        case BSONPP_DOCUMENT: // Fallthrough
-        case BSONPP_ARRAY:
-            memcpy(&cache, data, sizeof(int32_t));
-            return letoh32(cache) + sizeof(int32_t);
-        case BSONPP_BINARY:
-            // +1 for subtype
-            memcpy(&cache, data, sizeof(int32_t));
-            return letoh32(cache) + sizeof(int32_t) + 1;
-        case BSONPP_INT32:
-            return sizeof(int32_t);
-        case BSONPP_INT64: // Fallthrough
-        case BSONPP_DATETIME:
-            return sizeof(int64_t);
-        case BSONPP_BOOLEAN:
-            return 1;
-        case BSONPP_NULL:
-            return 0;
-        default:
-            // For unhandled types return a 0 length.
-            return -1;
+    // Only min and max key are beyond the table.
+    if (BSONPP_CHECKED(type > BSONPP_TYPE_LAST && type != BSONPP_MAX_KEY && type != BSONPP_MIN_KEY)) {
+        return -1;
     }
+
+    // A table lookup rather than a switch, only variable length values branch.
+    int8_t size = kTypeSizes[type & (BSONPP_TYPE_TABLE_SIZE - 1)];
+    if (size < BSONPP_TYPE_LENGTH_PREFIXED) {
+        return size;
+    }
+    if (size == BSONPP_TYPE_CSTRINGS) {
+        int32_t patternLength = strlen(reinterpret_cast<char *>(data)) + 1;
+        return patternLength + strlen(reinterpret_cast<char *>(data + patternLength)) + 1;
+    }
+    int32_t cache = 0;
+    memcpy(&cache, data, sizeof(int32_t));
+    return letoh32(cache) + (size - BSONPP_TYPE_LENGTH_PREFIXED);
 }
 
 uint8_t BSONPP::getType(uint8_t *data) {
     return data[0];
 }
 
-uint8_t *BSONPP::getData(uint8_t *data) {
+bool BSONPP::matchKey(const char *key, const char *elementKey, int32_t *elementKeyLength) {
+    const char *start = elementKey;
+    bool match = true;
+    // Keep going after a mismatch to find the end of the element key.
+    while (*elementKey != 0) {
+        match = match && *key == *elementKey;
+        if (match) {
+            key++;
+        }
+        elementKey++;
+    }
+    *elementKeyLength = elementKey - start;
+
+    // The whole key must be used up so a key doesn't match its prefix.
+    return match && *key == 0;
+}
+
+uint8_t *BSONPP::getData(int32_t offset, int32_t keyLength) {
+    if (offset < 0) {
+        return nullptr;
+    }
+    if (keyLength < 0) {
+        keyLength = strlen(reinterpret_cast<char *>(m_buffer + offset + 1));
+    }
     // +1 for type, +the key length, +the key null terminator
-    return data + 1 + strlen(reinterpret_cast<char *>(data + 1)) + 1;
+    return m_buffer + offset + 1 + keyLength + 1;
 }
 
-int32_t BSONPP::getOffset(const char *key, uint8_t type) {
+int32_t BSONPP::getOffset(const char *key, uint8_t type, int32_t *foundKeyLength) {
+    BSONPP_TRACE_BEGIN(lookup, this->getSize());
+    BSONPP_COUNT(scans, 1);
+    BSONPP_RECORD_SIZE(this->getSize());
+
     // Start at the end of the header.
     int32_t offset = sizeof(int32_t);
     // Minus 1 for the object null terminator
     int32_t size = this->getSize() - 1;
 
     while (offset < size) {
-        // +1 to skip the type
-        if (strncmp(key, reinterpret_cast<char *>(m_buffer + offset + 1), strlen(key)) == 0) {
+        BSONPP_COUNT(elementsVisited, 1);
+        // +1 to skip the type. Matching also measures the element key so it isn't scanned twice.
+        int32_t keyLength = 0;
+        if (BSONPP::matchKey(key, reinterpret_cast<char *>(m_buffer + offset + 1), &keyLength)) {
             if (m_buffer[offset] == BSONPP_NULL) {
-                return BSONPP_NULL_VALUE;
+                return BSONPP_LOOKUP_DONE(BSONPP_NULL_VALUE);
             }
             if (type != BSONPP_INVALID_TYPE && type != m_buffer[offset]) {
-                return BSONPP_INCORRECT_TYPE;
+                return BSONPP_LOOKUP_DONE(BSONPP_INCORRECT_TYPE);
+            }
+            if (foundKeyLength != nullptr) {
+                *foundKeyLength = keyLength;
             }
-            return offset;
+            return BSONPP_LOOKUP_DONE(offset);
         }
         // Extract the type and move the offset on
         uint8_t type = m_buffer[offset++];
         // +1 null terminator
-        offset += strlen(reinterpret_cast<char *>(m_buffer + offset)) + 1;
+        offset += keyLength + 1;
         int32_t dataSize = BSONPP::getTypeSize(type, m_buffer + offset);
-        if (dataSize < 0) {
-            return 0;
+        if (BSONPP_CHECKED(dataSize < 0)) {
+            return BSONPP_LOOKUP_DONE(BSONPP_INCORRECT_TYPE);
         }
         offset += dataSize;
     }
 
-    return BSONPP_KEY_NOT_FOUND;
+    return BSONPP_LOOKUP_DONE(BSONPP_KEY_NOT_FOUND);
 }
 
 int32_t BSONPP::getOffset(int32_t index) {
@@ -373,7 +851,7 @@ int32_t BSONPP::getOffset(int32_t index) {
         // +1 null terminator
         offset += strlen(reinterpret_cast<char *>(m_buffer + offset)) + 1;
         int32_t size = BSONPP::getTypeSize(type, m_buffer + offset);
-        if (size < 0) {
+        if (BSONPP_CHECKED(size < 0)) {
             return BSONPP_INCORRECT_TYPE;
         }
         offset += size;
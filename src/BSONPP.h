@@ -2,6 +2,12 @@
 #define __BSONPP_H__
 
 #include <stdint.h>
+#include "BSONPPKeySet.h"
+
+#if defined(__LINUX_BUILD) && __cplusplus >= 201703L
+#include <string_view>
+#define BSONPP_HAS_STRING_VIEW
+#endif
 
 #define BSONPP_SUCCESS (0)
 #define BSONPP_KEY_NOT_FOUND (-1)
@@ -10,6 +16,21 @@
 #define BSONPP_NO_BUFFER (-4)
 #define BSONPP_DUPLICATE_KEY (-5)
 #define BSONPP_NULL_VALUE (-6)
+#define BSONPP_INVALID_KEY_SET (-7)
+#define BSONPP_IO_ERROR (-8)
+#define BSONPP_WOULD_BLOCK (-9)
+#define BSONPP_INCOMPLETE (-10)
+#define BSONPP_INVALID_DOCUMENT (-11)
+#define BSONPP_END_OF_STREAM (-12)
+
+// Defining BSONPP_TRUSTED_INPUT for the whole build drops the checks that only fail on malformed or
+// hostile documents: unknown types aren't detected and appends don't look for duplicate keys. Use it
+// only when every document comes from a trusted encoder. Wrapped checks are never evaluated.
+#ifdef BSONPP_TRUSTED_INPUT
+#define BSONPP_CHECKED(condition) (false && (condition))
+#else
+#define BSONPP_CHECKED(condition) (condition)
+#endif
 
 #define BSONPP_INVALID_TYPE (0x00)
 #define BSONPP_DOUBLE (0x01)
@@ -17,16 +38,76 @@
 #define BSONPP_DOCUMENT (0x03)
 #define BSONPP_ARRAY (0x04)
 #define BSONPP_BINARY (0x05)
+#define BSONPP_UNDEFINED (0x06)
+#define BSONPP_OBJECT_ID (0x07)
 #define BSONPP_BOOLEAN (0x08)
 #define BSONPP_DATETIME (0x09)
 #define BSONPP_NULL (0x0A)
+#define BSONPP_REGEX (0x0B)
+#define BSONPP_DB_POINTER (0x0C)
+#define BSONPP_JAVASCRIPT (0x0D)
+#define BSONPP_SYMBOL (0x0E)
+#define BSONPP_JAVASCRIPT_WITH_SCOPE (0x0F)
 #define BSONPP_INT32 (0x10)
+#define BSONPP_TIMESTAMP (0x11)
 #define BSONPP_INT64 (0x12)
+#define BSONPP_DECIMAL128 (0x13)
+#define BSONPP_MAX_KEY (0x7F)
+#define BSONPP_MIN_KEY (0xFF)
 
 #define BSONPP_BINARY_SUBTYPE_GENERIC (0x00)
+#define BSONPP_BINARY_SUBTYPE_FUNCTION (0x01)
+#define BSONPP_BINARY_SUBTYPE_BINARY_OLD (0x02)
+#define BSONPP_BINARY_SUBTYPE_UUID_OLD (0x03)
+#define BSONPP_BINARY_SUBTYPE_UUID (0x04)
+#define BSONPP_BINARY_SUBTYPE_MD5 (0x05)
+#define BSONPP_BINARY_SUBTYPE_ENCRYPTED (0x06)
+#define BSONPP_BINARY_SUBTYPE_COLUMN (0x07)
+#define BSONPP_BINARY_SUBTYPE_SENSITIVE (0x08)
+#define BSONPP_BINARY_SUBTYPE_USER_DEFINED (0x80)
+
+// Deepest nesting validate accepts by default, as MongoDB does.
+#define BSONPP_MAX_DEPTH (100)
+
+#define BSONPP_MERGE_KEEP_FIRST (0x00)
+#define BSONPP_MERGE_KEEP_SECOND (0x01)
+#define BSONPP_MERGE_FAIL (0x02)
+
 #define BSONPP_BOOLEAN_FALSE (0x00)
 #define BSONPP_BOOLEAN_TRUE (0x01)
 
+// An element as stored in a document. Value points at the encoded value, including any length prefix.
+struct BSONPPElement {
+    int32_t offset;
+    uint8_t type;
+    const char *key;
+    int32_t keyLength;
+    uint8_t *value;
+    int32_t valueSize;
+};
+
+// 4 byte big endian seconds, 5 random bytes unique to the process and a 3 byte big endian counter.
+struct BSONPPObjectId {
+    uint8_t bytes[12];
+};
+
+// MongoDB's internal replication timestamp.
+struct BSONPPTimestamp {
+    uint32_t increment;
+    uint32_t seconds;
+};
+
+// IEEE 754-2008 decimal, kept as the raw little endian bytes.
+struct BSONPPDecimal128 {
+    uint8_t bytes[16];
+};
+
+class BSONPP;
+class BSONPPMergeIndex;
+
+// Called for each document read. The document is only valid until the callback returns.
+typedef void (*BSONPPDocumentCallback)(BSONPP *doc, void *context);
+
 class BSONPP {
 public:
     BSONPP(uint8_t *buffer, int32_t length, bool clear = true);
@@ -36,10 +117,15 @@ public:
     uint8_t *getBuffer();
     int32_t getBufferSize();
     void clear();
+    // Checks every length, terminator and type of a document that came from outside, including its
+    // sub-documents nested up to maxDepth deep. The rest of the API trusts the document's structure so
+    // untrusted buffers must be validated first. Returns BSONPP_INVALID_DOCUMENT if anything's wrong.
+    int32_t validate(int32_t maxDepth = BSONPP_MAX_DEPTH);
     bool exists(const char *key);
     // Various functions for easy iteration.
     int32_t getKeyCount(int32_t *count);
-    int32_t getKeyAt(int32_t index, char **key);
+    // Lengths exclude the null terminator.
+    int32_t getKeyAt(int32_t index, char **key, int32_t *length = nullptr);
     int32_t getTypeAt(int32_t index, uint8_t *type);
 
     int32_t append(const char *key, int32_t val);
@@ -47,26 +133,137 @@ public:
     int32_t append(const char *key, double val);
     int32_t append(const char *key, const char *val);
     int32_t append(const char *key, BSONPP *val, bool isArray = false);
-    int32_t append(const char *key, const uint8_t *data, const int32_t length);
+    int32_t append(const char *key, const uint8_t *data, const int32_t length, uint8_t subtype = BSONPP_BINARY_SUBTYPE_GENERIC);
     int32_t append(const char *key, bool val);
+    int32_t append(const char *key, const BSONPPObjectId *val);
+    int32_t append(const char *key, const BSONPPTimestamp *val);
+    int32_t append(const char *key, const BSONPPDecimal128 *val);
 
     int32_t get(const char *key, int32_t *val);
     int32_t get(const char *key, int64_t *val);
     int32_t get(const char *key, double *val);
     int32_t get(const char *key, BSONPP *val);
-    int32_t get(const char *key, char **val);
-    int32_t get(const char *key, uint8_t **val, int32_t *length = nullptr);
+    // String lengths exclude the null terminator and are read from the document rather than counted.
+    int32_t get(const char *key, char **val, int32_t *length = nullptr);
+    int32_t get(const char *key, uint8_t **val, int32_t *length = nullptr, uint8_t *subtype = nullptr);
     int32_t get(const char *key, bool *val);
+    int32_t get(const char *key, BSONPPObjectId *val);
+    int32_t get(const char *key, BSONPPTimestamp *val);
+    int32_t get(const char *key, BSONPPDecimal128 *val);
+
+#ifdef BSONPP_HAS_STRING_VIEW
+    // Views point into the document's buffer.
+    int32_t getKeyAt(int32_t index, std::string_view *key);
+    int32_t get(const char *key, std::string_view *val);
+    int32_t getValue(int32_t offset, std::string_view *val);
+#endif // BSONPP_HAS_STRING_VIEW
+
+    // Element level iteration. Start with offset at 0, each call reads the element at offset and moves
+    // it to the next. Returns BSONPP_KEY_NOT_FOUND after the last element.
+    int32_t nextElement(int32_t *offset, BSONPPElement *element);
+    // Appends an element from any document, copying its encoded value as is.
+    int32_t appendElement(const BSONPPElement *element);
+    // Copies the element with key from another document, null values included.
+    int32_t appendElement(BSONPP *from, const char *key);
+    // Copies every element of other, or only those with keys in the set, or with exclude only those
+    // without. Consecutive elements are copied with a single memcpy. Nothing is appended on failure.
+    // If this document already has elements each copied key is checked against them, by walking them
+    // again per key unless an index is given to hold them, which then needs an entry per element here.
+    int32_t appendAllFrom(BSONPP *other, const BSONPPKeySet *keys = nullptr, bool exclude = false,
+                          BSONPPMergeIndex *index = nullptr);
+    // Appends every element of a and b. Keys keep their order from a followed by the keys only in b,
+    // policy picks the value for keys in both or with BSONPP_MERGE_FAIL returns BSONPP_DUPLICATE_KEY.
+    // The index needs an entry per element of b and of this document, BSONPP_OUT_OF_SPACE otherwise.
+    // Neither may be this document. Nothing is appended on failure.
+    int32_t merge(BSONPP *a, BSONPP *b, BSONPPMergeIndex *index, uint8_t policy = BSONPP_MERGE_KEEP_SECOND);
+
+    // Builds a sub-document directly in this document's buffer, avoiding the copy append makes.
+    // Nothing else may be appended to this document until endDocument is called with the child.
+    // If endDocument isn't called the sub-document is discarded and this document is left as it was.
+    int32_t beginDocument(const char *key, BSONPP *child, bool isArray = false);
+    int32_t endDocument(BSONPP *child);
+
+    // Appends a patch to this document which turns from into to. A patch is itself a document with
+    // an element per changed key. Added or changed keys have their new value, removed keys have the
+    // undefined type and changed sub-documents or arrays have a nested patch of the same type.
+    // Documents with the same key order are compared in a single walk.
+    int32_t diff(BSONPP *from, BSONPP *to);
+    // Appends the result of applying a patch from diff to base to this document. Keys keep the
+    // order from base with added keys after them.
+    int32_t applyPatch(BSONPP *base, BSONPP *patch);
+
+    // Content hash of the document. Equal numbers hash equally whatever their type, so an int32 1,
+    // an int64 1 and a double 1.0 match. With ignoreKeyOrder the hash of each key and value pair is
+    // combined commutatively so documents holding the same keys in a different order match too,
+    // including within sub-documents.
+    int32_t hash(uint64_t *result, bool ignoreKeyOrder = false, uint64_t seed = 0);
+    // Total order over documents following the BSON comparison rules: elements are compared in order
+    // by type class, then key, then value, with numbers compared by value across types.
+    // result is negative, zero or positive as this is less than, equal to or greater than other.
+    int32_t compare(BSONPP *other, int32_t *result);
+    // Compares the value of the element at offset with the one at otherOffset in other, by the same rules.
+    int32_t compareValue(int32_t offset, BSONPP *other, int32_t otherOffset, int32_t *result);
+    // 64 bit key for the value at offset that sorts like compareValue: if a value sorts before another its
+    // key is less than or equal to the other's. Equal keys only mean the values may be equal.
+    int32_t getSortKey(int32_t offset, uint64_t *key);
+
+    // Looks up every key in the set during a single pass over the document.
+    // offsets must have room for one entry per key, they're set to the element offset or
+    // BSONPP_KEY_NOT_FOUND/BSONPP_NULL_VALUE. Values can then be read with getValue.
+    int32_t find(const BSONPPKeySet *keys, int32_t *offsets);
+
+    // Finds the element named by a dotted path such as "device.id", descending into sub-documents and
+    // arrays. owner is set to the (sub-)document holding the element and offset to its offset there.
+    int32_t findPath(const char *path, BSONPP *owner, int32_t *offset);
+
+    // Getters for an element offset returned by find. Error offsets are passed through.
+    int32_t getValue(int32_t offset, int32_t *val);
+    int32_t getValue(int32_t offset, int64_t *val);
+    int32_t getValue(int32_t offset, double *val);
+    int32_t getValue(int32_t offset, BSONPP *val);
+    int32_t getValue(int32_t offset, char **val, int32_t *length = nullptr);
+    int32_t getValue(int32_t offset, uint8_t **val, int32_t *length = nullptr, uint8_t *subtype = nullptr);
+    int32_t getValue(int32_t offset, bool *val);
+    int32_t getValue(int32_t offset, BSONPPObjectId *val);
+    int32_t getValue(int32_t offset, BSONPPTimestamp *val);
+    int32_t getValue(int32_t offset, BSONPPDecimal128 *val);
+
+    // Writes an element's type, key and, for strings and binary, the length prefix and subtype.
+    // length is the size of the value that follows. Returns the number of bytes written,
+    // if out is null nothing is written and just the size is returned.
+    static int32_t writeElementHeader(uint8_t *out, const char *key, uint8_t type, int32_t length,
+        uint8_t subtype = BSONPP_BINARY_SUBTYPE_GENERIC);
 
 private:
-    int32_t appendInternal(const char *key, uint8_t type, const uint8_t *data, int32_t length);
-    int32_t getOffset(const char *key, uint8_t type = BSONPP_INVALID_TYPE);
+    int32_t appendInternal(const char *key, uint8_t type, const uint8_t *data, int32_t length,
+        uint8_t subtype = BSONPP_BINARY_SUBTYPE_GENERIC);
+    int32_t appendEncoded(uint8_t type, const char *key, int32_t keyLength, const uint8_t *value, int32_t size, bool checkDuplicate);
+    // Appends already encoded elements, and drops everything after size on failure.
+    int32_t appendRaw(const uint8_t *elements, int32_t length);
+    void truncate(int32_t size);
+    // foundKeyLength is set to the length of the key when it's found.
+    int32_t getOffset(const char *key, uint8_t type = BSONPP_INVALID_TYPE, int32_t *foundKeyLength = nullptr);
     int32_t getOffset(int32_t index);
     void setSize(int32_t size);
     // Type size is inclusive of the length field for variable length values.
     static int32_t getTypeSize(uint8_t type, uint8_t *data);
     static uint8_t getType(uint8_t *data);
-    static uint8_t *getData(uint8_t *data);
+    // Exact key comparison that also returns the element key's length.
+    static bool matchKey(const char *key, const char *elementKey, int32_t *elementKeyLength);
+    // Start of the value of the element at offset, null for error offsets. The key is measured unless
+    // its length is already known.
+    uint8_t *getData(int32_t offset, int32_t keyLength = -1);
+    // The getValue implementations, data is the start of the value from getData.
+    int32_t readValue(int32_t offset, uint8_t *data, int32_t *val);
+    int32_t readValue(int32_t offset, uint8_t *data, int64_t *val);
+    int32_t readValue(int32_t offset, uint8_t *data, double *val);
+    int32_t readValue(int32_t offset, uint8_t *data, BSONPP *val);
+    int32_t readValue(int32_t offset, uint8_t *data, char **val, int32_t *length);
+    int32_t readValue(int32_t offset, uint8_t *data, uint8_t **val, int32_t *length, uint8_t *subtype);
+    int32_t readValue(int32_t offset, uint8_t *data, bool *val);
+    int32_t readValue(int32_t offset, uint8_t *data, BSONPPObjectId *val);
+    int32_t readValue(int32_t offset, uint8_t *data, BSONPPTimestamp *val);
+    int32_t readValue(int32_t offset, uint8_t *data, BSONPPDecimal128 *val);
 
     uint8_t *m_buffer;
     int32_t m_length;
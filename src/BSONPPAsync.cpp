@@ -0,0 +1,580 @@
+#ifdef __LINUX_BUILD
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "BSONPPAsync.h"
+#include "BSONPPStats.h"
+#include "NetworkUtil.h"
+
+#ifdef BSONPP_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif // BSONPP_HAVE_IO_URING
+
+#if defined(BSONPP_HAVE_IO_URING) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define BSONPP_USE_IO_URING
+#endif
+
+// Smallest possible document, 4 length bytes and a 0x00 suffix.
+#define BSONPP_ASYNC_MIN_DOCUMENT (5)
+
+#define BSONPP_ASYNC_OP_READ (0)
+#define BSONPP_ASYNC_OP_WRITE (1)
+
+BSONPPAsyncQueue::BSONPPAsyncQueue():
+    m_ringFd(-1), m_sqRing(nullptr), m_sqRingSize(0), m_cqRing(nullptr), m_cqRingSize(0), m_sqes(nullptr), m_sqesSize(0),
+    m_sqHead(nullptr), m_sqTail(nullptr), m_sqMask(0), m_sqArray(nullptr), m_cqHead(nullptr), m_cqTail(nullptr), m_cqMask(0),
+    m_cqes(nullptr), m_unsubmitted(0), m_inFlight(0), m_syncCount(0) {}
+
+BSONPPAsyncQueue::~BSONPPAsyncQueue() {
+    this->release();
+}
+
+void BSONPPAsyncQueue::init(bool forceSync) {
+    this->release();
+    m_unsubmitted = 0;
+    m_inFlight = 0;
+    m_syncCount = 0;
+
+#ifdef BSONPP_USE_IO_URING
+    if (forceSync) {
+        return;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0x00, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, BSONPP_ASYNC_MAX_IN_FLIGHT, &params);
+    if (fd < 0) {
+        // Not supported or not permitted, stay synchronous.
+        return;
+    }
+    m_ringFd = fd;
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        m_sqRingSize = m_cqRingSize > m_sqRingSize ? m_cqRingSize : m_sqRingSize;
+        m_cqRingSize = m_sqRingSize;
+    }
+
+    void *sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        this->release();
+        return;
+    }
+    m_sqRing = static_cast<uint8_t *>(sqRing);
+
+    if (singleMap) {
+        m_cqRing = m_sqRing;
+    } else {
+        void *cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            this->release();
+            return;
+        }
+        m_cqRing = static_cast<uint8_t *>(cqRing);
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        this->release();
+        return;
+    }
+    m_sqes = sqes;
+
+    m_sqHead = reinterpret_cast<uint32_t *>(m_sqRing + params.sq_off.head);
+    m_sqTail = reinterpret_cast<uint32_t *>(m_sqRing + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<uint32_t *>(m_sqRing + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<uint32_t *>(m_sqRing + params.sq_off.array);
+    m_cqHead = reinterpret_cast<uint32_t *>(m_cqRing + params.cq_off.head);
+    m_cqTail = reinterpret_cast<uint32_t *>(m_cqRing + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<uint32_t *>(m_cqRing + params.cq_off.ring_mask);
+    m_cqes = m_cqRing + params.cq_off.cqes;
+#else
+    (void) forceSync;
+#endif // BSONPP_USE_IO_URING
+}
+
+bool BSONPPAsyncQueue::isAsync() {
+    return m_ringFd >= 0;
+}
+
+int32_t BSONPPAsyncQueue::read(int fd, uint8_t *buffer, int32_t length, off_t offset, int32_t userData) {
+    return this->queue(BSONPP_ASYNC_OP_READ, fd, buffer, length, offset, userData);
+}
+
+int32_t BSONPPAsyncQueue::write(int fd, const uint8_t *buffer, int32_t length, off_t offset, int32_t userData) {
+    return this->queue(BSONPP_ASYNC_OP_WRITE, fd, buffer, length, offset, userData);
+}
+
+int32_t BSONPPAsyncQueue::wait(int32_t *userData, int32_t *result) {
+    if (m_inFlight == 0) {
+        return BSONPP_INCOMPLETE;
+    }
+
+    if (!this->isAsync()) {
+        *userData = m_syncUserData[0];
+        *result = m_syncResults[0];
+        m_syncCount--;
+        memmove(m_syncUserData, m_syncUserData + 1, m_syncCount * sizeof(int32_t));
+        memmove(m_syncResults, m_syncResults + 1, m_syncCount * sizeof(int32_t));
+        BSONPP_COUNT(bytesMoved, 2 * m_syncCount * sizeof(int32_t));
+        m_inFlight--;
+        return BSONPP_SUCCESS;
+    }
+
+    // Hand everything queued to the kernel in one go before looking for completions.
+    if (m_unsubmitted > 0) {
+        int32_t res = this->submit(0);
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+    while (!this->reap(userData, result)) {
+        int32_t res = this->submit(1);
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+    m_inFlight--;
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPAsyncQueue::getInFlight() {
+    return m_inFlight;
+}
+
+// Private methods
+int32_t BSONPPAsyncQueue::queue(uint8_t opcode, int fd, const uint8_t *buffer, int32_t length, off_t offset, int32_t userData) {
+    // userData doubles as the iovec slot so it must be unique among operations in flight.
+    if (m_inFlight >= BSONPP_ASYNC_MAX_IN_FLIGHT || userData < 0 || userData >= BSONPP_ASYNC_MAX_IN_FLIGHT) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    if (!this->isAsync()) {
+        ssize_t res = 0;
+        do {
+            if (opcode == BSONPP_ASYNC_OP_READ) {
+                res = pread(fd, const_cast<uint8_t *>(buffer), length, offset);
+            } else {
+                res = pwrite(fd, buffer, length, offset);
+            }
+        } while (res < 0 && errno == EINTR);
+
+        m_syncUserData[m_syncCount] = userData;
+        m_syncResults[m_syncCount] = res < 0 ? -errno : res;
+        m_syncCount++;
+        m_inFlight++;
+        return BSONPP_SUCCESS;
+    }
+
+#ifdef BSONPP_USE_IO_URING
+    // This is the only producer so the tail can be read without synchronisation.
+    uint32_t tail = *m_sqTail;
+    uint32_t index = tail & m_sqMask;
+    struct io_uring_sqe *sqe = &static_cast<struct io_uring_sqe *>(m_sqes)[index];
+    memset(sqe, 0x00, sizeof(*sqe));
+
+    m_iovecs[userData].iov_base = const_cast<uint8_t *>(buffer);
+    m_iovecs[userData].iov_len = length;
+
+    sqe->opcode = opcode == BSONPP_ASYNC_OP_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&m_iovecs[userData]);
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = userData;
+
+    m_sqArray[index] = index;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    m_unsubmitted++;
+    m_inFlight++;
+#endif // BSONPP_USE_IO_URING
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPAsyncQueue::submit(uint32_t minComplete) {
+#ifdef BSONPP_USE_IO_URING
+    uint32_t flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int res = syscall(__NR_io_uring_enter, m_ringFd, m_unsubmitted, minComplete, flags, nullptr, 0);
+    if (res < 0) {
+        return errno == EINTR ? BSONPP_SUCCESS : BSONPP_IO_ERROR;
+    }
+    m_unsubmitted -= res;
+#else
+    (void) minComplete;
+#endif // BSONPP_USE_IO_URING
+    return BSONPP_SUCCESS;
+}
+
+bool BSONPPAsyncQueue::reap(int32_t *userData, int32_t *result) {
+#ifdef BSONPP_USE_IO_URING
+    uint32_t head = *m_cqHead;
+    uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return false;
+    }
+
+    struct io_uring_cqe *cqe = &static_cast<struct io_uring_cqe *>(m_cqes)[head & m_cqMask];
+    *userData = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+#else
+    (void) userData;
+    (void) result;
+    return false;
+#endif // BSONPP_USE_IO_URING
+}
+
+void BSONPPAsyncQueue::release() {
+#ifdef BSONPP_USE_IO_URING
+    if (m_sqes != nullptr) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing != nullptr && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing != nullptr) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+#endif // BSONPP_USE_IO_URING
+    if (m_ringFd >= 0) {
+        close(m_ringFd);
+    }
+    m_ringFd = -1;
+    m_sqRing = nullptr;
+    m_cqRing = nullptr;
+    m_sqes = nullptr;
+}
+
+BSONPPAsyncReader::BSONPPAsyncReader(uint8_t *pool, int32_t bufferSize, int32_t bufferCount, uint8_t *carry, int32_t carryLength):
+    m_pool(pool), m_bufferSize(bufferSize), m_bufferCount(bufferCount), m_carry(carry), m_carryLength(carryLength), m_carryUsed(0) {
+    if (m_bufferCount > BSONPP_ASYNC_MAX_IN_FLIGHT) {
+        m_bufferCount = BSONPP_ASYNC_MAX_IN_FLIGHT;
+    }
+}
+
+void BSONPPAsyncReader::init(bool forceSync) {
+    m_queue.init(forceSync);
+}
+
+bool BSONPPAsyncReader::isAsync() {
+    return m_queue.isAsync();
+}
+
+int32_t BSONPPAsyncReader::read(int fd, off_t offset, BSONPPDocumentCallback callback, void *context) {
+    m_carryUsed = 0;
+
+    // Buffer n always holds chunk n modulo the buffer count.
+    int32_t res = BSONPP_SUCCESS;
+    int64_t nextChunk = 0;
+    for (; nextChunk < m_bufferCount && res == BSONPP_SUCCESS; nextChunk++) {
+        m_completed[nextChunk] = -1;
+        res = m_queue.read(fd, m_pool + nextChunk * m_bufferSize, m_bufferSize, offset + nextChunk * m_bufferSize, nextChunk);
+    }
+
+    int64_t chunk = 0;
+    bool done = false;
+    while (res == BSONPP_SUCCESS && !done) {
+        int32_t buffer = chunk % m_bufferCount;
+        uint8_t *data = m_pool + buffer * m_bufferSize;
+
+        // Completions arrive in any order but chunks are parsed in file order.
+        while (res == BSONPP_SUCCESS && m_completed[buffer] < 0) {
+            int32_t userData = 0;
+            int32_t result = 0;
+            res = m_queue.wait(&userData, &result);
+            if (res == BSONPP_SUCCESS && result < 0) {
+                res = BSONPP_IO_ERROR;
+            }
+            if (res == BSONPP_SUCCESS) {
+                m_completed[userData] = result;
+            }
+        }
+        if (res != BSONPP_SUCCESS) {
+            break;
+        }
+
+        // A short read normally means the end of the file, but may just be short, so finish it
+        // synchronously. A read returning nothing is the real end.
+        int32_t length = m_completed[buffer];
+        off_t chunkOffset = offset + chunk * m_bufferSize;
+        while (length > 0 && length < m_bufferSize) {
+            ssize_t extra = pread(fd, data + length, m_bufferSize - length, chunkOffset + length);
+            if (extra < 0 && errno == EINTR) {
+                continue;
+            }
+            if (extra < 0) {
+                res = BSONPP_IO_ERROR;
+            }
+            if (extra <= 0) {
+                break;
+            }
+            length += extra;
+        }
+        if (res != BSONPP_SUCCESS) {
+            break;
+        }
+
+        res = this->parse(data, length, callback, context);
+        if (length < m_bufferSize) {
+            done = true;
+        } else if (res == BSONPP_SUCCESS) {
+            // Recycle the buffer for the next unread chunk.
+            m_completed[buffer] = -1;
+            res = m_queue.read(fd, data, m_bufferSize, offset + nextChunk * m_bufferSize, buffer);
+            nextChunk++;
+            chunk++;
+        }
+    }
+
+    // Reads past the end of the file may still be in flight and must finish before the pool
+    // is handed back to the caller.
+    while (m_queue.getInFlight() > 0) {
+        int32_t userData = 0;
+        int32_t result = 0;
+        if (m_queue.wait(&userData, &result) != BSONPP_SUCCESS) {
+            return BSONPP_IO_ERROR;
+        }
+    }
+
+    if (res == BSONPP_SUCCESS && m_carryUsed > 0) {
+        // The file ends part way through a document.
+        return BSONPP_INVALID_DOCUMENT;
+    }
+    return res;
+}
+
+// Private methods
+int32_t BSONPPAsyncReader::parse(uint8_t *data, int32_t length, BSONPPDocumentCallback callback, void *context) {
+    int32_t offset = 0;
+
+    // Finish any document carried over from the previous chunk first.
+    if (m_carryUsed > 0) {
+        int32_t res = this->carry(data, length, &offset);
+        if (res == BSONPP_INCOMPLETE) {
+            return BSONPP_SUCCESS;
+        }
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+        BSONPP doc(m_carry, m_carryUsed, false);
+        callback(&doc, context);
+        m_carryUsed = 0;
+    }
+
+    while (offset < length) {
+        int32_t remaining = length - offset;
+        if (remaining < static_cast<int32_t>(sizeof(int32_t))) {
+            break;
+        }
+
+        int32_t size = 0;
+        memcpy(&size, data + offset, sizeof(int32_t));
+        size = letoh32(size);
+        if (size < BSONPP_ASYNC_MIN_DOCUMENT) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+        if (size > remaining) {
+            break;
+        }
+        if (data[offset + size - 1] != 0x00) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+
+        BSONPP doc(data + offset, size, false);
+        callback(&doc, context);
+        offset += size;
+    }
+
+    if (offset < length) {
+        int32_t used = 0;
+        int32_t res = this->carry(data + offset, length - offset, &used);
+        if (res != BSONPP_INCOMPLETE) {
+            // Anything other than needing more data means the size was invalid.
+            return BSONPP_INVALID_DOCUMENT;
+        }
+    }
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPAsyncReader::carry(const uint8_t *data, int32_t length, int32_t *used) {
+    int32_t consumed = 0;
+
+    // The length prefix first so the document size is known.
+    if (m_carryUsed < static_cast<int32_t>(sizeof(int32_t))) {
+        int32_t needed = sizeof(int32_t) - m_carryUsed;
+        int32_t count = needed < length ? needed : length;
+        memcpy(m_carry + m_carryUsed, data, count);
+        m_carryUsed += count;
+        consumed += count;
+        if (m_carryUsed < static_cast<int32_t>(sizeof(int32_t))) {
+            *used = consumed;
+            return BSONPP_INCOMPLETE;
+        }
+    }
+
+    int32_t size = 0;
+    memcpy(&size, m_carry, sizeof(int32_t));
+    size = letoh32(size);
+    if (size < BSONPP_ASYNC_MIN_DOCUMENT || size > m_carryLength) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+
+    int32_t needed = size - m_carryUsed;
+    int32_t count = needed < length - consumed ? needed : length - consumed;
+    memcpy(m_carry + m_carryUsed, data + consumed, count);
+    m_carryUsed += count;
+    consumed += count;
+    *used = consumed;
+
+    if (m_carryUsed < size) {
+        return BSONPP_INCOMPLETE;
+    }
+    if (m_carry[size - 1] != 0x00) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+
+    return BSONPP_SUCCESS;
+}
+
+BSONPPAsyncWriter::BSONPPAsyncWriter(uint8_t *pool, int32_t bufferSize, int32_t bufferCount):
+    m_pool(pool), m_bufferSize(bufferSize), m_bufferCount(bufferCount), m_fd(-1), m_offset(0), m_current(-1),
+    m_currentUsed(0), m_error(BSONPP_SUCCESS) {
+    if (m_bufferCount > BSONPP_ASYNC_MAX_IN_FLIGHT) {
+        m_bufferCount = BSONPP_ASYNC_MAX_IN_FLIGHT;
+    }
+    memset(m_submitted, 0x00, sizeof(m_submitted));
+}
+
+void BSONPPAsyncWriter::init(bool forceSync) {
+    m_queue.init(forceSync);
+}
+
+bool BSONPPAsyncWriter::isAsync() {
+    return m_queue.isAsync();
+}
+
+void BSONPPAsyncWriter::begin(int fd, off_t offset) {
+    m_fd = fd;
+    m_offset = offset;
+    m_current = -1;
+    m_currentUsed = 0;
+    m_error = BSONPP_SUCCESS;
+}
+
+int32_t BSONPPAsyncWriter::write(BSONPP *doc) {
+    int32_t size = doc->getSize();
+    if (size > m_bufferSize) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    if (m_current >= 0 && m_currentUsed + size > m_bufferSize) {
+        int32_t res = this->submitCurrent();
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+
+    if (m_current < 0) {
+        int32_t buffer = this->acquire();
+        if (buffer < 0) {
+            return buffer;
+        }
+        m_current = buffer;
+        m_currentUsed = 0;
+    }
+
+    memcpy(m_pool + m_current * m_bufferSize + m_currentUsed, doc->getBuffer(), size);
+    m_currentUsed += size;
+
+    return m_error;
+}
+
+int32_t BSONPPAsyncWriter::flush() {
+    if (m_current >= 0 && m_currentUsed > 0) {
+        int32_t res = this->submitCurrent();
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+
+    while (m_queue.getInFlight() > 0) {
+        int32_t buffer = 0;
+        int32_t result = 0;
+        if (m_queue.wait(&buffer, &result) != BSONPP_SUCCESS) {
+            return BSONPP_IO_ERROR;
+        }
+        this->complete(buffer, result);
+    }
+
+    return m_error;
+}
+
+// Private methods
+int32_t BSONPPAsyncWriter::submitCurrent() {
+    int32_t res = m_queue.write(m_fd, m_pool + m_current * m_bufferSize, m_currentUsed, m_offset, m_current);
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    m_submitted[m_current] = m_currentUsed;
+    m_offsets[m_current] = m_offset;
+    m_offset += m_currentUsed;
+    m_current = -1;
+    m_currentUsed = 0;
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPAsyncWriter::acquire() {
+    while (true) {
+        for (int32_t i = 0; i < m_bufferCount; i++) {
+            if (m_submitted[i] == 0) {
+                return i;
+            }
+        }
+
+        // Every buffer is being written, wait for one to come back.
+        int32_t buffer = 0;
+        int32_t result = 0;
+        if (m_queue.wait(&buffer, &result) != BSONPP_SUCCESS) {
+            return BSONPP_IO_ERROR;
+        }
+        this->complete(buffer, result);
+    }
+}
+
+int32_t BSONPPAsyncWriter::complete(int32_t buffer, int32_t result) {
+    if (result < 0) {
+        m_error = BSONPP_IO_ERROR;
+    } else {
+        // Short writes are rare so the rest is written synchronously.
+        const uint8_t *data = m_pool + buffer * m_bufferSize;
+        int32_t written = result;
+        while (written < m_submitted[buffer] && m_error == BSONPP_SUCCESS) {
+            ssize_t res = pwrite(m_fd, data + written, m_submitted[buffer] - written, m_offsets[buffer] + written);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (res <= 0) {
+                m_error = BSONPP_IO_ERROR;
+                break;
+            }
+            written += res;
+        }
+    }
+
+    m_submitted[buffer] = 0;
+    return m_error;
+}
+
+#endif // __LINUX_BUILD
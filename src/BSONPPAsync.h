@@ -0,0 +1,141 @@
+#ifndef __BSONPP_ASYNC_H__
+#define __BSONPP_ASYNC_H__
+
+#ifdef __LINUX_BUILD
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "BSONPP.h"
+
+// Maximum number of reads or writes in flight at once.
+#define BSONPP_ASYNC_MAX_IN_FLIGHT (64)
+
+/**
+ * Minimal io_uring submission and completion queue using the raw syscalls.
+ * When io_uring isn't available, either at build time or because the kernel refuses it,
+ * operations are performed synchronously with preadv/pwritev at submission and their
+ * completions queued so callers don't need a separate code path.
+ */
+class BSONPPAsyncQueue {
+public:
+    BSONPPAsyncQueue();
+    ~BSONPPAsyncQueue();
+
+    // Sets up the ring, falling back to synchronous IO unless forceSync is false and it succeeds.
+    void init(bool forceSync = false);
+    bool isAsync();
+
+    // Queues a read or write of length bytes at offset. userData is returned with the completion.
+    // Returns BSONPP_OUT_OF_SPACE if BSONPP_ASYNC_MAX_IN_FLIGHT operations are already queued.
+    int32_t read(int fd, uint8_t *buffer, int32_t length, off_t offset, int32_t userData);
+    int32_t write(int fd, const uint8_t *buffer, int32_t length, off_t offset, int32_t userData);
+    // Waits for a completion, result is the bytes transferred or -errno.
+    int32_t wait(int32_t *userData, int32_t *result);
+    int32_t getInFlight();
+
+private:
+    int32_t queue(uint8_t opcode, int fd, const uint8_t *buffer, int32_t length, off_t offset, int32_t userData);
+    int32_t submit(uint32_t minComplete);
+    bool reap(int32_t *userData, int32_t *result);
+    void release();
+
+    int m_ringFd;
+    uint8_t *m_sqRing;
+    size_t m_sqRingSize;
+    uint8_t *m_cqRing;
+    size_t m_cqRingSize;
+    void *m_sqes;
+    size_t m_sqesSize;
+    uint32_t *m_sqHead;
+    uint32_t *m_sqTail;
+    uint32_t m_sqMask;
+    uint32_t *m_sqArray;
+    uint32_t *m_cqHead;
+    uint32_t *m_cqTail;
+    uint32_t m_cqMask;
+    void *m_cqes;
+    uint32_t m_unsubmitted;
+
+    int32_t m_inFlight;
+    // Per operation iovecs for the vectored ops, and synchronous completions when not async.
+    struct iovec m_iovecs[BSONPP_ASYNC_MAX_IN_FLIGHT];
+    int32_t m_syncUserData[BSONPP_ASYNC_MAX_IN_FLIGHT];
+    int32_t m_syncResults[BSONPP_ASYNC_MAX_IN_FLIGHT];
+    int32_t m_syncCount;
+};
+
+/**
+ * Reads a file of concatenated BSON documents with several reads in flight.
+ * The file is read in bufferSize chunks into a fixed pool of bufferCount buffers, each chunk is
+ * parsed in file order and documents are handed to the callback as views into the pool. The
+ * occasional document spanning two chunks is assembled in the carry buffer, which must be as
+ * large as the largest document. Buffers are recycled for the next chunk once parsed.
+ */
+class BSONPPAsyncReader {
+public:
+    // pool must be bufferSize * bufferCount bytes, bufferCount at most BSONPP_ASYNC_MAX_IN_FLIGHT.
+    BSONPPAsyncReader(uint8_t *pool, int32_t bufferSize, int32_t bufferCount, uint8_t *carry, int32_t carryLength);
+
+    void init(bool forceSync = false);
+    bool isAsync();
+    // Reads every document in fd from offset onwards. Returns BSONPP_SUCCESS at the end of the
+    // file, BSONPP_INVALID_DOCUMENT if a document is corrupt or truncated or BSONPP_IO_ERROR.
+    int32_t read(int fd, off_t offset, BSONPPDocumentCallback callback, void *context);
+
+private:
+    int32_t parse(uint8_t *data, int32_t length, BSONPPDocumentCallback callback, void *context);
+    int32_t carry(const uint8_t *data, int32_t length, int32_t *used);
+
+    BSONPPAsyncQueue m_queue;
+    uint8_t *m_pool;
+    int32_t m_bufferSize;
+    int32_t m_bufferCount;
+    uint8_t *m_carry;
+    int32_t m_carryLength;
+    int32_t m_carryUsed;
+    // Completed read sizes per buffer, negative while the read is in flight.
+    int32_t m_completed[BSONPP_ASYNC_MAX_IN_FLIGHT];
+};
+
+/**
+ * Writes documents to a file with several writes in flight. Documents are copied into pool
+ * buffers and a buffer is submitted once the next document won't fit, at which point the next
+ * free buffer is used, waiting for a write to complete if none are free.
+ */
+class BSONPPAsyncWriter {
+public:
+    // pool must be bufferSize * bufferCount bytes, bufferCount at most BSONPP_ASYNC_MAX_IN_FLIGHT.
+    BSONPPAsyncWriter(uint8_t *pool, int32_t bufferSize, int32_t bufferCount);
+
+    void init(bool forceSync = false);
+    bool isAsync();
+    // Documents are written to fd starting at offset.
+    void begin(int fd, off_t offset);
+    // Returns BSONPP_OUT_OF_SPACE if the document is larger than a buffer.
+    int32_t write(BSONPP *doc);
+    // Submits anything buffered and waits until every write completes.
+    int32_t flush();
+
+private:
+    int32_t submitCurrent();
+    int32_t acquire();
+    int32_t complete(int32_t buffer, int32_t result);
+
+    BSONPPAsyncQueue m_queue;
+    uint8_t *m_pool;
+    int32_t m_bufferSize;
+    int32_t m_bufferCount;
+    int m_fd;
+    off_t m_offset;
+    int32_t m_current;
+    int32_t m_currentUsed;
+    int32_t m_error;
+    // Bytes submitted per buffer and their file offsets, 0 when free.
+    int32_t m_submitted[BSONPP_ASYNC_MAX_IN_FLIGHT];
+    off_t m_offsets[BSONPP_ASYNC_MAX_IN_FLIGHT];
+};
+
+#endif // __LINUX_BUILD
+
+#endif // __BSONPP_ASYNC_H__
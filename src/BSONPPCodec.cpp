@@ -0,0 +1,614 @@
+#include <string.h>
+#include "BSONPPCodec.h"
+#include "NetworkUtil.h"
+
+// Marks an empty hash table slot.
+#define BSONPP_DICTIONARY_EMPTY_SLOT (0xFFFF)
+// Key references below this are followed by the key itself.
+#define BSONPP_KEY_LITERAL_LEARN (0)
+#define BSONPP_KEY_LITERAL (1)
+#define BSONPP_KEY_ID_BASE (2)
+
+// LZ4 block format limits.
+#define BSONPP_BLOCK_MIN_MATCH (4)
+#define BSONPP_BLOCK_LAST_LITERALS (5)
+#define BSONPP_BLOCK_MATCH_FIND_LIMIT (12)
+// Longer lengths than this are treated as corrupt rather than risk overflowing.
+#define BSONPP_BLOCK_MAX_LENGTH (0x7FFFFF00)
+
+static uint32_t hashKey(const char *key, int32_t length) {
+    uint32_t hash = 2166136261u;
+    for (int32_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<uint8_t>(key[i])) * 16777619u;
+    }
+    return hash;
+}
+
+static bool writeVarint(uint8_t *out, int32_t outLength, int32_t *position, uint32_t value) {
+    do {
+        if (*position >= outLength) {
+            return false;
+        }
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        out[(*position)++] = value > 0 ? byte | 0x80 : byte;
+    } while (value > 0);
+    return true;
+}
+
+static bool readVarint(const uint8_t *in, int32_t inLength, int32_t *position, uint32_t *value) {
+    *value = 0;
+    for (int32_t shift = 0; shift < 35; shift += 7) {
+        if (*position >= inLength) {
+            return false;
+        }
+        uint8_t byte = in[(*position)++];
+        *value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool writeBytes(uint8_t *out, int32_t outLength, int32_t *position, const void *data, int32_t length) {
+    if (length > outLength - *position) {
+        return false;
+    }
+    memcpy(out + *position, data, length);
+    *position += length;
+    return true;
+}
+
+// Array keys are the element's index in decimal.
+static int32_t formatIndex(int32_t index, char *key) {
+    char reversed[11];
+    int32_t length = 0;
+    do {
+        reversed[length++] = '0' + index % 10;
+        index /= 10;
+    } while (index > 0);
+    for (int32_t i = 0; i < length; i++) {
+        key[i] = reversed[length - 1 - i];
+    }
+    key[length] = 0;
+    return length;
+}
+
+// Size of the values copied unchanged, -1 for values the codec handles itself or doesn't know.
+static int32_t getFixedSize(uint8_t type) {
+    switch (type) {
+        case BSONPP_DECIMAL128:
+            return 16;
+        case BSONPP_OBJECT_ID:
+            return 12;
+        case BSONPP_DOUBLE: // Fallthrough
+        case BSONPP_INT64: // Fallthrough
+        case BSONPP_DATETIME: // Fallthrough
+        case BSONPP_TIMESTAMP:
+            return 8;
+        case BSONPP_INT32:
+            return 4;
+        case BSONPP_BOOLEAN:
+            return 1;
+        case BSONPP_NULL: // Fallthrough
+        case BSONPP_UNDEFINED: // Fallthrough
+        case BSONPP_MIN_KEY: // Fallthrough
+        case BSONPP_MAX_KEY:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Types laid out like strings.
+static bool isStringLike(uint8_t type) {
+    return type == BSONPP_STRING || type == BSONPP_SYMBOL || type == BSONPP_JAVASCRIPT;
+}
+
+// Rare types copied whole after a varint size.
+static bool isRaw(uint8_t type) {
+    return type == BSONPP_REGEX || type == BSONPP_DB_POINTER || type == BSONPP_JAVASCRIPT_WITH_SCOPE;
+}
+
+// Checks a raw value's own structure so the decoded document can be walked safely.
+static bool isValidRaw(uint8_t type, const uint8_t *value, uint32_t size) {
+    int32_t prefix = 0;
+    if (type == BSONPP_REGEX) {
+        // Two null terminated strings, the second ending the value.
+        const uint8_t *end = static_cast<const uint8_t *>(memchr(value, 0, size));
+        return end != nullptr && static_cast<uint32_t>(end - value) + 1 < size && value[size - 1] == 0x00 &&
+            memchr(end + 1, 0, size - (end - value) - 1) == value + size - 1;
+    }
+    if (size < sizeof(int32_t)) {
+        return false;
+    }
+    memcpy(&prefix, value, sizeof(int32_t));
+    prefix = letoh32(prefix);
+    if (type == BSONPP_DB_POINTER) {
+        // A string then a 12 byte ObjectId.
+        return prefix > 0 && static_cast<uint32_t>(prefix) + sizeof(int32_t) + 12 == size;
+    }
+    // JavaScript with scope, the prefix is the whole size.
+    return static_cast<uint32_t>(prefix) == size;
+}
+
+BSONPPKeyDictionary::BSONPPKeyDictionary(char *storage, uint16_t storageLength, uint16_t *offsets, uint16_t maxKeys,
+    uint16_t *slots, uint16_t slotCount): m_storage(storage), m_storageLength(storageLength), m_offsets(offsets),
+    m_maxKeys(maxKeys), m_slots(slots), m_slotCount(slotCount), m_count(0) {
+    this->clear();
+}
+
+void BSONPPKeyDictionary::clear() {
+    m_count = 0;
+    if (m_slots != nullptr) {
+        memset(m_slots, 0xFF, m_slotCount * sizeof(uint16_t));
+    }
+}
+
+int32_t BSONPPKeyDictionary::add(const char *key, int32_t length) {
+    // Offsets are where each key ends, keys are stored with their null terminator.
+    int32_t start = m_count == 0 ? 0 : m_offsets[m_count - 1];
+    // The hash table always keeps an empty slot so probing ends.
+    if (m_count >= m_maxKeys || start + length + 1 > m_storageLength ||
+        (m_slots != nullptr && m_count + 1 >= m_slotCount)) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    memcpy(m_storage + start, key, length);
+    m_storage[start + length] = 0;
+    m_offsets[m_count] = start + length + 1;
+    if (m_slots != nullptr) {
+        this->insertSlot(m_count, hashKey(key, length));
+    }
+
+    return m_count++;
+}
+
+void BSONPPKeyDictionary::insertSlot(int32_t id, uint32_t hash) {
+    uint16_t mask = m_slotCount - 1;
+    uint16_t slot = hash & mask;
+    while (m_slots[slot] != BSONPP_DICTIONARY_EMPTY_SLOT) {
+        slot = (slot + 1) & mask;
+    }
+    m_slots[slot] = id;
+}
+
+int32_t BSONPPKeyDictionary::find(const char *key, int32_t length) {
+    if (m_slots == nullptr) {
+        for (int32_t id = 0; id < m_count; id++) {
+            int32_t keyLength = 0;
+            const char *stored = this->getKey(id, &keyLength);
+            if (keyLength == length && memcmp(stored, key, length) == 0) {
+                return id;
+            }
+        }
+        return BSONPP_KEY_NOT_FOUND;
+    }
+
+    uint16_t mask = m_slotCount - 1;
+    uint16_t slot = hashKey(key, length) & mask;
+    while (m_slots[slot] != BSONPP_DICTIONARY_EMPTY_SLOT) {
+        int32_t keyLength = 0;
+        const char *stored = this->getKey(m_slots[slot], &keyLength);
+        if (keyLength == length && memcmp(stored, key, length) == 0) {
+            return m_slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    return BSONPP_KEY_NOT_FOUND;
+}
+
+const char *BSONPPKeyDictionary::getKey(int32_t id, int32_t *length) {
+    if (id < 0 || id >= m_count) {
+        return nullptr;
+    }
+    int32_t start = id == 0 ? 0 : m_offsets[id - 1];
+    *length = m_offsets[id] - start - 1;
+    return m_storage + start;
+}
+
+int32_t BSONPPKeyDictionary::getCount() {
+    return m_count;
+}
+
+void BSONPPKeyDictionary::truncate(int32_t count) {
+    if (count >= m_count) {
+        return;
+    }
+    m_count = count;
+    if (m_slots != nullptr) {
+        memset(m_slots, 0xFF, m_slotCount * sizeof(uint16_t));
+        for (int32_t id = 0; id < m_count; id++) {
+            int32_t length = 0;
+            const char *key = this->getKey(id, &length);
+            this->insertSlot(id, hashKey(key, length));
+        }
+    }
+}
+
+BSONPPKeyEncoder::BSONPPKeyEncoder(BSONPPKeyDictionary *dictionary, bool learn): m_dictionary(dictionary), m_learn(learn) {}
+
+int32_t BSONPPKeyEncoder::encode(BSONPP *doc, uint8_t *out, int32_t outLength, int32_t *written) {
+    int32_t count = m_dictionary->getCount();
+    int32_t position = 0;
+    int32_t res = this->encodeDocument(doc, false, 0, out, outLength, &position);
+    if (res != BSONPP_SUCCESS) {
+        m_dictionary->truncate(count);
+        return res;
+    }
+    *written = position;
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPKeyEncoder::encodeDocument(BSONPP *doc, bool isArray, int32_t depth, uint8_t *out, int32_t outLength, int32_t *position) {
+    if (depth > BSONPP_CODEC_MAX_DEPTH) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+
+    int32_t offset = 0;
+    int32_t index = 0;
+    BSONPPElement element;
+    int32_t res = BSONPP_SUCCESS;
+    while ((res = doc->nextElement(&offset, &element)) == BSONPP_SUCCESS) {
+        if (!writeBytes(out, outLength, position, &element.type, 1)) {
+            return BSONPP_OUT_OF_SPACE;
+        }
+
+        if (isArray) {
+            char key[12];
+            int32_t keyLength = formatIndex(index++, key);
+            if (keyLength != element.keyLength || memcmp(key, element.key, keyLength) != 0) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+        } else {
+            int32_t id = m_dictionary->find(element.key, element.keyLength);
+            if (id < 0 && m_learn) {
+                // Full dictionaries write the key each time without learning it.
+                id = m_dictionary->add(element.key, element.keyLength);
+                if (!writeVarint(out, outLength, position, id < 0 ? BSONPP_KEY_LITERAL : BSONPP_KEY_LITERAL_LEARN) ||
+                    !writeBytes(out, outLength, position, element.key, element.keyLength + 1)) {
+                    return BSONPP_OUT_OF_SPACE;
+                }
+            } else if (id < 0) {
+                if (!writeVarint(out, outLength, position, BSONPP_KEY_LITERAL) ||
+                    !writeBytes(out, outLength, position, element.key, element.keyLength + 1)) {
+                    return BSONPP_OUT_OF_SPACE;
+                }
+            } else if (!writeVarint(out, outLength, position, id + BSONPP_KEY_ID_BASE)) {
+                return BSONPP_OUT_OF_SPACE;
+            }
+        }
+
+        int32_t fixedSize = getFixedSize(element.type);
+        bool written = true;
+        if (fixedSize >= 0) {
+            written = writeBytes(out, outLength, position, element.value, fixedSize);
+        } else if (isStringLike(element.type)) {
+            // The length prefix includes the null terminator, which isn't sent.
+            int32_t length = element.valueSize - sizeof(int32_t) - 1;
+            written = writeVarint(out, outLength, position, length) &&
+                writeBytes(out, outLength, position, element.value + sizeof(int32_t), length);
+        } else if (element.type == BSONPP_BINARY) {
+            // The subtype follows the length.
+            int32_t length = element.valueSize - sizeof(int32_t) - 1;
+            written = writeVarint(out, outLength, position, length) &&
+                writeBytes(out, outLength, position, element.value + sizeof(int32_t), length + 1);
+        } else if (isRaw(element.type)) {
+            written = writeVarint(out, outLength, position, element.valueSize) &&
+                writeBytes(out, outLength, position, element.value, element.valueSize);
+        } else if (element.type == BSONPP_DOCUMENT || element.type == BSONPP_ARRAY) {
+            BSONPP child;
+            doc->getValue(element.offset, &child);
+            res = this->encodeDocument(&child, element.type == BSONPP_ARRAY, depth + 1, out, outLength, position);
+            if (res != BSONPP_SUCCESS) {
+                return res;
+            }
+        } else {
+            return BSONPP_INCORRECT_TYPE;
+        }
+        if (!written) {
+            return BSONPP_OUT_OF_SPACE;
+        }
+    }
+    if (res != BSONPP_KEY_NOT_FOUND) {
+        return res;
+    }
+
+    uint8_t terminator = BSONPP_INVALID_TYPE;
+    return writeBytes(out, outLength, position, &terminator, 1) ? BSONPP_SUCCESS : BSONPP_OUT_OF_SPACE;
+}
+
+BSONPPKeyDecoder::BSONPPKeyDecoder(BSONPPKeyDictionary *dictionary): m_dictionary(dictionary) {}
+
+int32_t BSONPPKeyDecoder::decode(const uint8_t *in, int32_t inLength, uint8_t *out, int32_t outLength, BSONPP *doc, int32_t *consumed) {
+    int32_t count = m_dictionary->getCount();
+    int32_t inPosition = 0;
+    int32_t outPosition = 0;
+    int32_t res = this->decodeDocument(in, inLength, &inPosition, false, 0, out, outLength, &outPosition);
+    if (res != BSONPP_SUCCESS) {
+        m_dictionary->truncate(count);
+        return res;
+    }
+
+    *doc = BSONPP(out, outLength, false);
+    *consumed = inPosition;
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPKeyDecoder::decodeDocument(const uint8_t *in, int32_t inLength, int32_t *inPosition, bool isArray, int32_t depth,
+    uint8_t *out, int32_t outLength, int32_t *outPosition) {
+    if (depth > BSONPP_CODEC_MAX_DEPTH) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+
+    // The length is filled in at the end.
+    int32_t start = *outPosition;
+    if (outLength - start < static_cast<int32_t>(sizeof(int32_t))) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+    *outPosition += sizeof(int32_t);
+
+    for (int32_t index = 0; ; index++) {
+        if (*inPosition >= inLength) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+        uint8_t type = in[(*inPosition)++];
+        if (!writeBytes(out, outLength, outPosition, &type, 1)) {
+            return BSONPP_OUT_OF_SPACE;
+        }
+        if (type == BSONPP_INVALID_TYPE) {
+            int32_t size = htole32(*outPosition - start);
+            memcpy(out + start, &size, sizeof(int32_t));
+            return BSONPP_SUCCESS;
+        }
+
+        // Key.
+        if (isArray) {
+            char key[12];
+            int32_t keyLength = formatIndex(index, key);
+            if (!writeBytes(out, outLength, outPosition, key, keyLength + 1)) {
+                return BSONPP_OUT_OF_SPACE;
+            }
+        } else {
+            uint32_t reference = 0;
+            if (!readVarint(in, inLength, inPosition, &reference)) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            const char *key = nullptr;
+            int32_t keyLength = 0;
+            if (reference < BSONPP_KEY_ID_BASE) {
+                key = reinterpret_cast<const char *>(in + *inPosition);
+                const void *end = memchr(key, 0, inLength - *inPosition);
+                if (end == nullptr) {
+                    return BSONPP_INVALID_DOCUMENT;
+                }
+                keyLength = static_cast<const char *>(end) - key;
+                *inPosition += keyLength + 1;
+                // A smaller dictionary than the encoder's can't keep up.
+                if (reference == BSONPP_KEY_LITERAL_LEARN && m_dictionary->add(key, keyLength) < 0) {
+                    return BSONPP_OUT_OF_SPACE;
+                }
+            } else {
+                key = m_dictionary->getKey(reference - BSONPP_KEY_ID_BASE, &keyLength);
+                if (key == nullptr) {
+                    return BSONPP_INVALID_DOCUMENT;
+                }
+            }
+            if (!writeBytes(out, outLength, outPosition, key, keyLength + 1)) {
+                return BSONPP_OUT_OF_SPACE;
+            }
+        }
+
+        // Value.
+        int32_t fixedSize = getFixedSize(type);
+        if (fixedSize >= 0) {
+            if (fixedSize > inLength - *inPosition) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            if (!writeBytes(out, outLength, outPosition, in + *inPosition, fixedSize)) {
+                return BSONPP_OUT_OF_SPACE;
+            }
+            *inPosition += fixedSize;
+        } else if (isStringLike(type) || type == BSONPP_BINARY) {
+            uint32_t length = 0;
+            // Binary has the subtype after the length.
+            int32_t extra = type == BSONPP_BINARY ? 1 : 0;
+            if (!readVarint(in, inLength, inPosition, &length) || inLength - *inPosition - extra < 0 ||
+                length > static_cast<uint32_t>(inLength - *inPosition - extra)) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            // Strings store their null terminator in the length.
+            int32_t prefix = htole32(static_cast<int32_t>(length) + 1 - extra);
+            uint8_t terminator = 0x00;
+            if (!writeBytes(out, outLength, outPosition, &prefix, sizeof(int32_t)) ||
+                !writeBytes(out, outLength, outPosition, in + *inPosition, length + extra) ||
+                (type != BSONPP_BINARY && !writeBytes(out, outLength, outPosition, &terminator, 1))) {
+                return BSONPP_OUT_OF_SPACE;
+            }
+            *inPosition += length + extra;
+        } else if (isRaw(type)) {
+            uint32_t size = 0;
+            if (!readVarint(in, inLength, inPosition, &size) || size > static_cast<uint32_t>(inLength - *inPosition) ||
+                !isValidRaw(type, in + *inPosition, size)) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            if (!writeBytes(out, outLength, outPosition, in + *inPosition, size)) {
+                return BSONPP_OUT_OF_SPACE;
+            }
+            *inPosition += size;
+        } else if (type == BSONPP_DOCUMENT || type == BSONPP_ARRAY) {
+            int32_t res = this->decodeDocument(in, inLength, inPosition, type == BSONPP_ARRAY, depth + 1, out, outLength, outPosition);
+            if (res != BSONPP_SUCCESS) {
+                return res;
+            }
+        } else {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+    }
+}
+
+static uint32_t read32(const uint8_t *data) {
+    uint32_t val;
+    memcpy(&val, data, sizeof(uint32_t));
+    return val;
+}
+
+static uint32_t hashSequence(const uint8_t *data, int32_t tableBits) {
+    return (read32(data) * 2654435761u) >> (32 - tableBits);
+}
+
+// Writes the remainder of a length that didn't fit in its token nibble.
+static bool writeLength(uint8_t *out, int32_t outLength, int32_t *position, int32_t length) {
+    while (length >= 255) {
+        if (*position >= outLength) {
+            return false;
+        }
+        out[(*position)++] = 255;
+        length -= 255;
+    }
+    if (*position >= outLength) {
+        return false;
+    }
+    out[(*position)++] = length;
+    return true;
+}
+
+static bool readLength(const uint8_t *in, int32_t inLength, int32_t *position, int32_t *length) {
+    uint8_t byte = 0;
+    do {
+        if (*position >= inLength || *length > BSONPP_BLOCK_MAX_LENGTH) {
+            return false;
+        }
+        byte = in[(*position)++];
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// A sequence is a token, literals and, unless it's the last, a match offset and length.
+static bool writeSequence(uint8_t *out, int32_t outLength, int32_t *position, const uint8_t *literals, int32_t literalLength,
+    int32_t offset, int32_t matchLength) {
+    int32_t matchNibble = matchLength - BSONPP_BLOCK_MIN_MATCH;
+    if (*position >= outLength) {
+        return false;
+    }
+    uint8_t token = (literalLength < 15 ? literalLength : 15) << 4;
+    if (offset > 0) {
+        token |= matchNibble < 15 ? matchNibble : 15;
+    }
+    out[(*position)++] = token;
+    if (literalLength >= 15 && !writeLength(out, outLength, position, literalLength - 15)) {
+        return false;
+    }
+    if (!writeBytes(out, outLength, position, literals, literalLength)) {
+        return false;
+    }
+    if (offset == 0) {
+        return true;
+    }
+
+    uint8_t encodedOffset[2] = {static_cast<uint8_t>(offset & 0xFF), static_cast<uint8_t>(offset >> 8)};
+    if (!writeBytes(out, outLength, position, encodedOffset, sizeof(encodedOffset))) {
+        return false;
+    }
+    return matchNibble < 15 || writeLength(out, outLength, position, matchNibble - 15);
+}
+
+int32_t BSONPPBlock::compress(const uint8_t *in, int32_t inLength, uint8_t *out, int32_t outLength, uint16_t *table, int32_t tableBits) {
+    if (inLength > BSONPP_BLOCK_MAX_SIZE) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+    memset(table, 0, sizeof(uint16_t) << tableBits);
+
+    int32_t position = 0;
+    int32_t anchor = 0;
+    if (inLength > BSONPP_BLOCK_MATCH_FIND_LIMIT) {
+        // Matches must start 12 bytes and end 5 bytes before the end of the block.
+        int32_t matchStartLimit = inLength - BSONPP_BLOCK_MATCH_FIND_LIMIT;
+        int32_t matchEndLimit = inLength - BSONPP_BLOCK_LAST_LITERALS;
+        int32_t current = 1;
+        while (current < matchStartLimit) {
+            uint32_t hash = hashSequence(in + current, tableBits);
+            int32_t candidate = table[hash];
+            table[hash] = current;
+            if (candidate >= current || read32(in + candidate) != read32(in + current)) {
+                current++;
+                continue;
+            }
+
+            // Extend backwards into the pending literals, then forwards.
+            while (current > anchor && candidate > 0 && in[current - 1] == in[candidate - 1]) {
+                current--;
+                candidate--;
+            }
+            int32_t length = BSONPP_BLOCK_MIN_MATCH;
+            while (current + length < matchEndLimit && in[candidate + length] == in[current + length]) {
+                length++;
+            }
+
+            if (!writeSequence(out, outLength, &position, in + anchor, current - anchor, current - candidate, length)) {
+                return BSONPP_OUT_OF_SPACE;
+            }
+            current += length;
+            anchor = current;
+        }
+    }
+
+    if (!writeSequence(out, outLength, &position, in + anchor, inLength - anchor, 0, 0)) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+    return position;
+}
+
+int32_t BSONPPBlock::decompress(const uint8_t *in, int32_t inLength, uint8_t *out, int32_t outLength) {
+    int32_t inPosition = 0;
+    int32_t outPosition = 0;
+
+    while (true) {
+        if (inPosition >= inLength) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+        uint8_t token = in[inPosition++];
+
+        int32_t literalLength = token >> 4;
+        if (literalLength == 15 && !readLength(in, inLength, &inPosition, &literalLength)) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+        if (literalLength > inLength - inPosition) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+        if (!writeBytes(out, outLength, &outPosition, in + inPosition, literalLength)) {
+            return BSONPP_OUT_OF_SPACE;
+        }
+        inPosition += literalLength;
+        // The last sequence is only literals.
+        if (inPosition == inLength) {
+            return outPosition;
+        }
+
+        if (inLength - inPosition < 2) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+        int32_t offset = in[inPosition] | (static_cast<int32_t>(in[inPosition + 1]) << 8);
+        inPosition += 2;
+        if (offset == 0 || offset > outPosition) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+
+        int32_t matchLength = token & 0x0F;
+        if (matchLength == 15 && !readLength(in, inLength, &inPosition, &matchLength)) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+        matchLength += BSONPP_BLOCK_MIN_MATCH;
+        if (matchLength > outLength - outPosition) {
+            return BSONPP_OUT_OF_SPACE;
+        }
+        // Matches may overlap what they're copying, repeating it.
+        const uint8_t *match = out + outPosition - offset;
+        for (int32_t i = 0; i < matchLength; i++) {
+            out[outPosition + i] = match[i];
+        }
+        outPosition += matchLength;
+    }
+}
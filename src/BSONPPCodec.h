@@ -0,0 +1,105 @@
+#ifndef __BSONPP_CODEC_H__
+#define __BSONPP_CODEC_H__
+
+#include <stdint.h>
+#include "BSONPP.h"
+
+// Deepest sub-document nesting the codec follows, bounding its stack use.
+#define BSONPP_CODEC_MAX_DEPTH (16)
+// Largest block BSONPPBlock compresses, match offsets and the hash table hold 16 bit positions.
+#define BSONPP_BLOCK_MAX_SIZE (65535)
+
+/**
+ * Key strings numbered in the order they're added. The storage, the per key offsets and, for
+ * encoding, a hash table are provided by the caller. Encoder and decoder dictionaries must start
+ * with the same keys, either empty or filled with the same supplied keys.
+ */
+class BSONPPKeyDictionary {
+public:
+    // storage holds the keys, offsets one entry per key. slots is the encoder's hash table, a power of
+    // two at least twice maxKeys, decoders don't need one and can pass null.
+    BSONPPKeyDictionary(char *storage, uint16_t storageLength, uint16_t *offsets, uint16_t maxKeys,
+        uint16_t *slots = nullptr, uint16_t slotCount = 0);
+
+    void clear();
+    // Returns the new key's id or BSONPP_OUT_OF_SPACE.
+    int32_t add(const char *key, int32_t length);
+    // Returns the key's id or BSONPP_KEY_NOT_FOUND.
+    int32_t find(const char *key, int32_t length);
+    const char *getKey(int32_t id, int32_t *length);
+    int32_t getCount();
+    // Forgets keys added after the first count, used to undo a partly coded document.
+    void truncate(int32_t count);
+
+private:
+    void insertSlot(int32_t id, uint32_t hash);
+
+    char *m_storage;
+    uint16_t m_storageLength;
+    uint16_t *m_offsets;
+    uint16_t m_maxKeys;
+    uint16_t *m_slots;
+    uint16_t m_slotCount;
+    uint16_t m_count;
+};
+
+/**
+ * Compact document encoding with keys replaced by varint dictionary ids.
+ *
+ * Each element is its type, a key reference and its value. References of 0 and 1 are followed by
+ * the key itself, with 0 telling the decoder to add it to its dictionary as the encoder did.
+ * Otherwise the reference is the key's id plus two. Array keys are implied by position and omitted.
+ * Document length prefixes are dropped and string, symbol, JavaScript and binary lengths are
+ * varints. Regexes, DBPointers and JavaScript with scope are copied whole after a varint size and
+ * everything else is copied as in BSON. Documents end with a 0x00 type.
+ *
+ * Decoders follow the encoder's learning so must see documents in the same order, with a dictionary
+ * at least as large.
+ */
+class BSONPPKeyEncoder {
+public:
+    BSONPPKeyEncoder(BSONPPKeyDictionary *dictionary, bool learn = true);
+
+    // Returns BSONPP_OUT_OF_SPACE if out is too small, the dictionary is unchanged on failure.
+    // Once the dictionary is full new keys are written in full.
+    int32_t encode(BSONPP *doc, uint8_t *out, int32_t outLength, int32_t *written);
+
+private:
+    int32_t encodeDocument(BSONPP *doc, bool isArray, int32_t depth, uint8_t *out, int32_t outLength, int32_t *position);
+
+    BSONPPKeyDictionary *m_dictionary;
+    bool m_learn;
+};
+
+/**
+ * Decodes BSONPPKeyEncoder output back into standard BSON without allocating.
+ */
+class BSONPPKeyDecoder {
+public:
+    BSONPPKeyDecoder(BSONPPKeyDictionary *dictionary);
+
+    // Decodes one document from in into out and points doc at it. consumed is the encoded size.
+    // Returns BSONPP_INVALID_DOCUMENT for malformed input or BSONPP_OUT_OF_SPACE if out is too small.
+    int32_t decode(const uint8_t *in, int32_t inLength, uint8_t *out, int32_t outLength, BSONPP *doc, int32_t *consumed);
+
+private:
+    int32_t decodeDocument(const uint8_t *in, int32_t inLength, int32_t *inPosition, bool isArray, int32_t depth,
+        uint8_t *out, int32_t outLength, int32_t *outPosition);
+
+    BSONPPKeyDictionary *m_dictionary;
+};
+
+/**
+ * LZ77 block compression in the LZ4 block format, for batches of encoded documents.
+ * Decompression needs no extra memory, compression a caller provided hash table.
+ */
+class BSONPPBlock {
+public:
+    // table must have 1 << tableBits entries. Returns the compressed size or BSONPP_OUT_OF_SPACE.
+    // Input larger than BSONPP_BLOCK_MAX_SIZE returns BSONPP_OUT_OF_SPACE too.
+    static int32_t compress(const uint8_t *in, int32_t inLength, uint8_t *out, int32_t outLength, uint16_t *table, int32_t tableBits);
+    // Returns the decompressed size, BSONPP_INVALID_DOCUMENT or BSONPP_OUT_OF_SPACE.
+    static int32_t decompress(const uint8_t *in, int32_t inLength, uint8_t *out, int32_t outLength);
+};
+
+#endif // __BSONPP_CODEC_H__
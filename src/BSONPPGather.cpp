@@ -0,0 +1,348 @@
+#ifdef __LINUX_BUILD
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include "BSONPPGather.h"
+#include "NetworkUtil.h"
+
+// Size of the stack buffer used when a file range can't be sent with sendfile or splice.
+#define BSONPP_GATHER_COPY_BUFFER_SIZE (4096)
+
+static int32_t writeAll(int fd, const uint8_t *data, size_t length) {
+    while (length > 0) {
+        ssize_t res = write(fd, data, length);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return BSONPP_IO_ERROR;
+        }
+        data += res;
+        length -= res;
+    }
+    return BSONPP_SUCCESS;
+}
+
+BSONPPGather::BSONPPGather(struct iovec *iovecs, int32_t iovecCount, uint8_t *scratch, int32_t scratchLength):
+    m_iovecs(iovecs), m_iovecCount(iovecCount), m_scratch(scratch), m_scratchLength(scratchLength),
+    m_fileRanges(nullptr), m_fileRangeCount(0) {
+    this->clear();
+}
+
+void BSONPPGather::clear() {
+    m_iovecUsed = 0;
+    m_scratchUsed = 0;
+    m_fileRangeUsed = 0;
+    m_size = 0;
+    m_finished = false;
+
+    // Reserve the document length, it's filled in by finish.
+    uint8_t length[sizeof(int32_t)] = { 0 };
+    this->appendScratch(length, sizeof(length));
+}
+
+int32_t BSONPPGather::append(const char *key, int32_t val) {
+    int32_t swapped = htole32(val);
+    return this->appendInternal(key, BSONPP_INT32, reinterpret_cast<uint8_t *>(&swapped), sizeof(int32_t));
+}
+
+int32_t BSONPPGather::append(const char *key, int64_t val, bool dateTime) {
+    int64_t swapped = htole64(val);
+    uint8_t type = dateTime ? BSONPP_DATETIME : BSONPP_INT64;
+    return this->appendInternal(key, type, reinterpret_cast<uint8_t *>(&swapped), sizeof(int64_t));
+}
+
+int32_t BSONPPGather::append(const char *key, double val) {
+    return this->appendInternal(key, BSONPP_DOUBLE, reinterpret_cast<uint8_t *>(&val), sizeof(double));
+}
+
+int32_t BSONPPGather::append(const char *key, const char *val) {
+    return this->appendInternal(key, BSONPP_STRING, reinterpret_cast<const uint8_t *>(val), strlen(val) + 1);
+}
+
+int32_t BSONPPGather::append(const char *key, BSONPP *val, bool isArray) {
+    return this->appendInternal(key, isArray ? BSONPP_ARRAY : BSONPP_DOCUMENT, val->getBuffer(), val->getSize());
+}
+
+int32_t BSONPPGather::append(const char *key, const uint8_t *data, const int32_t length) {
+    return this->appendInternal(key, BSONPP_BINARY, data, length);
+}
+
+int32_t BSONPPGather::append(const char *key, bool val) {
+    uint8_t converted = val ? BSONPP_BOOLEAN_TRUE : BSONPP_BOOLEAN_FALSE;
+    return this->appendInternal(key, BSONPP_BOOLEAN, &converted, 1);
+}
+
+void BSONPPGather::setFileRanges(BSONPPFileRange *ranges, int32_t count) {
+    m_fileRanges = ranges;
+    m_fileRangeCount = count;
+    m_fileRangeUsed = 0;
+}
+
+int32_t BSONPPGather::appendFile(const char *key, int fd, off_t offset, int32_t length) {
+    if (m_fileRangeUsed >= m_fileRangeCount) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    int32_t res = this->appendHeader(key, BSONPP_BINARY, length, true);
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    BSONPPFileRange *range = &m_fileRanges[m_fileRangeUsed++];
+    range->fd = fd;
+    range->offset = offset;
+    range->length = length;
+
+    // A null base marks the value as coming from the next file range.
+    return this->appendReference(nullptr, length);
+}
+
+int32_t BSONPPGather::finish() {
+    if (m_finished) {
+        return BSONPP_SUCCESS;
+    }
+
+    uint8_t terminator = 0x00;
+    int32_t res = this->appendScratch(&terminator, 1);
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    // The length prefix is always at the start of scratch.
+    int32_t swapped = htole32(m_size);
+    memcpy(m_scratch, &swapped, sizeof(int32_t));
+    m_finished = true;
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPGather::getSize() {
+    return m_size;
+}
+
+struct iovec *BSONPPGather::getIovecs() {
+    return m_iovecs;
+}
+
+int32_t BSONPPGather::getIovecCount() {
+    return m_iovecUsed;
+}
+
+int32_t BSONPPGather::writeTo(int fd) {
+    int32_t start = 0;
+    int32_t fileRange = 0;
+    for (int32_t i = 0; i < m_iovecUsed; i++) {
+        if (m_iovecs[i].iov_base != nullptr) {
+            continue;
+        }
+
+        int32_t res = this->writeIovecs(fd, start, i);
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+        res = BSONPPGather::writeFileRange(fd, &m_fileRanges[fileRange++]);
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+        start = i + 1;
+    }
+
+    return this->writeIovecs(fd, start, m_iovecUsed);
+}
+
+int32_t BSONPPGather::writeFileRange(int fd, const BSONPPFileRange *range) {
+    off_t offset = range->offset;
+    size_t remaining = range->length;
+
+    // sendfile works for any output since Linux 2.6.33 but may be refused, for example for
+    // files opened with O_APPEND. Only fall back if nothing has been sent yet.
+    while (remaining > 0) {
+        ssize_t res = sendfile(fd, range->fd, &offset, remaining);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EINVAL || errno == ENOSYS) && offset == range->offset) {
+                break;
+            }
+            return BSONPP_IO_ERROR;
+        }
+        if (res == 0) {
+            // The file is shorter than the range.
+            return BSONPP_IO_ERROR;
+        }
+        remaining -= res;
+    }
+
+    // splice only works when the output is a pipe.
+    while (remaining > 0) {
+        ssize_t res = splice(range->fd, &offset, fd, nullptr, remaining, SPLICE_F_MOVE);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL && offset == range->offset) {
+                break;
+            }
+            return BSONPP_IO_ERROR;
+        }
+        if (res == 0) {
+            return BSONPP_IO_ERROR;
+        }
+        remaining -= res;
+    }
+
+    uint8_t buffer[BSONPP_GATHER_COPY_BUFFER_SIZE];
+    while (remaining > 0) {
+        size_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        ssize_t res = pread(range->fd, buffer, chunk, offset);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return BSONPP_IO_ERROR;
+        }
+        if (res == 0) {
+            return BSONPP_IO_ERROR;
+        }
+        if (writeAll(fd, buffer, res) != BSONPP_SUCCESS) {
+            return BSONPP_IO_ERROR;
+        }
+        offset += res;
+        remaining -= res;
+    }
+
+    return BSONPP_SUCCESS;
+}
+
+// Private methods
+int32_t BSONPPGather::appendInternal(const char *key, uint8_t type, const uint8_t *data, int32_t length) {
+    bool reference = length > BSONPP_GATHER_COPY_THRESHOLD;
+    int32_t res = this->appendHeader(key, type, length, reference);
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    if (reference) {
+        return this->appendReference(data, length);
+    }
+    return this->appendScratch(data, length);
+}
+
+int32_t BSONPPGather::appendHeader(const char *key, uint8_t type, int32_t length, bool reference) {
+    if (m_finished) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    int32_t headerSize = BSONPP::writeElementHeader(nullptr, key, type, length);
+    int32_t scratchNeeded = headerSize + (reference ? 0 : length);
+    // The header needs a new iovec unless it extends the last scratch one. A referenced value needs
+    // its own iovec and then whatever follows it in scratch needs another.
+    int32_t iovecsNeeded = this->isScratchContiguous() ? 0 : 1;
+    if (reference) {
+        iovecsNeeded += 2;
+    }
+
+    // Check up front so a failed append doesn't leave a partial element behind.
+    // Keep room for the terminator written by finish.
+    if (m_scratchUsed + scratchNeeded + 1 > m_scratchLength || m_iovecUsed + iovecsNeeded > m_iovecCount) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    uint8_t *header = m_scratch + m_scratchUsed;
+    BSONPP::writeElementHeader(header, key, type, length);
+    return this->appendScratch(header, headerSize);
+}
+
+int32_t BSONPPGather::appendScratch(const uint8_t *data, int32_t length) {
+    if (m_scratchUsed + length > m_scratchLength) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    uint8_t *dest = m_scratch + m_scratchUsed;
+    // Data may already be in place when the header was written straight into scratch.
+    if (dest != data) {
+        memcpy(dest, data, length);
+    }
+
+    // Grow the previous iovec when it ends where this data starts.
+    if (this->isScratchContiguous()) {
+        m_iovecs[m_iovecUsed - 1].iov_len += length;
+    } else {
+        if (m_iovecUsed >= m_iovecCount) {
+            return BSONPP_OUT_OF_SPACE;
+        }
+        m_iovecs[m_iovecUsed].iov_base = dest;
+        m_iovecs[m_iovecUsed].iov_len = length;
+        m_iovecUsed++;
+    }
+
+    m_scratchUsed += length;
+    m_size += length;
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPGather::writeIovecs(int fd, int32_t start, int32_t end) {
+    int32_t index = start;
+    while (index < end) {
+        int32_t count = end - index;
+        if (count > IOV_MAX) {
+            count = IOV_MAX;
+        }
+
+        ssize_t written = writev(fd, m_iovecs + index, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return BSONPP_IO_ERROR;
+        }
+
+        // Skip fully written iovecs, a partially written one is finished by hand.
+        while (index < end && written >= static_cast<ssize_t>(m_iovecs[index].iov_len)) {
+            written -= m_iovecs[index].iov_len;
+            index++;
+        }
+        if (written > 0) {
+            const uint8_t *rest = static_cast<uint8_t *>(m_iovecs[index].iov_base) + written;
+            if (writeAll(fd, rest, m_iovecs[index].iov_len - written) != BSONPP_SUCCESS) {
+                return BSONPP_IO_ERROR;
+            }
+            index++;
+        }
+    }
+
+    return BSONPP_SUCCESS;
+}
+
+bool BSONPPGather::isScratchContiguous() {
+    if (m_iovecUsed == 0) {
+        return false;
+    }
+    struct iovec *last = &m_iovecs[m_iovecUsed - 1];
+    if (last->iov_base == nullptr) {
+        return false;
+    }
+    return static_cast<uint8_t *>(last->iov_base) + last->iov_len == m_scratch + m_scratchUsed;
+}
+
+int32_t BSONPPGather::appendReference(const uint8_t *data, int32_t length) {
+    if (m_iovecUsed >= m_iovecCount) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    m_iovecs[m_iovecUsed].iov_base = const_cast<uint8_t *>(data);
+    m_iovecs[m_iovecUsed].iov_len = length;
+    m_iovecUsed++;
+    m_size += length;
+
+    return BSONPP_SUCCESS;
+}
+
+#endif // __LINUX_BUILD
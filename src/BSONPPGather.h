@@ -0,0 +1,91 @@
+#ifndef __BSONPP_GATHER_H__
+#define __BSONPP_GATHER_H__
+
+#ifdef __LINUX_BUILD
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "BSONPP.h"
+
+// Values up to this size are copied into scratch rather than given their own iovec.
+#define BSONPP_GATHER_COPY_THRESHOLD (64)
+
+// A binary value sourced from a file, see BSONPPGather::appendFile.
+struct BSONPPFileRange {
+    int fd;
+    off_t offset;
+    int32_t length;
+};
+
+/**
+ * Serializes a document as a list of iovecs for writev/sendmsg rather than into one buffer.
+ * Element headers, length prefixes and small values are written to a caller provided scratch
+ * area while strings, binary and sub-documents above BSONPP_GATHER_COPY_THRESHOLD are referenced
+ * in place, so large payloads are never copied. Referenced memory must outlive the iovecs.
+ *
+ * Binary values can also be sourced from a file descriptor range with appendFile. When written with
+ * writeTo these are moved with sendfile (or splice) so the payload never enters user space.
+ *
+ * Unlike BSONPP keys aren't checked for duplicates as the document can't be searched cheaply.
+ */
+class BSONPPGather {
+public:
+    BSONPPGather(struct iovec *iovecs, int32_t iovecCount, uint8_t *scratch, int32_t scratchLength);
+
+    void clear();
+
+    int32_t append(const char *key, int32_t val);
+    int32_t append(const char *key, int64_t val, bool dateTime = false);
+    int32_t append(const char *key, double val);
+    int32_t append(const char *key, const char *val);
+    int32_t append(const char *key, BSONPP *val, bool isArray = false);
+    int32_t append(const char *key, const uint8_t *data, const int32_t length);
+    int32_t append(const char *key, bool val);
+
+    // Storage for file ranges, required before appendFile is used.
+    void setFileRanges(BSONPPFileRange *ranges, int32_t count);
+    // Appends a binary value of length bytes read from fd starting at offset. The fd must stay open
+    // until the document is written. In the iovecs the value is an entry with a null base and the
+    // value's length, the nth such entry is the nth file range. These can only be sent by writeTo.
+    int32_t appendFile(const char *key, int fd, off_t offset, int32_t length);
+
+    // Terminates the document and fills in its length. Nothing can be appended afterwards.
+    int32_t finish();
+
+    // Total size of the document in bytes.
+    int32_t getSize();
+    struct iovec *getIovecs();
+    int32_t getIovecCount();
+
+    // Writes the finished document to a blocking file descriptor, retrying partial writes.
+    int32_t writeTo(int fd);
+
+    // Moves length bytes from a file to fd with sendfile, falling back to splice and then to
+    // copying through a small stack buffer when neither supports the descriptors.
+    static int32_t writeFileRange(int fd, const BSONPPFileRange *range);
+
+private:
+    int32_t appendInternal(const char *key, uint8_t type, const uint8_t *data, int32_t length);
+    int32_t appendHeader(const char *key, uint8_t type, int32_t length, bool reference);
+    int32_t appendScratch(const uint8_t *data, int32_t length);
+    int32_t appendReference(const uint8_t *data, int32_t length);
+    bool isScratchContiguous();
+    int32_t writeIovecs(int fd, int32_t start, int32_t end);
+
+    struct iovec *m_iovecs;
+    int32_t m_iovecCount;
+    int32_t m_iovecUsed;
+    uint8_t *m_scratch;
+    int32_t m_scratchLength;
+    int32_t m_scratchUsed;
+    BSONPPFileRange *m_fileRanges;
+    int32_t m_fileRangeCount;
+    int32_t m_fileRangeUsed;
+    int32_t m_size;
+    bool m_finished;
+};
+
+#endif // __LINUX_BUILD
+
+#endif // __BSONPP_GATHER_H__
@@ -0,0 +1,541 @@
+#include <string.h>
+#include "BSONPP.h"
+#include "NetworkUtil.h"
+
+// The byte hash is wyhash (public domain, Wang Yi). It works on 64 bit words folded with a 64x64->128
+// multiply and takes long values three independent lanes at a time.
+static const uint64_t kSecret[4] = {
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+// Smallest double that doesn't fit in an int64, 2^63.
+static const double kInt64Limit = 9223372036854775808.0;
+
+static void multiply(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t product = static_cast<__uint128_t>(*a) * *b;
+    *a = static_cast<uint64_t>(product);
+    *b = static_cast<uint64_t>(product >> 64);
+#else
+    uint64_t highA = *a >> 32;
+    uint64_t highB = *b >> 32;
+    uint64_t lowA = static_cast<uint32_t>(*a);
+    uint64_t lowB = static_cast<uint32_t>(*b);
+    uint64_t high = highA * highB;
+    uint64_t middle0 = highA * lowB;
+    uint64_t middle1 = highB * lowA;
+    uint64_t low = lowA * lowB;
+    uint64_t sum = low + (middle0 << 32);
+    uint64_t carry = sum < low;
+    uint64_t result = sum + (middle1 << 32);
+    carry += result < sum;
+    *a = result;
+    *b = high + (middle0 >> 32) + (middle1 >> 32) + carry;
+#endif
+}
+
+static uint64_t mix(uint64_t a, uint64_t b) {
+    multiply(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t read64(const uint8_t *data) {
+    uint64_t val;
+    memcpy(&val, data, sizeof(uint64_t));
+    return letoh64(val);
+}
+
+static uint64_t read32(const uint8_t *data) {
+    uint32_t val;
+    memcpy(&val, data, sizeof(uint32_t));
+    return static_cast<uint32_t>(letoh32(val));
+}
+
+static uint64_t hashBytes(const uint8_t *data, int32_t length, uint64_t seed) {
+    uint64_t a;
+    uint64_t b;
+    seed ^= mix(seed ^ kSecret[0], kSecret[1]);
+
+    if (length <= 16) {
+        if (length >= 4) {
+            int32_t shift = (length >> 3) << 2;
+            a = (read32(data) << 32) | read32(data + shift);
+            b = (read32(data + length - 4) << 32) | read32(data + length - 4 - shift);
+        } else if (length > 0) {
+            a = (static_cast<uint64_t>(data[0]) << 16) | (static_cast<uint64_t>(data[length >> 1]) << 8) | data[length - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        int32_t remaining = length;
+        if (remaining > 48) {
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = mix(read64(data) ^ kSecret[1], read64(data + 8) ^ seed);
+                seed1 = mix(read64(data + 16) ^ kSecret[2], read64(data + 24) ^ seed1);
+                seed2 = mix(read64(data + 32) ^ kSecret[3], read64(data + 40) ^ seed2);
+                data += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (remaining > 16) {
+            seed = mix(read64(data) ^ kSecret[1], read64(data + 8) ^ seed);
+            data += 16;
+            remaining -= 16;
+        }
+        // The last 16 bytes, overlapping what was already hashed if need be.
+        a = read64(data + remaining - 16);
+        b = read64(data + remaining - 8);
+    }
+
+    a ^= kSecret[1];
+    b ^= seed;
+    multiply(&a, &b);
+    return mix(a ^ kSecret[0] ^ static_cast<uint64_t>(length), b ^ kSecret[1]);
+}
+
+// Position of a type in the BSON comparison order. Types sharing a rank compare by value.
+static int32_t typeRank(uint8_t type) {
+    switch (type) {
+        case BSONPP_MIN_KEY:
+            return -1;
+        case BSONPP_UNDEFINED:
+            return 0;
+        case BSONPP_NULL:
+            return 5;
+        case BSONPP_DOUBLE: // Fallthrough
+        case BSONPP_INT32: // Fallthrough
+        case BSONPP_INT64:
+            return 10;
+        case BSONPP_DECIMAL128:
+            return 12;
+        case BSONPP_STRING: // Fallthrough
+        case BSONPP_SYMBOL:
+            return 15;
+        case BSONPP_DOCUMENT:
+            return 20;
+        case BSONPP_ARRAY:
+            return 25;
+        case BSONPP_BINARY:
+            return 30;
+        case BSONPP_OBJECT_ID:
+            return 35;
+        case BSONPP_BOOLEAN:
+            return 40;
+        case BSONPP_DATETIME:
+            return 45;
+        case BSONPP_TIMESTAMP:
+            return 47;
+        case BSONPP_REGEX:
+            return 50;
+        case BSONPP_DB_POINTER:
+            return 55;
+        case BSONPP_JAVASCRIPT:
+            return 60;
+        case BSONPP_JAVASCRIPT_WITH_SCOPE:
+            return 65;
+        case BSONPP_MAX_KEY:
+            return 127;
+        default:
+            // Just before max key. Sort keys hold rank + 1 in their top byte so ranks stay below 128,
+            // ranking by type value could overflow it. Checked documents never get here, scanning
+            // stops at an unknown type with BSONPP_INCORRECT_TYPE.
+            return 126;
+    }
+}
+
+static bool isNumber(uint8_t type) {
+    return typeRank(type) == typeRank(BSONPP_DOUBLE);
+}
+
+static uint64_t hashInt64(int64_t val, uint64_t seed) {
+    uint64_t encoded = htole64(static_cast<uint64_t>(val));
+    return hashBytes(reinterpret_cast<uint8_t *>(&encoded), sizeof(uint64_t), seed);
+}
+
+// Integral doubles hash as the equivalent int64 so equal numbers of any type hash the same.
+static uint64_t hashNumber(BSONPP *doc, const BSONPPElement *element, uint64_t seed) {
+    if (element->type != BSONPP_DOUBLE) {
+        int64_t val = 0;
+        doc->getValue(element->offset, &val);
+        return hashInt64(val, seed);
+    }
+
+    double val = 0;
+    doc->getValue(element->offset, &val);
+    if (val != val) {
+        // Every NaN is equal.
+        return hashBytes(nullptr, 0, seed);
+    }
+    if (val >= -kInt64Limit && val < kInt64Limit && val == static_cast<double>(static_cast<int64_t>(val))) {
+        // Includes -0.0.
+        return hashInt64(static_cast<int64_t>(val), seed);
+    }
+    return hashBytes(reinterpret_cast<uint8_t *>(&val), sizeof(double), seed);
+}
+
+static int32_t hashElement(BSONPP *doc, const BSONPPElement *element, bool ignoreKeyOrder, uint64_t seed, uint64_t *result) {
+    // The key and type class seed the value's hash.
+    uint64_t valueSeed = hashBytes(reinterpret_cast<const uint8_t *>(element->key), element->keyLength,
+        seed ^ static_cast<uint64_t>(typeRank(element->type)));
+
+    switch (element->type) {
+        case BSONPP_DOUBLE: // Fallthrough
+        case BSONPP_INT32: // Fallthrough
+        case BSONPP_INT64:
+            *result = hashNumber(doc, element, valueSeed);
+            return BSONPP_SUCCESS;
+        case BSONPP_STRING: // Fallthrough
+        case BSONPP_SYMBOL:
+            // Skip the length prefix and null terminator.
+            *result = hashBytes(element->value + sizeof(int32_t), element->valueSize - sizeof(int32_t) - 1, valueSeed);
+            return BSONPP_SUCCESS;
+        case BSONPP_BINARY:
+            // Skip the length prefix, keeping the subtype.
+            *result = hashBytes(element->value + sizeof(int32_t), element->valueSize - sizeof(int32_t), valueSeed);
+            return BSONPP_SUCCESS;
+        case BSONPP_DOCUMENT: // Fallthrough
+        case BSONPP_ARRAY: {
+            BSONPP child;
+            doc->getValue(element->offset, &child);
+            return child.hash(result, ignoreKeyOrder, valueSeed);
+        }
+        default:
+            *result = hashBytes(element->value, element->valueSize, valueSeed);
+            return BSONPP_SUCCESS;
+    }
+}
+
+int32_t BSONPP::hash(uint64_t *result, bool ignoreKeyOrder, uint64_t seed) {
+    if (m_buffer == nullptr) {
+        return BSONPP_NO_BUFFER;
+    }
+
+    int32_t offset = 0;
+    BSONPPElement element;
+    uint64_t state = seed;
+    uint64_t count = 0;
+    int32_t res = BSONPP_SUCCESS;
+
+    while ((res = this->nextElement(&offset, &element)) == BSONPP_SUCCESS) {
+        uint64_t elementHash = 0;
+        res = hashElement(this, &element, ignoreKeyOrder, seed, &elementHash);
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+        // Addition doesn't depend on order, elements are already well mixed.
+        state = ignoreKeyOrder ? state + elementHash : mix(state ^ elementHash, kSecret[2]);
+        count++;
+    }
+    if (res != BSONPP_KEY_NOT_FOUND) {
+        return res;
+    }
+
+    *result = mix(state ^ kSecret[0], count ^ kSecret[3]);
+    return BSONPP_SUCCESS;
+}
+
+template<typename T>
+static int32_t compareOrdered(T a, T b) {
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+static int32_t compareBytes(const uint8_t *a, int32_t aLength, const uint8_t *b, int32_t bLength) {
+    int32_t res = memcmp(a, b, aLength < bLength ? aLength : bLength);
+    if (res != 0) {
+        return res < 0 ? -1 : 1;
+    }
+    return compareOrdered(aLength, bLength);
+}
+
+// NaN is less than every other number.
+static int32_t compareDoubles(double a, double b) {
+    if (a != a) {
+        return b != b ? 0 : -1;
+    }
+    if (b != b) {
+        return 1;
+    }
+    return compareOrdered(a, b);
+}
+
+// Compares exactly, without rounding a through a double.
+static int32_t compareInt64Double(int64_t a, double b) {
+    if (b != b) {
+        return 1;
+    }
+    if (b >= kInt64Limit) {
+        return -1;
+    }
+    if (b < -kInt64Limit) {
+        return 1;
+    }
+
+    int64_t truncated = static_cast<int64_t>(b);
+    if (a != truncated) {
+        return compareOrdered(a, truncated);
+    }
+    // Equal integer parts, so the fraction decides.
+    return compareOrdered(0.0, b - static_cast<double>(truncated));
+}
+
+static int32_t compareNumbers(BSONPP *a, const BSONPPElement *aElement, BSONPP *b, const BSONPPElement *bElement) {
+    int64_t aInt = 0;
+    int64_t bInt = 0;
+    double aDouble = 0;
+    double bDouble = 0;
+    bool aIsDouble = aElement->type == BSONPP_DOUBLE;
+    bool bIsDouble = bElement->type == BSONPP_DOUBLE;
+    if (aIsDouble) {
+        a->getValue(aElement->offset, &aDouble);
+    } else {
+        a->getValue(aElement->offset, &aInt);
+    }
+    if (bIsDouble) {
+        b->getValue(bElement->offset, &bDouble);
+    } else {
+        b->getValue(bElement->offset, &bInt);
+    }
+
+    if (aIsDouble && bIsDouble) {
+        return compareDoubles(aDouble, bDouble);
+    }
+    if (aIsDouble) {
+        return -compareInt64Double(bInt, aDouble);
+    }
+    if (bIsDouble) {
+        return compareInt64Double(aInt, bDouble);
+    }
+    return compareOrdered(aInt, bInt);
+}
+
+// Values must be the same type rank.
+static int32_t compareValues(BSONPP *a, const BSONPPElement *aElement, BSONPP *b, const BSONPPElement *bElement, int32_t *result) {
+    if (isNumber(aElement->type)) {
+        *result = compareNumbers(a, aElement, b, bElement);
+        return BSONPP_SUCCESS;
+    }
+
+    switch (aElement->type) {
+        case BSONPP_STRING: // Fallthrough
+        case BSONPP_SYMBOL:
+            // Symbols are laid out like strings and compare with them.
+            *result = compareBytes(aElement->value + sizeof(int32_t), aElement->valueSize - sizeof(int32_t) - 1,
+                bElement->value + sizeof(int32_t), bElement->valueSize - sizeof(int32_t) - 1);
+            return BSONPP_SUCCESS;
+        case BSONPP_DOCUMENT: // Fallthrough
+        case BSONPP_ARRAY: {
+            BSONPP aChild;
+            BSONPP bChild;
+            a->getValue(aElement->offset, &aChild);
+            b->getValue(bElement->offset, &bChild);
+            return aChild.compare(&bChild, result);
+        }
+        case BSONPP_BINARY:
+            // Shorter binary values come first, then by subtype and then by content.
+            *result = compareOrdered(aElement->valueSize, bElement->valueSize);
+            if (*result == 0) {
+                *result = compareBytes(aElement->value + sizeof(int32_t), aElement->valueSize - sizeof(int32_t),
+                    bElement->value + sizeof(int32_t), bElement->valueSize - sizeof(int32_t));
+            }
+            return BSONPP_SUCCESS;
+        case BSONPP_BOOLEAN:
+            *result = compareOrdered(aElement->value[0] != BSONPP_BOOLEAN_FALSE, bElement->value[0] != BSONPP_BOOLEAN_FALSE);
+            return BSONPP_SUCCESS;
+        case BSONPP_DATETIME: {
+            int64_t aVal = 0;
+            int64_t bVal = 0;
+            a->getValue(aElement->offset, &aVal);
+            b->getValue(bElement->offset, &bVal);
+            *result = compareOrdered(aVal, bVal);
+            return BSONPP_SUCCESS;
+        }
+        case BSONPP_TIMESTAMP: {
+            BSONPPTimestamp aVal;
+            BSONPPTimestamp bVal;
+            a->getValue(aElement->offset, &aVal);
+            b->getValue(bElement->offset, &bVal);
+            *result = compareOrdered(aVal.seconds, bVal.seconds);
+            if (*result == 0) {
+                *result = compareOrdered(aVal.increment, bVal.increment);
+            }
+            return BSONPP_SUCCESS;
+        }
+        default:
+            // Includes ObjectIds, whose big endian fields compare in order as bytes. Decimal128 values
+            // sort after the other numbers and compare by their encoding rather than numerically.
+            *result = compareBytes(aElement->value, aElement->valueSize, bElement->value, bElement->valueSize);
+            return BSONPP_SUCCESS;
+    }
+}
+
+int32_t BSONPP::compareValue(int32_t offset, BSONPP *other, int32_t otherOffset, int32_t *result) {
+    if (offset < 0) {
+        return offset;
+    }
+    if (otherOffset < 0) {
+        return otherOffset;
+    }
+
+    BSONPPElement element;
+    BSONPPElement otherElement;
+    int32_t res = this->nextElement(&offset, &element);
+    if (res == BSONPP_SUCCESS) {
+        res = other->nextElement(&otherOffset, &otherElement);
+    }
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    *result = compareOrdered(typeRank(element.type), typeRank(otherElement.type));
+    if (*result != 0) {
+        return BSONPP_SUCCESS;
+    }
+    return compareValues(this, &element, other, &otherElement, result);
+}
+
+// Maps a double's bits to an unsigned integer with the same order.
+static uint64_t orderedDoubleBits(double val) {
+    if (val == 0) {
+        // -0.0 is equal to 0.0.
+        val = 0;
+    }
+    uint64_t bits = 0;
+    if (sizeof(double) == sizeof(uint64_t)) {
+        memcpy(&bits, &val, sizeof(uint64_t));
+    } else {
+        uint32_t bits32;
+        memcpy(&bits32, &val, sizeof(uint32_t));
+        bits = static_cast<uint64_t>(bits32) << 32;
+    }
+    return (bits & (1ULL << 63)) ? ~bits : bits | (1ULL << 63);
+}
+
+// Big endian so the bytes compare in order, padded with zeros when shorter than 8.
+static uint64_t prefixBytes(const uint8_t *data, int32_t length) {
+    uint64_t prefix = 0;
+    for (int32_t i = 0; i < 8; i++) {
+        prefix = (prefix << 8) | (i < length ? data[i] : 0);
+    }
+    return prefix;
+}
+
+int32_t BSONPP::getSortKey(int32_t offset, uint64_t *key) {
+    if (offset < 0) {
+        return offset;
+    }
+
+    BSONPPElement element;
+    int32_t res = this->nextElement(&offset, &element);
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    // The type rank is the top byte, the value the remaining 56 bits.
+    uint64_t value = 0;
+    switch (element.type) {
+        case BSONPP_DOUBLE: // Fallthrough
+        case BSONPP_INT32: // Fallthrough
+        case BSONPP_INT64: {
+            // Large int64s lose precision as doubles but still sort in order.
+            double number = 0;
+            if (element.type == BSONPP_DOUBLE) {
+                this->getValue(element.offset, &number);
+            } else {
+                int64_t integer = 0;
+                this->getValue(element.offset, &integer);
+                number = static_cast<double>(integer);
+            }
+            // NaN sorts first.
+            value = number != number ? 0 : orderedDoubleBits(number) >> 8;
+            break;
+        }
+        case BSONPP_STRING: // Fallthrough
+        case BSONPP_SYMBOL:
+            value = prefixBytes(element.value + sizeof(int32_t), element.valueSize - sizeof(int32_t) - 1) >> 8;
+            break;
+        case BSONPP_BINARY: {
+            // Length, subtype and then the first bytes, the order binary values compare in.
+            uint64_t length = element.valueSize - sizeof(int32_t) - 1;
+            value = (length > 0xFFFFFFFFULL ? 0xFFFFFFFFULL : length) << 24;
+            value |= prefixBytes(element.value + sizeof(int32_t), element.valueSize - sizeof(int32_t)) >> 40;
+            break;
+        }
+        case BSONPP_BOOLEAN:
+            value = element.value[0] != BSONPP_BOOLEAN_FALSE;
+            break;
+        case BSONPP_DATETIME: {
+            // Exact within 2^55 ms either side of the epoch, clamped beyond.
+            int64_t dateTime = 0;
+            this->getValue(element.offset, &dateTime);
+            const int64_t limit = 1LL << 55;
+            dateTime = dateTime < -limit ? -limit : (dateTime >= limit ? limit - 1 : dateTime);
+            value = static_cast<uint64_t>(dateTime + limit);
+            break;
+        }
+        case BSONPP_TIMESTAMP: {
+            BSONPPTimestamp timestamp;
+            this->getValue(element.offset, &timestamp);
+            value = ((static_cast<uint64_t>(timestamp.seconds) << 32) | timestamp.increment) >> 8;
+            break;
+        }
+        case BSONPP_DOCUMENT: // Fallthrough
+        case BSONPP_ARRAY: // Fallthrough
+        case BSONPP_NULL: // Fallthrough
+        case BSONPP_UNDEFINED: // Fallthrough
+        case BSONPP_MIN_KEY: // Fallthrough
+        case BSONPP_MAX_KEY:
+            break;
+        default:
+            value = prefixBytes(element.value, element.valueSize) >> 8;
+            break;
+    }
+
+    *key = (static_cast<uint64_t>(typeRank(element.type) + 1) << 56) | value;
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPP::compare(BSONPP *other, int32_t *result) {
+    if (m_buffer == nullptr || other->m_buffer == nullptr) {
+        return BSONPP_NO_BUFFER;
+    }
+
+    int32_t offset = 0;
+    int32_t otherOffset = 0;
+    BSONPPElement element;
+    BSONPPElement otherElement;
+
+    while (true) {
+        int32_t res = this->nextElement(&offset, &element);
+        int32_t otherRes = other->nextElement(&otherOffset, &otherElement);
+        if (res != BSONPP_SUCCESS && res != BSONPP_KEY_NOT_FOUND) {
+            return res;
+        }
+        if (otherRes != BSONPP_SUCCESS && otherRes != BSONPP_KEY_NOT_FOUND) {
+            return otherRes;
+        }
+        // A document that ends first is less.
+        if (res == BSONPP_KEY_NOT_FOUND || otherRes == BSONPP_KEY_NOT_FOUND) {
+            *result = (res == BSONPP_SUCCESS ? 1 : 0) - (otherRes == BSONPP_SUCCESS ? 1 : 0);
+            return BSONPP_SUCCESS;
+        }
+
+        *result = compareOrdered(typeRank(element.type), typeRank(otherElement.type));
+        if (*result != 0) {
+            return BSONPP_SUCCESS;
+        }
+        *result = compareBytes(reinterpret_cast<const uint8_t *>(element.key), element.keyLength,
+            reinterpret_cast<const uint8_t *>(otherElement.key), otherElement.keyLength);
+        if (*result != 0) {
+            return BSONPP_SUCCESS;
+        }
+        res = compareValues(this, &element, other, &otherElement, result);
+        if (res != BSONPP_SUCCESS || *result != 0) {
+            return res;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#include <string.h>
+#include "BSONPP.h"
+#include "BSONPPKeySet.h"
+
+// Number of displacements tried per bucket before giving up.
+#define BSONPP_KEY_SET_MAX_DISPLACEMENT (255)
+
+BSONPPKeySet::BSONPPKeySet(const BSONPPKey *keys, int32_t count, uint8_t *slots, uint8_t *displacements, int32_t tableSize):
+    m_keys(keys), m_count(count), m_slots(slots), m_displacements(displacements), m_tableSize(tableSize), m_valid(false) {
+    m_valid = this->build();
+}
+
+bool BSONPPKeySet::isValid() const {
+    return m_valid;
+}
+
+int32_t BSONPPKeySet::getCount() const {
+    return m_count;
+}
+
+const BSONPPKey *BSONPPKeySet::getKey(int32_t index) const {
+    return &m_keys[index];
+}
+
+int32_t BSONPPKeySet::indexOf(const char *key, int32_t length, uint32_t hash) const {
+    uint8_t slot = m_slots[this->getSlot(hash, m_displacements[this->getBucket(hash)])];
+    if (slot == 0) {
+        return BSONPP_KEY_NOT_FOUND;
+    }
+
+    // Slots are offset by one so zero can mark an empty slot.
+    const BSONPPKey *candidate = &m_keys[slot - 1];
+    if (candidate->hash != hash || candidate->length != length || memcmp(candidate->name, key, length) != 0) {
+        return BSONPP_KEY_NOT_FOUND;
+    }
+
+    return slot - 1;
+}
+
+uint32_t BSONPPKeySet::hash(const char *key, int32_t *length) {
+    uint32_t hash = 2166136261u;
+    const char *start = key;
+    while (*key != 0) {
+        hash = (hash ^ static_cast<uint8_t>(*key++)) * 16777619u;
+    }
+    *length = key - start;
+    return hash;
+}
+
+// Private methods
+bool BSONPPKeySet::build() {
+    if (m_count > BSONPP_KEY_SET_MAX_KEYS || m_tableSize < m_count || (m_tableSize & (m_tableSize - 1)) != 0) {
+        return false;
+    }
+
+    int32_t buckets = this->getBucketCount();
+    memset(m_slots, 0x00, m_tableSize);
+    memset(m_displacements, 0x00, buckets);
+
+    int32_t maxSize = 0;
+    for (int32_t bucket = 0; bucket < buckets; bucket++) {
+        int32_t bucketSize = this->getBucketSize(bucket);
+        maxSize = bucketSize > maxSize ? bucketSize : maxSize;
+    }
+
+    // Place the most crowded buckets first while the table is emptiest.
+    // Bucket sizes are recounted rather than stored so no scratch memory is needed.
+    for (int32_t size = maxSize; size > 0; size--) {
+        for (int32_t bucket = 0; bucket < buckets; bucket++) {
+            if (this->getBucketSize(bucket) != size) {
+                continue;
+            }
+
+            bool placed = false;
+            for (int32_t displacement = 0; displacement <= BSONPP_KEY_SET_MAX_DISPLACEMENT && !placed; displacement++) {
+                placed = this->place(bucket, static_cast<uint8_t>(displacement));
+            }
+            if (!placed) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool BSONPPKeySet::place(int32_t bucket, uint8_t displacement) {
+    for (int32_t i = 0; i < m_count; i++) {
+        if (this->getBucket(m_keys[i].hash) != bucket) {
+            continue;
+        }
+
+        int32_t slot = this->getSlot(m_keys[i].hash, displacement);
+        if (m_slots[slot] != 0) {
+            // Roll back anything placed from this bucket so far.
+            for (int32_t j = 0; j < i; j++) {
+                if (this->getBucket(m_keys[j].hash) == bucket) {
+                    m_slots[this->getSlot(m_keys[j].hash, displacement)] = 0;
+                }
+            }
+            return false;
+        }
+        m_slots[slot] = i + 1;
+    }
+
+    m_displacements[bucket] = displacement;
+    return true;
+}
+
+int32_t BSONPPKeySet::getBucketCount() const {
+    return m_tableSize / 2 > 0 ? m_tableSize / 2 : 1;
+}
+
+int32_t BSONPPKeySet::getBucketSize(int32_t bucket) const {
+    int32_t size = 0;
+    for (int32_t i = 0; i < m_count; i++) {
+        if (this->getBucket(m_keys[i].hash) == bucket) {
+            size++;
+        }
+    }
+    return size;
+}
+
+int32_t BSONPPKeySet::getBucket(uint32_t hash) const {
+    return hash & (this->getBucketCount() - 1);
+}
+
+int32_t BSONPPKeySet::getSlot(uint32_t hash, uint8_t displacement) const {
+    // Murmur3 finaliser so the slot depends on every bit of the hash and the displacement.
+    hash ^= displacement * 0x9E3779B9u;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+    return hash & (m_tableSize - 1);
+}
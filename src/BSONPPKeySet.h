@@ -0,0 +1,87 @@
+#ifndef __BSONPP_KEY_SET_H__
+#define __BSONPP_KEY_SET_H__
+
+#include <stdint.h>
+
+// 32 bit FNV-1a. This is constexpr so key sets can be hashed by the compiler.
+constexpr uint32_t bsonppHash(const char *str, uint32_t hash = 2166136261u) {
+    return *str == 0 ? hash : bsonppHash(str + 1, (hash ^ static_cast<uint8_t>(*str)) * 16777619u);
+}
+
+// Smallest power of two table with at most a 50% load for the given number of keys.
+constexpr int32_t bsonppKeySetTableSize(int32_t count, int32_t size = 2) {
+    return size >= count * 2 ? size : bsonppKeySetTableSize(count, size * 2);
+}
+
+struct BSONPPKey {
+    const char *name;
+    int32_t length;
+    uint32_t hash;
+};
+
+// Declares a key with its length and hash computed at compile time, name must be a string literal.
+#define BSONPP_KEY(name) { name, sizeof(name) - 1, bsonppHash(name) }
+
+// Maximum number of keys in a set, slots store the key index in a byte.
+#define BSONPP_KEY_SET_MAX_KEYS (255)
+
+/**
+ * A fixed set of keys arranged into a collision free (perfect) hash table.
+ * This lets BSONPP::find locate every key in the set in a single walk over a document,
+ * hashing each element key once regardless of how many keys are being looked up.
+ *
+ * The table is built using hash and displace. Keys are split into buckets and each bucket is given
+ * a displacement that moves all of its keys into free slots. A lookup is then one bucket read, one
+ * slot read and one exact length comparison.
+ */
+class BSONPPKeySet {
+public:
+    // slots must have room for tableSize entries and displacements for tableSize / 2 entries.
+    // tableSize must be a power of two and at least the number of keys.
+    BSONPPKeySet(const BSONPPKey *keys, int32_t count, uint8_t *slots, uint8_t *displacements, int32_t tableSize);
+
+    // False if the keys contain duplicates, there's too many of them or no perfect layout was found.
+    bool isValid() const;
+    int32_t getCount() const;
+    const BSONPPKey *getKey(int32_t index) const;
+    // Returns the index of the key within the set or BSONPP_KEY_NOT_FOUND.
+    int32_t indexOf(const char *key, int32_t length, uint32_t hash) const;
+
+    // Hashes a null terminated key at runtime, matches bsonppHash. Length is set to the key length.
+    static uint32_t hash(const char *key, int32_t *length);
+
+private:
+    bool build();
+    bool place(int32_t bucket, uint8_t displacement);
+    int32_t getBucketCount() const;
+    int32_t getBucketSize(int32_t bucket) const;
+    int32_t getBucket(uint32_t hash) const;
+    int32_t getSlot(uint32_t hash, uint8_t displacement) const;
+
+    const BSONPPKey *m_keys;
+    int32_t m_count;
+    uint8_t *m_slots;
+    uint8_t *m_displacements;
+    int32_t m_tableSize;
+    bool m_valid;
+};
+
+/**
+ * Key set which owns its tables, for example:
+ *   static const BSONPPKey kKeys[] = { BSONPP_KEY("id"), BSONPP_KEY("temp") };
+ *   static const BSONPPStaticKeySet<2> kKeySet(kKeys);
+ */
+template <int32_t N>
+class BSONPPStaticKeySet : public BSONPPKeySet {
+public:
+    explicit BSONPPStaticKeySet(const BSONPPKey (&keys)[N]):
+        BSONPPKeySet(keys, N, m_slots, m_displacements, kTableSize) {}
+
+private:
+    static constexpr int32_t kTableSize = bsonppKeySetTableSize(N);
+
+    uint8_t m_slots[kTableSize];
+    uint8_t m_displacements[kTableSize / 2];
+};
+
+#endif // __BSONPP_KEY_SET_H__
@@ -0,0 +1,262 @@
+#include <string.h>
+#include "BSONPP.h"
+#include "BSONPPMergeIndex.h"
+#include "BSONPPStats.h"
+
+// Looks for key among the elements of doc that start before end.
+static bool findKey(BSONPP *doc, int32_t end, const char *key, int32_t keyLength, BSONPPElement *found) {
+    int32_t offset = 0;
+    while (doc->nextElement(&offset, found) == BSONPP_SUCCESS && found->offset < end) {
+        if (found->keyLength == keyLength && memcmp(found->key, key, keyLength) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The encoded size of an element, from its type to the end of its value.
+static int32_t getElementSize(BSONPP *doc, const BSONPPElement *element) {
+    return element->value - doc->getBuffer() + element->valueSize - element->offset;
+}
+
+// Consecutive elements of one document waiting to be copied together.
+struct BSONPPRun {
+    int32_t start;
+    int32_t end;
+};
+
+static void extendRun(BSONPPRun *run, BSONPP *doc, const BSONPPElement *element) {
+    if (run->start < 0) {
+        run->start = element->offset;
+    }
+    run->end = element->offset + getElementSize(doc, element);
+}
+
+int32_t BSONPP::appendElement(BSONPP *from, const char *key) {
+    if (m_buffer == nullptr) {
+        return BSONPP_NO_BUFFER;
+    }
+
+    BSONPPElement element;
+    if (!findKey(from, from->getSize(), key, strlen(key), &element)) {
+        return BSONPP_KEY_NOT_FOUND;
+    }
+    BSONPPElement existing;
+    if (BSONPP_CHECKED(findKey(this, this->getSize(), element.key, element.keyLength, &existing))) {
+        return BSONPP_DUPLICATE_KEY;
+    }
+    return this->appendRaw(from->getBuffer() + element.offset, getElementSize(from, &element));
+}
+
+// Adds the elements of doc to index, failing if any key is already in it.
+static int32_t indexElements(BSONPPMergeIndex *index, BSONPP *doc, bool existing, bool checkIndexed) {
+    int32_t offset = 0;
+    BSONPPElement element;
+    int32_t res = BSONPP_SUCCESS;
+    while ((res = doc->nextElement(&offset, &element)) == BSONPP_SUCCESS) {
+        int32_t keyLength = 0;
+        uint32_t hash = BSONPPKeySet::hash(element.key, &keyLength);
+        if (checkIndexed && index->find(element.key, hash) != nullptr) {
+            return BSONPP_DUPLICATE_KEY;
+        }
+        if ((res = index->add(&element, doc->getBuffer(), hash, existing)) != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+    return res == BSONPP_KEY_NOT_FOUND ? BSONPP_SUCCESS : res;
+}
+
+int32_t BSONPP::appendAllFrom(BSONPP *other, const BSONPPKeySet *keys, bool exclude, BSONPPMergeIndex *index) {
+    if (m_buffer == nullptr) {
+        return BSONPP_NO_BUFFER;
+    }
+    if (keys != nullptr && !keys->isValid()) {
+        return BSONPP_INVALID_KEY_SET;
+    }
+
+    int32_t start = this->getSize();
+    // Only keys already here can clash, other's own keys are unique.
+    bool checkExisting = BSONPP_CHECKED(start > 5);
+    BSONPPRun run = { -1, -1 };
+    int32_t offset = 0;
+    BSONPPElement element;
+    BSONPPElement existing;
+    int32_t res = BSONPP_SUCCESS;
+
+    if (checkExisting && index != nullptr) {
+        index->clear();
+        if ((res = indexElements(index, this, true, false)) != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+
+    while ((res = other->nextElement(&offset, &element)) == BSONPP_SUCCESS) {
+        int32_t keyLength = 0;
+        uint32_t hash = keys != nullptr || (checkExisting && index != nullptr) ? BSONPPKeySet::hash(element.key, &keyLength) : 0;
+        bool copy = keys == nullptr || (keys->indexOf(element.key, element.keyLength, hash) >= 0) != exclude;
+        if (!copy) {
+            if (run.start >= 0 && (res = this->appendRaw(other->getBuffer() + run.start, run.end - run.start)) != BSONPP_SUCCESS) {
+                break;
+            }
+            run.start = -1;
+            continue;
+        }
+        if (checkExisting && (index != nullptr ? index->find(element.key, hash) != nullptr :
+                                                 findKey(this, start - 1, element.key, element.keyLength, &existing))) {
+            res = BSONPP_DUPLICATE_KEY;
+            break;
+        }
+        extendRun(&run, other, &element);
+    }
+
+    if (res == BSONPP_KEY_NOT_FOUND) {
+        res = run.start < 0 ? BSONPP_SUCCESS : this->appendRaw(other->getBuffer() + run.start, run.end - run.start);
+    }
+    if (res != BSONPP_SUCCESS) {
+        this->truncate(start);
+    }
+    return res;
+}
+
+int32_t BSONPP::merge(BSONPP *a, BSONPP *b, BSONPPMergeIndex *index, uint8_t policy) {
+    if (m_buffer == nullptr) {
+        return BSONPP_NO_BUFFER;
+    }
+
+    int32_t start = this->getSize();
+    bool checkExisting = BSONPP_CHECKED(start > 5);
+    BSONPPRun run = { -1, -1 };
+    int32_t offset = 0;
+    BSONPPElement element;
+    int32_t res = BSONPP_SUCCESS;
+
+    // Keys already here then b's, each element of either is walked once.
+    index->clear();
+    if ((checkExisting && (res = indexElements(index, this, true, false)) != BSONPP_SUCCESS) ||
+        (res = indexElements(index, b, false, checkExisting)) != BSONPP_SUCCESS) {
+        return res;
+    }
+    int32_t firstOfB = 0;
+    while (firstOfB < index->getCount() && index->getEntry(firstOfB)->existing) {
+        firstOfB++;
+    }
+
+    // a's keys in order, runs of them copied at once until b's value is taken instead.
+    while ((res = a->nextElement(&offset, &element)) == BSONPP_SUCCESS) {
+        int32_t keyLength = 0;
+        BSONPPMergeEntry *other = index->find(element.key, BSONPPKeySet::hash(element.key, &keyLength));
+        if (other != nullptr && other->existing) {
+            res = BSONPP_DUPLICATE_KEY;
+            break;
+        }
+        if (other != nullptr && policy == BSONPP_MERGE_FAIL) {
+            res = BSONPP_DUPLICATE_KEY;
+            break;
+        }
+        if (other == nullptr || policy == BSONPP_MERGE_KEEP_FIRST) {
+            if (other != nullptr) {
+                other->taken = true;
+            }
+            extendRun(&run, a, &element);
+            continue;
+        }
+        if ((run.start >= 0 && (res = this->appendRaw(a->getBuffer() + run.start, run.end - run.start)) != BSONPP_SUCCESS) ||
+            (res = this->appendRaw(other->element, other->size)) != BSONPP_SUCCESS) {
+            break;
+        }
+        other->taken = true;
+        run.start = -1;
+    }
+    if (res == BSONPP_KEY_NOT_FOUND) {
+        res = run.start < 0 ? BSONPP_SUCCESS : this->appendRaw(a->getBuffer() + run.start, run.end - run.start);
+    }
+
+    // Then b's keys that weren't in a, in b's order from the index.
+    run.start = -1;
+    for (int32_t i = firstOfB; res == BSONPP_SUCCESS && i < index->getCount(); i++) {
+        BSONPPMergeEntry *entry = index->getEntry(i);
+        int32_t entryOffset = entry->element - b->getBuffer();
+        if (!entry->taken) {
+            run.start = run.start < 0 ? entryOffset : run.start;
+            run.end = entryOffset + entry->size;
+        } else if (run.start >= 0) {
+            res = this->appendRaw(b->getBuffer() + run.start, run.end - run.start);
+            run.start = -1;
+        }
+    }
+    if (res == BSONPP_SUCCESS && run.start >= 0) {
+        res = this->appendRaw(b->getBuffer() + run.start, run.end - run.start);
+    }
+
+    if (res != BSONPP_SUCCESS) {
+        this->truncate(start);
+    }
+    return res;
+}
+
+int32_t BSONPP::appendRaw(const uint8_t *elements, int32_t length) {
+    int32_t size = this->getSize();
+    if (size + length > m_length) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    // Minus one for the null terminator of the BSON object
+    memcpy(m_buffer + size - 1, elements, length);
+    BSONPP_COUNT(bytesCopied, length);
+    this->truncate(size + length);
+    return BSONPP_SUCCESS;
+}
+
+void BSONPP::truncate(int32_t size) {
+    m_buffer[size - 1] = 0x00;
+    this->setSize(size);
+}
+
+BSONPPMergeIndex::BSONPPMergeIndex(BSONPPMergeEntry *entries, int32_t maxEntries, uint16_t *slots, int32_t slotCount):
+    m_entries(entries), m_maxEntries(maxEntries), m_slots(slots), m_slotCount(slotCount), m_count(0) {
+    this->clear();
+}
+
+void BSONPPMergeIndex::clear() {
+    memset(m_slots, 0x00, m_slotCount * sizeof(uint16_t));
+    m_count = 0;
+}
+
+int32_t BSONPPMergeIndex::getCount() {
+    return m_count;
+}
+
+BSONPPMergeEntry *BSONPPMergeIndex::getEntry(int32_t index) {
+    return &m_entries[index];
+}
+
+int32_t BSONPPMergeIndex::add(const BSONPPElement *element, uint8_t *buffer, uint32_t hash, bool existing) {
+    if (m_count >= m_maxEntries || m_count >= UINT16_MAX || m_count >= m_slotCount / 2) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    BSONPPMergeEntry *entry = &m_entries[m_count];
+    entry->element = buffer + element->offset;
+    entry->size = element->value - buffer + element->valueSize - element->offset;
+    entry->hash = hash;
+    entry->existing = existing;
+    entry->taken = false;
+
+    int32_t slot = hash & (m_slotCount - 1);
+    while (m_slots[slot] != 0) {
+        slot = (slot + 1) & (m_slotCount - 1);
+    }
+    m_slots[slot] = static_cast<uint16_t>(++m_count);
+    return BSONPP_SUCCESS;
+}
+
+BSONPPMergeEntry *BSONPPMergeIndex::find(const char *key, uint32_t hash) {
+    // Slots are offset by one so zero can mark an empty slot, there's always one at half load.
+    for (int32_t slot = hash & (m_slotCount - 1); m_slots[slot] != 0; slot = (slot + 1) & (m_slotCount - 1)) {
+        BSONPPMergeEntry *entry = &m_entries[m_slots[slot] - 1];
+        if (entry->hash == hash && strcmp(reinterpret_cast<const char *>(entry->element + 1), key) == 0) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
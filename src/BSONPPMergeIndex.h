@@ -0,0 +1,66 @@
+#ifndef __BSONPP_MERGE_INDEX_H__
+#define __BSONPP_MERGE_INDEX_H__
+
+#include <stdint.h>
+#include "BSONPP.h"
+
+// An element indexed for a merge or copy, pointing into the document it was read from.
+struct BSONPPMergeEntry {
+    const uint8_t *element;
+    // Encoded size from the type to the end of the value.
+    int32_t size;
+    uint32_t hash;
+    // Already in the destination rather than in the document being merged.
+    bool existing;
+    // Taken in place of, or dropped for, an element with the same key in the first merged document.
+    bool taken;
+};
+
+/**
+ * Scratch for BSONPP::merge and BSONPP::appendAllFrom. The destination's existing keys and the
+ * second merged document's keys are indexed in one walk each, after which every other key is
+ * looked up in the hash table instead of by walking those documents again.
+ *
+ * Entries are kept in the order they were added with slots holding their index plus one, so a
+ * table with at most 65535 entries. Provide one entry per element of the destination and of the
+ * second merged document, and at least twice as many slots as entries, a power of two.
+ */
+class BSONPPMergeIndex {
+public:
+    BSONPPMergeIndex(BSONPPMergeEntry *entries, int32_t maxEntries, uint16_t *slots, int32_t slotCount);
+
+    void clear();
+    int32_t getCount();
+    BSONPPMergeEntry *getEntry(int32_t index);
+
+    // Returns BSONPP_OUT_OF_SPACE once the entries or half the slots are used.
+    int32_t add(const BSONPPElement *element, uint8_t *buffer, uint32_t hash, bool existing);
+    // Returns the first entry with key or nullptr.
+    BSONPPMergeEntry *find(const char *key, uint32_t hash);
+
+private:
+    BSONPPMergeEntry *m_entries;
+    int32_t m_maxEntries;
+    uint16_t *m_slots;
+    int32_t m_slotCount;
+    int32_t m_count;
+};
+
+/**
+ * Merge index which owns its tables, for example:
+ *   BSONPPStaticMergeIndex<32> index;
+ *   merged.merge(&a, &b, &index);
+ */
+template <int32_t N>
+class BSONPPStaticMergeIndex : public BSONPPMergeIndex {
+public:
+    BSONPPStaticMergeIndex(): BSONPPMergeIndex(m_entries, N, m_slots, kSlotCount) {}
+
+private:
+    static constexpr int32_t kSlotCount = bsonppKeySetTableSize(N);
+
+    BSONPPMergeEntry m_entries[N];
+    uint16_t m_slots[kSlotCount];
+};
+
+#endif // __BSONPP_MERGE_INDEX_H__
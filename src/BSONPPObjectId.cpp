@@ -0,0 +1,82 @@
+#include <string.h>
+#include "BSONPPObjectId.h"
+
+#ifdef __LINUX_BUILD
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+static std::atomic<uint64_t> generations(0);
+
+// Counter values reserved by the calling thread, only handed out in the second they were reserved.
+struct BSONPPObjectIdCache {
+    uint64_t generation;
+    uint32_t seconds;
+    uint32_t next;
+    uint32_t end;
+};
+
+static thread_local BSONPPObjectIdCache cache = {0, 0, 0, 0};
+#endif // __LINUX_BUILD
+
+BSONPPObjectIdGenerator::BSONPPObjectIdGenerator(const uint8_t *processUnique, uint32_t counter): m_counter(counter) {
+    memcpy(m_processUnique, processUnique, sizeof(m_processUnique));
+#ifdef __LINUX_BUILD
+    // Generation 0 is an empty cache.
+    m_generation = ++generations;
+#endif
+}
+
+#ifdef __LINUX_BUILD
+BSONPPObjectIdGenerator::BSONPPObjectIdGenerator(): m_counter(0) {
+    uint8_t seed[sizeof(m_processUnique) + sizeof(uint32_t)];
+    if (getrandom(seed, sizeof(seed), 0) != static_cast<ssize_t>(sizeof(seed))) {
+        // Very old kernels, distinct enough for ids that aren't security sensitive.
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        uint64_t fallback = static_cast<uint64_t>(now.tv_nsec) * 0x9E3779B97F4A7C15ULL ^ static_cast<uint64_t>(getpid()) << 32;
+        for (uint32_t i = 0; i < sizeof(seed); i++) {
+            seed[i] = static_cast<uint8_t>(fallback >> ((i % 8) * 8));
+        }
+    }
+    memcpy(m_processUnique, seed, sizeof(m_processUnique));
+    uint32_t counter = 0;
+    memcpy(&counter, seed + sizeof(m_processUnique), sizeof(uint32_t));
+    m_counter = counter;
+    m_generation = ++generations;
+}
+
+void BSONPPObjectIdGenerator::next(BSONPPObjectId *id) {
+    this->next(id, static_cast<uint32_t>(time(nullptr)));
+}
+
+uint32_t BSONPPObjectIdGenerator::nextCount(uint32_t seconds) {
+    // Other threads may have wrapped the counter since an idle thread reserved its block, a block kept
+    // into a later second could then repeat counts they hand out in that second.
+    if (cache.generation != m_generation || cache.seconds != seconds || cache.next == cache.end) {
+        cache.generation = m_generation;
+        cache.seconds = seconds;
+        cache.next = m_counter.fetch_add(BSONPP_OBJECT_ID_BLOCK, std::memory_order_relaxed);
+        cache.end = cache.next + BSONPP_OBJECT_ID_BLOCK;
+    }
+    return cache.next++;
+}
+#else
+uint32_t BSONPPObjectIdGenerator::nextCount(uint32_t seconds) {
+    (void) seconds;
+    return m_counter++;
+}
+#endif // __LINUX_BUILD
+
+void BSONPPObjectIdGenerator::next(BSONPPObjectId *id, uint32_t seconds) {
+    uint32_t count = this->nextCount(seconds);
+    // Both big endian so ids sort by time.
+    id->bytes[0] = seconds >> 24;
+    id->bytes[1] = seconds >> 16;
+    id->bytes[2] = seconds >> 8;
+    id->bytes[3] = seconds;
+    memcpy(id->bytes + 4, m_processUnique, sizeof(m_processUnique));
+    id->bytes[9] = count >> 16;
+    id->bytes[10] = count >> 8;
+    id->bytes[11] = count;
+}
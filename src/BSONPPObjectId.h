@@ -0,0 +1,50 @@
+#ifndef __BSONPP_OBJECT_ID_H__
+#define __BSONPP_OBJECT_ID_H__
+
+#include <stdint.h>
+#include "BSONPP.h"
+
+#ifdef __LINUX_BUILD
+#include <atomic>
+#endif
+
+// Counter values a thread takes from the shared counter at a time.
+#define BSONPP_OBJECT_ID_BLOCK (256)
+
+/**
+ * Generates ObjectIds without locks or allocation.
+ *
+ * On Linux next can be called from any number of threads. Each thread reserves a block of counter
+ * values with a single atomic add and hands them out from a thread local cache, so threads don't
+ * contend on the counter. A block is only used in the second it was reserved in. Ids are unique while fewer than 2^24 are made per second, though not
+ * increasing across threads. Share one generator per process, a forked child must create its own.
+ */
+class BSONPPObjectIdGenerator {
+public:
+    // processUnique is 5 random bytes identifying this generator, counter its random starting count.
+    BSONPPObjectIdGenerator(const uint8_t *processUnique, uint32_t counter);
+#ifdef __LINUX_BUILD
+    // Seeded from the kernel's random source.
+    BSONPPObjectIdGenerator();
+#endif
+
+    void next(BSONPPObjectId *id, uint32_t seconds);
+#ifdef __LINUX_BUILD
+    // Uses the current time.
+    void next(BSONPPObjectId *id);
+#endif
+
+private:
+    uint32_t nextCount(uint32_t seconds);
+
+    uint8_t m_processUnique[5];
+#ifdef __LINUX_BUILD
+    std::atomic<uint32_t> m_counter;
+    // Tells thread caches apart from those of an earlier generator at the same address.
+    uint64_t m_generation;
+#else
+    uint32_t m_counter;
+#endif
+};
+
+#endif // __BSONPP_OBJECT_ID_H__
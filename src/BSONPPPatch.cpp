@@ -0,0 +1,159 @@
+#include <string.h>
+#include "BSONPP.h"
+
+// Finds the element with the same key as wanted. Documents being diffed usually share key order so
+// the element at cursor is tried first, falling back to a scan. inOrder is cleared on a fallback.
+static bool findElement(BSONPP *doc, int32_t *cursor, const BSONPPElement *wanted, BSONPPElement *found, bool *inOrder) {
+    int32_t next = *cursor;
+    if (doc->nextElement(&next, found) == BSONPP_SUCCESS &&
+        found->keyLength == wanted->keyLength && memcmp(found->key, wanted->key, wanted->keyLength) == 0) {
+        *cursor = next;
+        return true;
+    }
+
+    *inOrder = false;
+    int32_t offset = 0;
+    while (doc->nextElement(&offset, found) == BSONPP_SUCCESS) {
+        if (found->keyLength == wanted->keyLength && memcmp(found->key, wanted->key, wanted->keyLength) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool isContainer(uint8_t type) {
+    return type == BSONPP_DOCUMENT || type == BSONPP_ARRAY;
+}
+
+int32_t BSONPP::diff(BSONPP *from, BSONPP *to) {
+    int32_t toOffset = 0;
+    int32_t fromCursor = 0;
+    bool inOrder = true;
+    BSONPPElement toElement;
+    BSONPPElement fromElement;
+    int32_t res = BSONPP_SUCCESS;
+
+    while ((res = to->nextElement(&toOffset, &toElement)) == BSONPP_SUCCESS) {
+        if (!findElement(from, &fromCursor, &toElement, &fromElement, &inOrder)) {
+            // Added.
+            res = this->appendEncoded(toElement.type, toElement.key, toElement.keyLength, toElement.value, toElement.valueSize, false);
+        } else if (fromElement.type == toElement.type && fromElement.valueSize == toElement.valueSize &&
+            memcmp(fromElement.value, toElement.value, toElement.valueSize) == 0) {
+            // Unchanged.
+            continue;
+        } else if (fromElement.type == toElement.type && isContainer(toElement.type)) {
+            BSONPP fromChild;
+            BSONPP toChild;
+            BSONPP patchChild;
+            from->getValue(fromElement.offset, &fromChild);
+            to->getValue(toElement.offset, &toChild);
+            res = this->beginDocument(toElement.key, &patchChild, toElement.type == BSONPP_ARRAY);
+            if (res == BSONPP_SUCCESS) {
+                res = patchChild.diff(&fromChild, &toChild);
+            }
+            // Children can differ in bytes but not content, for example by key order.
+            if (res == BSONPP_SUCCESS && patchChild.getSize() > 5) {
+                res = this->endDocument(&patchChild);
+            }
+        } else {
+            // Changed.
+            res = this->appendEncoded(toElement.type, toElement.key, toElement.keyLength, toElement.value, toElement.valueSize, false);
+        }
+
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+    if (res != BSONPP_KEY_NOT_FOUND) {
+        return res;
+    }
+
+    // When every key matched in order and all of from was walked nothing can have been removed.
+    int32_t end = fromCursor;
+    if (inOrder && from->nextElement(&end, &fromElement) == BSONPP_KEY_NOT_FOUND) {
+        return BSONPP_SUCCESS;
+    }
+
+    int32_t fromOffset = 0;
+    while ((res = from->nextElement(&fromOffset, &fromElement)) == BSONPP_SUCCESS) {
+        int32_t cursor = 0;
+        bool ignored = true;
+        if (!findElement(to, &cursor, &fromElement, &toElement, &ignored)) {
+            // Removed.
+            res = this->appendEncoded(BSONPP_UNDEFINED, fromElement.key, fromElement.keyLength, nullptr, 0, false);
+            if (res != BSONPP_SUCCESS) {
+                return res;
+            }
+        }
+    }
+
+    return res == BSONPP_KEY_NOT_FOUND ? BSONPP_SUCCESS : res;
+}
+
+int32_t BSONPP::applyPatch(BSONPP *base, BSONPP *patch) {
+    int32_t baseOffset = 0;
+    int32_t patchCursor = 0;
+    int32_t matched = 0;
+    bool inOrder = true;
+    BSONPPElement baseElement;
+    BSONPPElement patchElement;
+    int32_t res = BSONPP_SUCCESS;
+
+    while ((res = base->nextElement(&baseOffset, &baseElement)) == BSONPP_SUCCESS) {
+        if (!findElement(patch, &patchCursor, &baseElement, &patchElement, &inOrder)) {
+            // Unchanged.
+            res = this->appendEncoded(baseElement.type, baseElement.key, baseElement.keyLength, baseElement.value, baseElement.valueSize, false);
+        } else if (patchElement.type == BSONPP_UNDEFINED) {
+            // Removed.
+            matched++;
+            continue;
+        } else if (patchElement.type == baseElement.type && isContainer(patchElement.type)) {
+            matched++;
+            BSONPP baseChild;
+            BSONPP patchChild;
+            BSONPP outChild;
+            base->getValue(baseElement.offset, &baseChild);
+            patch->getValue(patchElement.offset, &patchChild);
+            res = this->beginDocument(baseElement.key, &outChild, baseElement.type == BSONPP_ARRAY);
+            if (res == BSONPP_SUCCESS) {
+                res = outChild.applyPatch(&baseChild, &patchChild);
+            }
+            if (res == BSONPP_SUCCESS) {
+                res = this->endDocument(&outChild);
+            }
+        } else {
+            // Changed.
+            matched++;
+            res = this->appendEncoded(patchElement.type, patchElement.key, patchElement.keyLength, patchElement.value, patchElement.valueSize, false);
+        }
+
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+    if (res != BSONPP_KEY_NOT_FOUND) {
+        return res;
+    }
+
+    // Anything in the patch that wasn't matched to a base key was added.
+    int32_t patchCount = 0;
+    res = patch->getKeyCount(&patchCount);
+    if (res != BSONPP_SUCCESS || patchCount == matched) {
+        return res;
+    }
+
+    int32_t patchOffset = 0;
+    while ((res = patch->nextElement(&patchOffset, &patchElement)) == BSONPP_SUCCESS) {
+        int32_t cursor = 0;
+        bool ignored = true;
+        if (patchElement.type == BSONPP_UNDEFINED || findElement(base, &cursor, &patchElement, &baseElement, &ignored)) {
+            continue;
+        }
+        res = this->appendEncoded(patchElement.type, patchElement.key, patchElement.keyLength, patchElement.value, patchElement.valueSize, false);
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+
+    return res == BSONPP_KEY_NOT_FOUND ? BSONPP_SUCCESS : res;
+}
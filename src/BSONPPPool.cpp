@@ -0,0 +1,290 @@
+#ifdef __LINUX_BUILD
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include "BSONPPPool.h"
+
+// Buffers start a cache line after their node so they're cache line aligned.
+#define BSONPP_POOL_HEADER (64)
+#define BSONPP_POOL_POINTER_BITS (48)
+#define BSONPP_POOL_POINTER_MASK ((1ULL << BSONPP_POOL_POINTER_BITS) - 1)
+
+struct BSONPPPoolNode {
+    // Atomic as a stale node may be read by a shared list pop that then fails.
+    std::atomic<BSONPPPoolNode *> next;
+    BSONPPPoolNode *allNext;
+    int32_t sizeClass;
+};
+
+// Owned by one thread at a time. Counters are atomic only so getStats can read them.
+struct alignas(64) BSONPPPoolCache {
+    BSONPPPoolNode *heads[BSONPP_POOL_MAX_CLASSES];
+    uint32_t counts[BSONPP_POOL_MAX_CLASSES];
+    std::atomic<uint64_t> acquires;
+    std::atomic<uint64_t> localHits;
+    std::atomic<uint64_t> sharedHits;
+    std::atomic<uint64_t> allocations;
+    std::atomic<uint64_t> spills;
+};
+
+// Cache indexes in use by live threads, shared by every pool.
+static std::atomic<uint64_t> threadsInUse[BSONPP_POOL_MAX_THREADS / 64];
+
+// Gives up the thread's cache index when it exits.
+struct BSONPPPoolThread {
+    // -1 before the first acquire, -2 when every index was taken.
+    int32_t index = -1;
+
+    ~BSONPPPoolThread() {
+        if (index >= 0) {
+            threadsInUse[index / 64].fetch_and(~(1ULL << (index % 64)), std::memory_order_release);
+        }
+    }
+};
+
+static thread_local BSONPPPoolThread poolThread;
+
+static int32_t getThreadIndex() {
+    if (poolThread.index != -1) {
+        return poolThread.index;
+    }
+
+    poolThread.index = -2;
+    for (int32_t word = 0; word < BSONPP_POOL_MAX_THREADS / 64; word++) {
+        uint64_t used = threadsInUse[word].load(std::memory_order_relaxed);
+        while (used != ~0ULL) {
+            int32_t bit = __builtin_ctzll(~used);
+            // Acquire pairs with the release of the thread that last had the index and its cache.
+            if (threadsInUse[word].compare_exchange_weak(used, used | (1ULL << bit), std::memory_order_acquire)) {
+                poolThread.index = word * 64 + bit;
+                return poolThread.index;
+            }
+        }
+    }
+    return poolThread.index;
+}
+
+// Only the owning thread writes a cache's counters so a plain add is enough.
+static void increment(std::atomic<uint64_t> *counter) {
+    counter->store(counter->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static BSONPPPoolNode *getNode(uint64_t tagged) {
+    return reinterpret_cast<BSONPPPoolNode *>(static_cast<uintptr_t>(tagged & BSONPP_POOL_POINTER_MASK));
+}
+
+static uint64_t tagNode(BSONPPPoolNode *node, uint64_t previous) {
+    uint64_t tag = (previous >> BSONPP_POOL_POINTER_BITS) + 1;
+    return reinterpret_cast<uintptr_t>(node) | (tag << BSONPP_POOL_POINTER_BITS);
+}
+
+static uint8_t *getData(BSONPPPoolNode *node) {
+    return reinterpret_cast<uint8_t *>(node) + BSONPP_POOL_HEADER;
+}
+
+BSONPPBufferPool::BSONPPBufferPool(int32_t minSize, int32_t classCount): m_minSize(64), m_classCount(classCount),
+    m_all(nullptr), m_acquires(0), m_sharedHits(0), m_allocations(0) {
+    while (m_minSize < minSize && m_minSize < (1 << 30)) {
+        m_minSize <<= 1;
+    }
+    if (m_classCount < 1) {
+        m_classCount = 1;
+    }
+    if (m_classCount > BSONPP_POOL_MAX_CLASSES) {
+        m_classCount = BSONPP_POOL_MAX_CLASSES;
+    }
+    // The largest class must fit in an int32.
+    while (m_classCount > 1 && (static_cast<int64_t>(m_minSize) << (m_classCount - 1)) > (1LL << 30)) {
+        m_classCount--;
+    }
+
+    for (int32_t i = 0; i < BSONPP_POOL_MAX_CLASSES; i++) {
+        m_shared[i].store(0, std::memory_order_relaxed);
+    }
+
+    m_caches = static_cast<BSONPPPoolCache *>(aligned_alloc(alignof(BSONPPPoolCache), sizeof(BSONPPPoolCache) * BSONPP_POOL_MAX_THREADS));
+    if (m_caches != nullptr) {
+        for (int32_t i = 0; i < BSONPP_POOL_MAX_THREADS; i++) {
+            BSONPPPoolCache *cache = new (m_caches + i) BSONPPPoolCache();
+            memset(cache->heads, 0x00, sizeof(cache->heads));
+            memset(cache->counts, 0x00, sizeof(cache->counts));
+            cache->acquires.store(0, std::memory_order_relaxed);
+            cache->localHits.store(0, std::memory_order_relaxed);
+            cache->sharedHits.store(0, std::memory_order_relaxed);
+            cache->allocations.store(0, std::memory_order_relaxed);
+            cache->spills.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+BSONPPBufferPool::~BSONPPBufferPool() {
+    BSONPPPoolNode *node = m_all.load(std::memory_order_acquire);
+    while (node != nullptr) {
+        BSONPPPoolNode *next = node->allNext;
+        node->~BSONPPPoolNode();
+        free(node);
+        node = next;
+    }
+    if (m_caches != nullptr) {
+        for (int32_t i = 0; i < BSONPP_POOL_MAX_THREADS; i++) {
+            m_caches[i].~BSONPPPoolCache();
+        }
+        free(m_caches);
+    }
+}
+
+int32_t BSONPPBufferPool::getClassSize(int32_t sizeClass) {
+    return m_minSize << sizeClass;
+}
+
+int32_t BSONPPBufferPool::getClass(int32_t size) {
+    for (int32_t sizeClass = 0; sizeClass < m_classCount; sizeClass++) {
+        if (size <= this->getClassSize(sizeClass)) {
+            return sizeClass;
+        }
+    }
+    return -1;
+}
+
+BSONPPPoolNode *BSONPPBufferPool::allocate(int32_t sizeClass) {
+    void *memory = aligned_alloc(BSONPP_POOL_HEADER, BSONPP_POOL_HEADER + this->getClassSize(sizeClass));
+    if (memory == nullptr) {
+        return nullptr;
+    }
+    // The shared lists keep a tag above the pointer bits.
+    if ((reinterpret_cast<uintptr_t>(memory) & ~BSONPP_POOL_POINTER_MASK) != 0) {
+        free(memory);
+        return nullptr;
+    }
+
+    BSONPPPoolNode *node = new (memory) BSONPPPoolNode();
+    node->next.store(nullptr, std::memory_order_relaxed);
+    node->sizeClass = sizeClass;
+    node->allNext = m_all.load(std::memory_order_relaxed);
+    while (!m_all.compare_exchange_weak(node->allNext, node, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    return node;
+}
+
+BSONPPPoolNode *BSONPPBufferPool::popShared(int32_t sizeClass) {
+    uint64_t head = m_shared[sizeClass].load(std::memory_order_acquire);
+    while (true) {
+        BSONPPPoolNode *node = getNode(head);
+        if (node == nullptr) {
+            return nullptr;
+        }
+        // Nodes are never freed so reading next is safe even if another thread took node first,
+        // the tag then fails the exchange.
+        BSONPPPoolNode *next = node->next.load(std::memory_order_relaxed);
+        if (m_shared[sizeClass].compare_exchange_weak(head, tagNode(next, head), std::memory_order_acquire)) {
+            return node;
+        }
+    }
+}
+
+void BSONPPBufferPool::pushShared(int32_t sizeClass, BSONPPPoolNode *first, BSONPPPoolNode *last) {
+    uint64_t head = m_shared[sizeClass].load(std::memory_order_relaxed);
+    do {
+        last->next.store(getNode(head), std::memory_order_relaxed);
+    } while (!m_shared[sizeClass].compare_exchange_weak(head, tagNode(first, head), std::memory_order_release,
+        std::memory_order_relaxed));
+}
+
+int32_t BSONPPBufferPool::acquire(int32_t size, BSONPP *doc) {
+    int32_t sizeClass = this->getClass(size);
+    if (sizeClass < 0) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    int32_t index = m_caches == nullptr ? -1 : getThreadIndex();
+    BSONPPPoolNode *node = nullptr;
+    if (index >= 0) {
+        BSONPPPoolCache *cache = m_caches + index;
+        increment(&cache->acquires);
+        node = cache->heads[sizeClass];
+        if (node != nullptr) {
+            cache->heads[sizeClass] = node->next.load(std::memory_order_relaxed);
+            cache->counts[sizeClass]--;
+            increment(&cache->localHits);
+        } else if ((node = this->popShared(sizeClass)) != nullptr) {
+            increment(&cache->sharedHits);
+            // Take a batch so the next acquires stay local.
+            for (int32_t i = 1; i < BSONPP_POOL_BATCH; i++) {
+                BSONPPPoolNode *extra = this->popShared(sizeClass);
+                if (extra == nullptr) {
+                    break;
+                }
+                extra->next.store(cache->heads[sizeClass], std::memory_order_relaxed);
+                cache->heads[sizeClass] = extra;
+                cache->counts[sizeClass]++;
+            }
+        } else if ((node = this->allocate(sizeClass)) != nullptr) {
+            increment(&cache->allocations);
+        }
+    } else {
+        m_acquires.fetch_add(1, std::memory_order_relaxed);
+        if ((node = this->popShared(sizeClass)) != nullptr) {
+            m_sharedHits.fetch_add(1, std::memory_order_relaxed);
+        } else if ((node = this->allocate(sizeClass)) != nullptr) {
+            m_allocations.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (node == nullptr) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+    // Only the empty document is written, not the whole buffer.
+    *doc = BSONPP(getData(node), this->getClassSize(sizeClass));
+    return BSONPP_SUCCESS;
+}
+
+void BSONPPBufferPool::release(BSONPP *doc) {
+    BSONPPPoolNode *node = reinterpret_cast<BSONPPPoolNode *>(doc->getBuffer() - BSONPP_POOL_HEADER);
+    int32_t sizeClass = node->sizeClass;
+    *doc = BSONPP();
+
+    int32_t index = m_caches == nullptr ? -1 : getThreadIndex();
+    if (index < 0) {
+        this->pushShared(sizeClass, node, node);
+        return;
+    }
+
+    BSONPPPoolCache *cache = m_caches + index;
+    node->next.store(cache->heads[sizeClass], std::memory_order_relaxed);
+    cache->heads[sizeClass] = node;
+    if (++cache->counts[sizeClass] <= BSONPP_POOL_CACHE_SIZE) {
+        return;
+    }
+
+    // Move the most recently released batch to the shared list in one exchange.
+    BSONPPPoolNode *first = cache->heads[sizeClass];
+    BSONPPPoolNode *last = first;
+    for (int32_t i = 1; i < BSONPP_POOL_BATCH; i++) {
+        last = last->next.load(std::memory_order_relaxed);
+    }
+    cache->heads[sizeClass] = last->next.load(std::memory_order_relaxed);
+    cache->counts[sizeClass] -= BSONPP_POOL_BATCH;
+    this->pushShared(sizeClass, first, last);
+    increment(&cache->spills);
+}
+
+void BSONPPBufferPool::getStats(BSONPPBufferPoolStats *stats) {
+    stats->acquires = m_acquires.load(std::memory_order_relaxed);
+    stats->localHits = 0;
+    stats->sharedHits = m_sharedHits.load(std::memory_order_relaxed);
+    stats->allocations = m_allocations.load(std::memory_order_relaxed);
+    stats->spills = 0;
+    if (m_caches == nullptr) {
+        return;
+    }
+    for (int32_t i = 0; i < BSONPP_POOL_MAX_THREADS; i++) {
+        stats->acquires += m_caches[i].acquires.load(std::memory_order_relaxed);
+        stats->localHits += m_caches[i].localHits.load(std::memory_order_relaxed);
+        stats->sharedHits += m_caches[i].sharedHits.load(std::memory_order_relaxed);
+        stats->allocations += m_caches[i].allocations.load(std::memory_order_relaxed);
+        stats->spills += m_caches[i].spills.load(std::memory_order_relaxed);
+    }
+}
+
+#endif // __LINUX_BUILD
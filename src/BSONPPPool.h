@@ -0,0 +1,81 @@
+#ifndef __BSONPP_POOL_H__
+#define __BSONPP_POOL_H__
+
+#ifdef __LINUX_BUILD
+
+#include <atomic>
+#include <stdint.h>
+#include "BSONPP.h"
+
+// Most size classes in a pool.
+#define BSONPP_POOL_MAX_CLASSES (16)
+// Most threads with their own cache at once, threads beyond it use the shared lists directly.
+#define BSONPP_POOL_MAX_THREADS (128)
+// Buffers a thread caches per size class before moving a batch to the shared list.
+#define BSONPP_POOL_CACHE_SIZE (32)
+// Buffers moved between a thread cache and the shared list at a time.
+#define BSONPP_POOL_BATCH (16)
+
+struct BSONPPBufferPoolStats {
+    uint64_t acquires;
+    // Acquires served from the thread's own cache.
+    uint64_t localHits;
+    // Acquires served from the shared list, refilling the thread's cache.
+    uint64_t sharedHits;
+    // Acquires that had to allocate a new buffer.
+    uint64_t allocations;
+    // Batches moved from a full thread cache to the shared list.
+    uint64_t spills;
+};
+
+struct BSONPPPoolNode;
+struct BSONPPPoolCache;
+
+/**
+ * Size classed document buffers for servers that would otherwise allocate one per message.
+ *
+ * Classes are powers of two starting at minSize. Each thread keeps a small free list per class,
+ * so acquiring and releasing on the same thread touches no shared state. Full caches move a batch
+ * to a lock-free shared list per class and empty ones refill from it before allocating. Buffers are
+ * only freed when the pool is destroyed, after every document has been released.
+ *
+ * Caches are per thread rather than per core, a thread can't be moved mid operation so no atomics
+ * are needed. A thread's cache passes to the next thread started after it exits.
+ */
+class BSONPPBufferPool {
+public:
+    BSONPPBufferPool(int32_t minSize = 256, int32_t classCount = 8);
+    ~BSONPPBufferPool();
+
+    // Points doc at an empty document with a buffer of at least size bytes. Returns BSONPP_OUT_OF_SPACE
+    // if size is larger than the largest class or memory runs out.
+    int32_t acquire(int32_t size, BSONPP *doc);
+    // Returns the buffer behind a document from acquire. doc must still point at the start of it.
+    void release(BSONPP *doc);
+
+    // Counters summed over every thread, approximate while other threads are running.
+    void getStats(BSONPPBufferPoolStats *stats);
+    int32_t getClassSize(int32_t sizeClass);
+
+private:
+    int32_t getClass(int32_t size);
+    BSONPPPoolNode *allocate(int32_t sizeClass);
+    BSONPPPoolNode *popShared(int32_t sizeClass);
+    void pushShared(int32_t sizeClass, BSONPPPoolNode *first, BSONPPPoolNode *last);
+
+    int32_t m_minSize;
+    int32_t m_classCount;
+    BSONPPPoolCache *m_caches;
+    // Treiber stacks with an ABA tag in the top 16 bits of the pointer.
+    std::atomic<uint64_t> m_shared[BSONPP_POOL_MAX_CLASSES];
+    // Every buffer allocated, for the destructor.
+    std::atomic<BSONPPPoolNode *> m_all;
+    // Counters for threads without a cache.
+    std::atomic<uint64_t> m_acquires;
+    std::atomic<uint64_t> m_sharedHits;
+    std::atomic<uint64_t> m_allocations;
+};
+
+#endif // __LINUX_BUILD
+
+#endif // __BSONPP_POOL_H__
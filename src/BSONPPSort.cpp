@@ -0,0 +1,443 @@
+#ifdef __LINUX_BUILD
+
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "BSONPPSort.h"
+#include "NetworkUtil.h"
+
+// Runs smaller than this per thread are sorted on fewer threads.
+#define BSONPP_SORT_MIN_THREAD_ENTRIES (4096)
+// iovecs gathered per writev when writing a sorted run.
+#define BSONPP_SORT_WRITE_IOVECS (64)
+
+// Documents without the field sort as if it were null, this is a document holding a null element.
+static uint8_t kMissing[] = {0x07, 0x00, 0x00, 0x00, BSONPP_NULL, 0x00, 0x00};
+
+static int32_t getField(BSONPP *doc, const char *path, BSONPP *owner, int32_t *offset) {
+    int32_t res = doc->findPath(path, owner, offset);
+    if (res == BSONPP_KEY_NOT_FOUND) {
+        *owner = BSONPP(kMissing, sizeof(kMissing), false);
+        *offset = sizeof(int32_t);
+        return BSONPP_SUCCESS;
+    }
+    return res;
+}
+
+// Only needed when sort keys tie.
+static int32_t compareFields(const char *path, BSONPP *a, BSONPP *b) {
+    BSONPP aOwner;
+    BSONPP bOwner;
+    int32_t aOffset = 0;
+    int32_t bOffset = 0;
+    int32_t result = 0;
+    if (getField(a, path, &aOwner, &aOffset) == BSONPP_SUCCESS && getField(b, path, &bOwner, &bOffset) == BSONPP_SUCCESS) {
+        aOwner.compareValue(aOffset, &bOwner, bOffset, &result);
+    }
+    return result;
+}
+
+struct BSONPPSortEntryLess {
+    uint8_t *memory;
+    const char *path;
+
+    bool operator()(const BSONPPSortEntry &a, const BSONPPSortEntry &b) const {
+        if (a.key != b.key) {
+            return a.key < b.key;
+        }
+        BSONPP aDoc(memory + a.offset, a.size, false);
+        BSONPP bDoc(memory + b.offset, b.size, false);
+        int32_t result = compareFields(path, &aDoc, &bDoc);
+        if (result != 0) {
+            return result < 0;
+        }
+        // Documents are copied in the order they're added.
+        return a.offset < b.offset;
+    }
+};
+
+// Reads the key and document records of a spilled run through a slice of the memory budget.
+struct BSONPPSortRun {
+    int fd;
+    off_t position;
+    uint8_t *buffer;
+    size_t length;
+    size_t start;
+    size_t end;
+    uint64_t key;
+    BSONPP doc;
+    bool valid;
+};
+
+static int32_t writevAll(int fd, struct iovec *iovecs, int32_t count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iovecs, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return BSONPP_IO_ERROR;
+        }
+        while (count > 0 && written >= static_cast<ssize_t>(iovecs->iov_len)) {
+            written -= iovecs->iov_len;
+            iovecs++;
+            count--;
+        }
+        if (written > 0) {
+            iovecs->iov_base = static_cast<uint8_t *>(iovecs->iov_base) + written;
+            iovecs->iov_len -= written;
+        }
+    }
+    return BSONPP_SUCCESS;
+}
+
+// Makes at least wanted bytes available from start, BSONPP_END_OF_STREAM at the end of the run.
+static int32_t fillRun(BSONPPSortRun *run, size_t wanted) {
+    if (run->end - run->start >= wanted) {
+        return BSONPP_SUCCESS;
+    }
+    if (wanted > run->length) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+
+    memmove(run->buffer, run->buffer + run->start, run->end - run->start);
+    run->end -= run->start;
+    run->start = 0;
+    while (run->end < wanted) {
+        ssize_t res = pread(run->fd, run->buffer + run->end, run->length - run->end, run->position);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return BSONPP_IO_ERROR;
+        }
+        if (res == 0) {
+            return run->end == 0 ? BSONPP_END_OF_STREAM : BSONPP_INVALID_DOCUMENT;
+        }
+        run->end += res;
+        run->position += res;
+    }
+    return BSONPP_SUCCESS;
+}
+
+static int32_t nextRecord(BSONPPSortRun *run) {
+    int32_t res = fillRun(run, sizeof(uint64_t) + sizeof(int32_t));
+    if (res == BSONPP_END_OF_STREAM) {
+        run->valid = false;
+        return BSONPP_SUCCESS;
+    }
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    int32_t size = 0;
+    memcpy(&size, run->buffer + run->start + sizeof(uint64_t), sizeof(int32_t));
+    size = letoh32(size);
+    if (size < 5) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+    res = fillRun(run, sizeof(uint64_t) + size);
+    if (res != BSONPP_SUCCESS) {
+        return res == BSONPP_END_OF_STREAM ? BSONPP_INVALID_DOCUMENT : res;
+    }
+
+    memcpy(&run->key, run->buffer + run->start, sizeof(uint64_t));
+    run->doc = BSONPP(run->buffer + run->start + sizeof(uint64_t), size, false);
+    run->start += sizeof(uint64_t) + size;
+    run->valid = true;
+    return BSONPP_SUCCESS;
+}
+
+// Heap order for the merge, the smallest head on top and earlier runs first when equal.
+struct BSONPPSortRunGreater {
+    BSONPPSortRun *runs;
+    const char *path;
+
+    bool operator()(int32_t a, int32_t b) const {
+        if (runs[a].key != runs[b].key) {
+            return runs[a].key > runs[b].key;
+        }
+        int32_t result = compareFields(path, &runs[a].doc, &runs[b].doc);
+        if (result != 0) {
+            return result > 0;
+        }
+        return a > b;
+    }
+};
+
+BSONPPSorter::BSONPPSorter(uint8_t *memory, size_t memoryLength, const char *fieldPath, const char *tempDirectory, int32_t threads):
+    m_memory(memory), m_memoryLength(memoryLength), m_fieldPath(fieldPath), m_tempDirectory(tempDirectory),
+    m_threads(threads < 1 ? 1 : (threads > BSONPP_SORT_MAX_THREADS ? BSONPP_SORT_MAX_THREADS : threads)),
+    m_used(0), m_count(0), m_runCount(0) {}
+
+BSONPPSorter::~BSONPPSorter() {
+    this->clear();
+}
+
+void BSONPPSorter::clear() {
+    for (int32_t i = 0; i < m_runCount; i++) {
+        close(m_runs[i]);
+    }
+    m_runCount = 0;
+    m_used = 0;
+    m_count = 0;
+}
+
+int32_t BSONPPSorter::getRunCount() {
+    return m_runCount;
+}
+
+// Entries sit at the end of the budget, aligned down.
+static BSONPPSortEntry *entriesEnd(uint8_t *memory, size_t length) {
+    uintptr_t end = reinterpret_cast<uintptr_t>(memory + length);
+    return reinterpret_cast<BSONPPSortEntry *>(end - end % alignof(BSONPPSortEntry));
+}
+
+int32_t BSONPPSorter::add(BSONPP *doc) {
+    BSONPPSortEntry entry;
+    BSONPP owner;
+    int32_t field = 0;
+    int32_t res = getField(doc, m_fieldPath, &owner, &field);
+    if (res == BSONPP_SUCCESS) {
+        res = owner.getSortKey(field, &entry.key);
+    }
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    entry.size = doc->getSize();
+    // Merging gives each run and the output an equal share of the budget, which must hold the
+    // document and its key. Rejected now rather than failing the sort once the runs are merged.
+    if (entry.size + sizeof(uint64_t) > m_memoryLength / (BSONPP_SORT_MAX_RUNS + 1)) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+    uint8_t *limit = reinterpret_cast<uint8_t *>(entriesEnd(m_memory, m_memoryLength) - m_count - 1);
+    if (m_memory + m_used + entry.size > limit) {
+        if (m_count == 0) {
+            return BSONPP_OUT_OF_SPACE;
+        }
+        res = this->spillRun();
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+        limit = reinterpret_cast<uint8_t *>(entriesEnd(m_memory, m_memoryLength) - 1);
+        if (m_memory + entry.size > limit) {
+            return BSONPP_OUT_OF_SPACE;
+        }
+    }
+
+    entry.offset = m_used;
+    memcpy(m_memory + m_used, doc->getBuffer(), entry.size);
+    m_used += entry.size;
+    m_count++;
+    *(entriesEnd(m_memory, m_memoryLength) - m_count) = entry;
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPSorter::createRun() {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/bsonppsortXXXXXX", m_tempDirectory) >= static_cast<int>(sizeof(path))) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return BSONPP_IO_ERROR;
+    }
+    // Unlinked straight away so runs never outlive the sorter.
+    unlink(path);
+    return fd;
+}
+
+// Sorts the entries in memory, splitting them into one chunk per thread. Chunks are merged as they're written.
+int32_t BSONPPSorter::sortRun() {
+    BSONPPSortEntry *entries = entriesEnd(m_memory, m_memoryLength) - m_count;
+    BSONPPSortEntryLess less = {m_memory, m_fieldPath};
+
+    int32_t chunks = m_count / BSONPP_SORT_MIN_THREAD_ENTRIES;
+    chunks = chunks < 1 ? 1 : (chunks > m_threads ? m_threads : chunks);
+    uint32_t chunkSize = (m_count + chunks - 1) / chunks;
+
+    std::thread threads[BSONPP_SORT_MAX_THREADS];
+    for (int32_t i = 1; i < chunks; i++) {
+        BSONPPSortEntry *start = entries + i * chunkSize;
+        BSONPPSortEntry *end = entries + std::min(m_count, (i + 1) * chunkSize);
+        threads[i] = std::thread([start, end, less]() {
+            std::sort(start, end, less);
+        });
+    }
+    std::sort(entries, entries + std::min(m_count, chunkSize), less);
+    for (int32_t i = 1; i < chunks; i++) {
+        threads[i].join();
+    }
+
+    return chunks;
+}
+
+// Writes the sorted chunks from sortRun merged, with their keys when the output is a run.
+static int32_t writeChunks(int fd, BSONPPSortEntry *entries, uint32_t count, int32_t chunks, uint8_t *memory, const char *path, bool keepKeys) {
+    BSONPPSortEntryLess less = {memory, path};
+    uint32_t chunkSize = (count + chunks - 1) / chunks;
+    uint32_t positions[BSONPP_SORT_MAX_THREADS];
+    uint32_t ends[BSONPP_SORT_MAX_THREADS];
+    for (int32_t i = 0; i < chunks; i++) {
+        positions[i] = i * chunkSize;
+        ends[i] = std::min(count, (i + 1) * chunkSize);
+    }
+
+    struct iovec iovecs[BSONPP_SORT_WRITE_IOVECS];
+    int32_t used = 0;
+    for (uint32_t written = 0; written < count; written++) {
+        int32_t best = -1;
+        for (int32_t i = 0; i < chunks; i++) {
+            if (positions[i] < ends[i] && (best < 0 || less(entries[positions[i]], entries[positions[best]]))) {
+                best = i;
+            }
+        }
+
+        BSONPPSortEntry *entry = entries + positions[best]++;
+        if (keepKeys) {
+            iovecs[used].iov_base = &entry->key;
+            iovecs[used++].iov_len = sizeof(uint64_t);
+        }
+        iovecs[used].iov_base = memory + entry->offset;
+        iovecs[used++].iov_len = entry->size;
+
+        if (used + 2 > BSONPP_SORT_WRITE_IOVECS || written + 1 == count) {
+            int32_t res = writevAll(fd, iovecs, used);
+            if (res != BSONPP_SUCCESS) {
+                return res;
+            }
+            used = 0;
+        }
+    }
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPSorter::spillRun() {
+    int fd = this->createRun();
+    if (fd < 0) {
+        return fd;
+    }
+
+    int32_t chunks = this->sortRun();
+    int32_t res = writeChunks(fd, entriesEnd(m_memory, m_memoryLength) - m_count, m_count, chunks, m_memory, m_fieldPath, true);
+    if (res != BSONPP_SUCCESS) {
+        close(fd);
+        return res;
+    }
+    m_runs[m_runCount++] = fd;
+    m_used = 0;
+    m_count = 0;
+
+    // Too many runs to merge at once, fold them into one.
+    if (m_runCount == BSONPP_SORT_MAX_RUNS) {
+        fd = this->createRun();
+        if (fd < 0) {
+            return fd;
+        }
+        res = this->mergeRuns(fd, true);
+        if (res != BSONPP_SUCCESS) {
+            close(fd);
+            return res;
+        }
+        for (int32_t i = 0; i < m_runCount; i++) {
+            close(m_runs[i]);
+        }
+        m_runs[0] = fd;
+        m_runCount = 1;
+    }
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPSorter::mergeRuns(int fd, bool keepKeys) {
+    // The budget is split evenly between the runs and the output.
+    size_t share = m_memoryLength / (m_runCount + 1);
+    BSONPPSortRun runs[BSONPP_SORT_MAX_RUNS];
+    int32_t heap[BSONPP_SORT_MAX_RUNS];
+    int32_t heapSize = 0;
+    BSONPPSortRunGreater greater = {runs, m_fieldPath};
+
+    for (int32_t i = 0; i < m_runCount; i++) {
+        runs[i].fd = m_runs[i];
+        runs[i].position = 0;
+        runs[i].buffer = m_memory + share * (i + 1);
+        runs[i].length = share;
+        runs[i].start = 0;
+        runs[i].end = 0;
+        int32_t res = nextRecord(runs + i);
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+        if (runs[i].valid) {
+            heap[heapSize++] = i;
+        }
+    }
+    std::make_heap(heap, heap + heapSize, greater);
+
+    // Output is buffered in the first share.
+    uint8_t *output = m_memory;
+    size_t outputUsed = 0;
+    while (heapSize > 0) {
+        std::pop_heap(heap, heap + heapSize, greater);
+        BSONPPSortRun *run = runs + heap[heapSize - 1];
+
+        size_t size = run->doc.getSize() + (keepKeys ? sizeof(uint64_t) : 0);
+        if (outputUsed + size > share) {
+            struct iovec iovec = {output, outputUsed};
+            int32_t res = writevAll(fd, &iovec, 1);
+            if (res != BSONPP_SUCCESS) {
+                return res;
+            }
+            outputUsed = 0;
+        }
+        if (keepKeys) {
+            memcpy(output + outputUsed, &run->key, sizeof(uint64_t));
+            outputUsed += sizeof(uint64_t);
+        }
+        memcpy(output + outputUsed, run->doc.getBuffer(), run->doc.getSize());
+        outputUsed += run->doc.getSize();
+
+        int32_t res = nextRecord(run);
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+        if (run->valid) {
+            std::push_heap(heap, heap + heapSize, greater);
+        } else {
+            heapSize--;
+        }
+    }
+
+    struct iovec iovec = {output, outputUsed};
+    return writevAll(fd, &iovec, outputUsed > 0 ? 1 : 0);
+}
+
+int32_t BSONPPSorter::finish(int fd) {
+    int32_t res = BSONPP_SUCCESS;
+    if (m_runCount == 0) {
+        // Everything fit in memory.
+        if (m_count > 0) {
+            int32_t chunks = this->sortRun();
+            res = writeChunks(fd, entriesEnd(m_memory, m_memoryLength) - m_count, m_count, chunks, m_memory, m_fieldPath, false);
+        }
+    } else {
+        if (m_count > 0) {
+            res = this->spillRun();
+        }
+        if (res == BSONPP_SUCCESS) {
+            res = this->mergeRuns(fd, false);
+        }
+    }
+
+    this->clear();
+    return res;
+}
+
+#endif // __LINUX_BUILD
@@ -0,0 +1,72 @@
+#ifndef __BSONPP_SORT_H__
+#define __BSONPP_SORT_H__
+
+#ifdef __LINUX_BUILD
+
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "BSONPP.h"
+
+// Most runs kept on disk at once, reaching it merges them into a single run.
+#define BSONPP_SORT_MAX_RUNS (64)
+// Most threads used to sort a run.
+#define BSONPP_SORT_MAX_THREADS (16)
+
+// A document in the memory budget, its sort key and where it was copied to.
+struct BSONPPSortEntry {
+    uint64_t key;
+    uint32_t offset;
+    uint32_t size;
+};
+
+/**
+ * External merge sort of documents by one field, ascending by the BSON comparison rules with
+ * documents missing the field sorting as null. Equal documents keep the order they were added in.
+ *
+ * Documents are copied into the caller provided memory budget with their BSONPP::getSortKey, which
+ * is extracted once per document. When the budget fills the entries are sorted on several threads
+ * and the run is spilled to an unnamed temporary file, keys included. finish then k-way merges the
+ * runs into the output, comparing the stored keys and only looking at the field itself when keys tie.
+ * A run of documents that fit in memory is written straight to the output.
+ */
+class BSONPPSorter {
+public:
+    // Runs are created in tempDirectory. The budget must be under 4GB. Merging splits it evenly between
+    // one buffer per run, up to BSONPP_SORT_MAX_RUNS, and one for the output, each holding a whole
+    // document and its 8 byte key, so documents can be at most budget / (BSONPP_SORT_MAX_RUNS + 1) - 8.
+    BSONPPSorter(uint8_t *memory, size_t memoryLength, const char *fieldPath, const char *tempDirectory, int32_t threads = 1);
+    ~BSONPPSorter();
+
+    // Returns BSONPP_OUT_OF_SPACE for documents over the limit above, even if the runs never need merging.
+    int32_t add(BSONPP *doc);
+    // Writes every document added in order to a blocking fd and resets the sorter.
+    int32_t finish(int fd);
+    void clear();
+
+    int32_t getRunCount();
+
+private:
+    int32_t sortRun();
+    int32_t spillRun();
+    int32_t mergeRuns(int fd, bool keepKeys);
+    int32_t createRun();
+
+    uint8_t *m_memory;
+    size_t m_memoryLength;
+    const char *m_fieldPath;
+    const char *m_tempDirectory;
+    int32_t m_threads;
+
+    // Documents fill the budget from the front and entries from the back.
+    size_t m_used;
+    uint32_t m_count;
+
+    int m_runs[BSONPP_SORT_MAX_RUNS];
+    int32_t m_runCount;
+};
+
+#endif // __LINUX_BUILD
+
+#endif // __BSONPP_SORT_H__
@@ -0,0 +1,73 @@
+#ifdef BSONPP_INSTRUMENT
+
+#include <string.h>
+#include "BSONPP.h"
+#include "BSONPPStats.h"
+
+#ifdef __LINUX_BUILD
+static thread_local BSONPPStats stats;
+#else
+static BSONPPStats stats;
+#endif
+
+static BSONPPTraceHook traceHook = nullptr;
+static void *traceContext = nullptr;
+
+BSONPPStats *bsonppGetStats() {
+    return &stats;
+}
+
+void bsonppResetStats() {
+    memset(&stats, 0x00, sizeof(stats));
+}
+
+void bsonppSetTraceHook(BSONPPTraceHook hook, void *context) {
+    traceContext = context;
+    traceHook = hook;
+}
+
+void bsonppRecordSize(int32_t size) {
+    int32_t bucket = 0;
+    while (size > 1 && bucket < BSONPP_STATS_SIZE_BUCKETS - 1) {
+        size >>= 1;
+        bucket++;
+    }
+    stats.documentSizes[bucket]++;
+}
+
+void bsonppTrace(const char *event, bool begin, int32_t value) {
+    if (traceHook != nullptr) {
+        traceHook(event, begin, value, traceContext);
+    }
+}
+
+int32_t bsonppLookupDone(int32_t result) {
+    switch (result) {
+        case BSONPP_NULL_VALUE:
+            stats.lookupsNull++;
+            break;
+        case BSONPP_KEY_NOT_FOUND:
+            stats.lookupsNotFound++;
+            break;
+        case BSONPP_INCORRECT_TYPE:
+            stats.lookupsIncorrectType++;
+            break;
+        default:
+            stats.lookupsFound++;
+    }
+    BSONPP_TRACE_END(lookup, result);
+    return result;
+}
+
+int32_t bsonppAppendDone(int32_t result) {
+    stats.appends++;
+    if (result == BSONPP_OUT_OF_SPACE) {
+        stats.appendsOutOfSpace++;
+    } else if (result == BSONPP_DUPLICATE_KEY) {
+        stats.appendsDuplicateKey++;
+    }
+    BSONPP_TRACE_END(append, result);
+    return result;
+}
+
+#endif // BSONPP_INSTRUMENT
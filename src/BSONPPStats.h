@@ -0,0 +1,84 @@
+#ifndef __BSONPP_STATS_H__
+#define __BSONPP_STATS_H__
+
+#include <stdint.h>
+
+/**
+ * Hot path instrumentation, compiled in by defining BSONPP_INSTRUMENT for the whole build.
+ * Without it every macro below expands to nothing, or to its result argument, so there is no cost.
+ *
+ * Counters are per thread on Linux and global elsewhere. Trace hooks see each lookup, key set find
+ * and append begin and end. With BSONPP_HAVE_SDT the same points are also USDT probes in the
+ * "bsonpp" provider, named like lookup__begin and append__end, for perf and bpftrace.
+ */
+
+// Document size histogram buckets, bucket n counts documents of 2^n to 2^(n+1)-1 bytes.
+#define BSONPP_STATS_SIZE_BUCKETS (32)
+
+struct BSONPPStats {
+    // Key lookups and key set finds, each walking the document from the start.
+    uint64_t scans;
+    // Elements looked at by scans and nextElement.
+    uint64_t elementsVisited;
+    // getOffset(key) by outcome.
+    uint64_t lookupsFound;
+    uint64_t lookupsNull;
+    uint64_t lookupsNotFound;
+    uint64_t lookupsIncorrectType;
+    // Appends by outcome, failures for any other reason only count as appends.
+    uint64_t appends;
+    uint64_t appendsOutOfSpace;
+    uint64_t appendsDuplicateKey;
+    // Element bytes written by appends.
+    uint64_t bytesCopied;
+    // Bytes memmoved compacting stream and queue buffers.
+    uint64_t bytesMoved;
+    // Sizes of the documents scanned.
+    uint64_t documentSizes[BSONPP_STATS_SIZE_BUCKETS];
+};
+
+// event is the trace point name, value the document size on begin and the result on end.
+typedef void (*BSONPPTraceHook)(const char *event, bool begin, int32_t value, void *context);
+
+#ifdef BSONPP_INSTRUMENT
+
+#ifdef BSONPP_HAVE_SDT
+#include <sys/sdt.h>
+#define BSONPP_PROBE(name, value) DTRACE_PROBE1(bsonpp, name, value)
+#else
+#define BSONPP_PROBE(name, value) do {} while (0)
+#endif
+
+// The calling thread's counters.
+BSONPPStats *bsonppGetStats();
+void bsonppResetStats();
+// Set the hook before other threads start using BSONPP, null removes it.
+void bsonppSetTraceHook(BSONPPTraceHook hook, void *context);
+
+void bsonppRecordSize(int32_t size);
+void bsonppTrace(const char *event, bool begin, int32_t value);
+int32_t bsonppLookupDone(int32_t result);
+int32_t bsonppAppendDone(int32_t result);
+
+#define BSONPP_COUNT(counter, n) (bsonppGetStats()->counter += (n))
+#define BSONPP_RECORD_SIZE(size) bsonppRecordSize(size)
+#define BSONPP_TRACE_BEGIN(event, value) \
+    do { bsonppTrace(#event, true, (value)); BSONPP_PROBE(event##__begin, (value)); } while (0)
+#define BSONPP_TRACE_END(event, value) \
+    do { bsonppTrace(#event, false, (value)); BSONPP_PROBE(event##__end, (value)); } while (0)
+// Wrap the value returned by getOffset(key) and appends, counting the outcome and ending the trace.
+#define BSONPP_LOOKUP_DONE(result) bsonppLookupDone(result)
+#define BSONPP_APPEND_DONE(result) bsonppAppendDone(result)
+
+#else
+
+#define BSONPP_COUNT(counter, n) do {} while (0)
+#define BSONPP_RECORD_SIZE(size) do {} while (0)
+#define BSONPP_TRACE_BEGIN(event, value) do {} while (0)
+#define BSONPP_TRACE_END(event, value) do {} while (0)
+#define BSONPP_LOOKUP_DONE(result) (result)
+#define BSONPP_APPEND_DONE(result) (result)
+
+#endif // BSONPP_INSTRUMENT
+
+#endif // __BSONPP_STATS_H__
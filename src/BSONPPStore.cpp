@@ -0,0 +1,562 @@
+#ifdef __LINUX_BUILD
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif // __SSE4_2__
+#include "BSONPPStore.h"
+#include "NetworkUtil.h"
+
+// Each record is a CRC32C of the document followed by the document.
+#define BSONPP_STORE_RECORD_HEADER (4)
+// Smallest possible document, 4 length bytes and a 0x00 suffix.
+#define BSONPP_STORE_MIN_DOCUMENT (5)
+// The segment mapping grows in steps of this many bytes so appends rarely need a remap.
+#define BSONPP_STORE_MAP_STEP (1 << 20)
+// Entries buffered on the stack while a checkpoint writes the index.
+#define BSONPP_STORE_WRITE_ENTRIES (256)
+
+// The index file, in the machine's byte order as it is never moved between machines.
+struct BSONPPStoreIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pathHash;
+    uint32_t reserved;
+    uint64_t checkpoint;
+    uint64_t count;
+};
+
+#ifndef __SSE4_2__
+struct BSONPPCrcTable {
+    uint32_t values[256];
+
+    BSONPPCrcTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int32_t bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+            }
+            values[i] = crc;
+        }
+    }
+};
+#endif // __SSE4_2__
+
+// CRC32C, with the SSE4.2 instruction when the build targets it.
+static uint32_t crc32c(const uint8_t *data, size_t length) {
+#ifdef __SSE4_2__
+    uint64_t crc = 0xFFFFFFFFu;
+    while (length >= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(uint64_t));
+        crc = _mm_crc32_u64(crc, word);
+        data += sizeof(uint64_t);
+        length -= sizeof(uint64_t);
+    }
+    uint32_t crc32 = static_cast<uint32_t>(crc);
+    while (length-- > 0) {
+        crc32 = _mm_crc32_u8(crc32, *data++);
+    }
+    return ~crc32;
+#else
+    static const BSONPPCrcTable table;
+    uint32_t crc = 0xFFFFFFFFu;
+    while (length-- > 0) {
+        crc = table.values[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+#endif // __SSE4_2__
+}
+
+static int32_t writeAllAt(int fd, const uint8_t *data, size_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t res = pwrite(fd, data, length, offset);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return BSONPP_IO_ERROR;
+        }
+        data += res;
+        length -= res;
+        offset += res;
+    }
+    return BSONPP_SUCCESS;
+}
+
+static bool entryLess(const BSONPPStoreEntry *a, const BSONPPStoreEntry *b) {
+    return a->key < b->key || (a->key == b->key && a->offset < b->offset);
+}
+
+// First entry with a key of at least key.
+static uint64_t lowerBound(const BSONPPStoreEntry *entries, uint64_t count, uint64_t key) {
+    uint64_t low = 0;
+    uint64_t high = count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (entries[middle].key < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+BSONPPStore::BSONPPStore(BSONPPStoreEntry *tail, int32_t tailCapacity): m_tail(tail), m_tailCapacity(tailCapacity),
+    m_tailCount(0), m_fieldPath(nullptr), m_segmentFd(-1), m_segmentSize(0), m_segmentMap(nullptr), m_segmentMapSize(0),
+    m_indexMap(nullptr), m_indexMapSize(0), m_entries(nullptr), m_entryCount(0), m_checkpoint(0), m_indexedSize(0) {
+    m_indexPath[0] = 0;
+}
+
+BSONPPStore::~BSONPPStore() {
+    this->close();
+}
+
+int32_t BSONPPStore::open(const char *segmentPath, const char *indexPath, const char *fieldPath) {
+    this->close();
+
+    // Room for the temporary index name.
+    if (strlen(indexPath) + sizeof(".tmp") > sizeof(m_indexPath)) {
+        return BSONPP_OUT_OF_SPACE;
+    }
+    strcpy(m_indexPath, indexPath);
+    m_fieldPath = fieldPath;
+
+    m_segmentFd = ::open(segmentPath, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_segmentFd < 0) {
+        return BSONPP_IO_ERROR;
+    }
+    struct stat info;
+    if (fstat(m_segmentFd, &info) != 0) {
+        this->close();
+        return BSONPP_IO_ERROR;
+    }
+    m_segmentSize = info.st_size;
+
+    int32_t res = this->mapIndex();
+    if (res != BSONPP_SUCCESS) {
+        this->close();
+        return res;
+    }
+    // An index ahead of the segment doesn't belong to it.
+    if (m_checkpoint > m_segmentSize) {
+        this->unmapIndex();
+    }
+
+    res = this->recover(m_checkpoint);
+    if (res != BSONPP_SUCCESS) {
+        this->close();
+    }
+    return res;
+}
+
+void BSONPPStore::close() {
+    this->unmapIndex();
+    if (m_segmentMap != nullptr) {
+        munmap(m_segmentMap, m_segmentMapSize);
+        m_segmentMap = nullptr;
+        m_segmentMapSize = 0;
+    }
+    if (m_segmentFd >= 0) {
+        ::close(m_segmentFd);
+        m_segmentFd = -1;
+    }
+    m_segmentSize = 0;
+    m_indexedSize = 0;
+    m_tailCount = 0;
+}
+
+int32_t BSONPPStore::mapIndex() {
+    int fd = ::open(m_indexPath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        // No index yet, everything is rescanned.
+        return errno == ENOENT ? BSONPP_SUCCESS : BSONPP_IO_ERROR;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return BSONPP_IO_ERROR;
+    }
+    if (static_cast<uint64_t>(info.st_size) < sizeof(BSONPPStoreIndexHeader)) {
+        ::close(fd);
+        return BSONPP_SUCCESS;
+    }
+
+    void *map = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return BSONPP_IO_ERROR;
+    }
+
+    const BSONPPStoreIndexHeader *header = static_cast<const BSONPPStoreIndexHeader *>(map);
+    int32_t pathLength = 0;
+    if (header->magic != BSONPP_STORE_INDEX_MAGIC || header->version != BSONPP_STORE_INDEX_VERSION ||
+        header->pathHash != BSONPPKeySet::hash(m_fieldPath, &pathLength) ||
+        header->count != (info.st_size - sizeof(BSONPPStoreIndexHeader)) / sizeof(BSONPPStoreEntry) ||
+        (info.st_size - sizeof(BSONPPStoreIndexHeader)) % sizeof(BSONPPStoreEntry) != 0) {
+        // Not an index for this field, it's rebuilt.
+        munmap(map, info.st_size);
+        return BSONPP_SUCCESS;
+    }
+
+    m_indexMap = static_cast<uint8_t *>(map);
+    m_indexMapSize = info.st_size;
+    m_entries = reinterpret_cast<const BSONPPStoreEntry *>(m_indexMap + sizeof(BSONPPStoreIndexHeader));
+    m_entryCount = header->count;
+    m_checkpoint = header->checkpoint;
+    return BSONPP_SUCCESS;
+}
+
+void BSONPPStore::unmapIndex() {
+    if (m_indexMap != nullptr) {
+        munmap(m_indexMap, m_indexMapSize);
+    }
+    m_indexMap = nullptr;
+    m_indexMapSize = 0;
+    m_entries = nullptr;
+    m_entryCount = 0;
+    m_checkpoint = 0;
+}
+
+int32_t BSONPPStore::mapSegment(uint64_t size) {
+    if (size <= m_segmentMapSize) {
+        return BSONPP_SUCCESS;
+    }
+
+    // Pages past the end of the file are never touched, they become readable as the file grows.
+    uint64_t mapSize = (size + BSONPP_STORE_MAP_STEP - 1) / BSONPP_STORE_MAP_STEP * BSONPP_STORE_MAP_STEP;
+    void *map = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, m_segmentFd, 0);
+    if (map == MAP_FAILED) {
+        return BSONPP_IO_ERROR;
+    }
+    if (m_segmentMap != nullptr) {
+        munmap(m_segmentMap, m_segmentMapSize);
+    }
+    m_segmentMap = static_cast<uint8_t *>(map);
+    m_segmentMapSize = mapSize;
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPStore::recover(uint64_t from) {
+    m_indexedSize = from;
+    if (m_segmentSize == 0) {
+        return BSONPP_SUCCESS;
+    }
+
+    int32_t res = this->mapSegment(m_segmentSize);
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    uint64_t offset = from;
+    while (offset + BSONPP_STORE_RECORD_HEADER + BSONPP_STORE_MIN_DOCUMENT <= m_segmentSize) {
+        uint32_t crc = 0;
+        int32_t size = 0;
+        memcpy(&crc, m_segmentMap + offset, sizeof(uint32_t));
+        memcpy(&size, m_segmentMap + offset + BSONPP_STORE_RECORD_HEADER, sizeof(int32_t));
+        crc = letoh32(crc);
+        size = letoh32(size);
+
+        uint8_t *data = m_segmentMap + offset + BSONPP_STORE_RECORD_HEADER;
+        uint64_t end = offset + BSONPP_STORE_RECORD_HEADER + size;
+        if (size < BSONPP_STORE_MIN_DOCUMENT || end > m_segmentSize || data[size - 1] != 0x00 || crc32c(data, size) != crc) {
+            break;
+        }
+
+        BSONPP doc(data, size, false);
+        res = this->index(&doc, offset, end);
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+        offset = end;
+    }
+
+    // Anything after the last good record is from a write that didn't complete.
+    if (offset < m_segmentSize) {
+        if (ftruncate(m_segmentFd, offset) != 0) {
+            return BSONPP_IO_ERROR;
+        }
+        m_segmentSize = offset;
+    }
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPStore::index(BSONPP *doc, uint64_t offset, uint64_t end) {
+    BSONPP owner;
+    int32_t field = 0;
+    int32_t res = doc->findPath(m_fieldPath, &owner, &field);
+    if (res == BSONPP_KEY_NOT_FOUND) {
+        // Documents without the field aren't indexed.
+        m_indexedSize = end;
+        return BSONPP_SUCCESS;
+    }
+
+    BSONPPStoreEntry entry;
+    entry.offset = offset;
+    if (res == BSONPP_SUCCESS) {
+        res = owner.getSortKey(field, &entry.key);
+    }
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    if (m_tailCount >= m_tailCapacity) {
+        res = this->checkpoint();
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+        if (m_tailCapacity == 0) {
+            return BSONPP_OUT_OF_SPACE;
+        }
+    }
+
+    // Offsets only grow so the entry goes after any with the same key.
+    int32_t position = m_tailCount;
+    while (position > 0 && m_tail[position - 1].key > entry.key) {
+        position--;
+    }
+    memmove(m_tail + position + 1, m_tail + position, (m_tailCount - position) * sizeof(BSONPPStoreEntry));
+    m_tail[position] = entry;
+    m_tailCount++;
+    m_indexedSize = end;
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPStore::append(BSONPP *doc, uint64_t *offset) {
+    if (m_segmentFd < 0) {
+        return BSONPP_IO_ERROR;
+    }
+
+    int32_t size = doc->getSize();
+    uint32_t crc = htole32(crc32c(doc->getBuffer(), size));
+    uint64_t start = m_segmentSize;
+
+    struct iovec iovecs[2];
+    iovecs[0].iov_base = &crc;
+    iovecs[0].iov_len = BSONPP_STORE_RECORD_HEADER;
+    iovecs[1].iov_base = doc->getBuffer();
+    iovecs[1].iov_len = size;
+
+    ssize_t written = 0;
+    do {
+        written = pwritev(m_segmentFd, iovecs, 2, start);
+    } while (written < 0 && errno == EINTR);
+    if (written < 0) {
+        return BSONPP_IO_ERROR;
+    }
+    // Finish a short write, the record header is never split.
+    if (written < BSONPP_STORE_RECORD_HEADER + size) {
+        int32_t res = written < BSONPP_STORE_RECORD_HEADER ?
+            writeAllAt(m_segmentFd, reinterpret_cast<uint8_t *>(&crc) + written, BSONPP_STORE_RECORD_HEADER - written, start + written) :
+            BSONPP_SUCCESS;
+        if (res == BSONPP_SUCCESS) {
+            int32_t done = written < BSONPP_STORE_RECORD_HEADER ? 0 : written - BSONPP_STORE_RECORD_HEADER;
+            res = writeAllAt(m_segmentFd, doc->getBuffer() + done, size - done, start + BSONPP_STORE_RECORD_HEADER + done);
+        }
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+
+    m_segmentSize = start + BSONPP_STORE_RECORD_HEADER + size;
+    if (offset != nullptr) {
+        *offset = start;
+    }
+    return this->index(doc, start, m_segmentSize);
+}
+
+int32_t BSONPPStore::sync() {
+    if (m_segmentFd < 0 || fdatasync(m_segmentFd) != 0) {
+        return BSONPP_IO_ERROR;
+    }
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPStore::checkpoint() {
+    // The index must never cover documents that aren't durable.
+    int32_t res = this->sync();
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    // open checked the name fits.
+    char tempPath[PATH_MAX];
+    strcpy(tempPath, m_indexPath);
+    strcat(tempPath, ".tmp");
+    int fd = ::open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return BSONPP_IO_ERROR;
+    }
+
+    BSONPPStoreIndexHeader header;
+    int32_t pathLength = 0;
+    header.magic = BSONPP_STORE_INDEX_MAGIC;
+    header.version = BSONPP_STORE_INDEX_VERSION;
+    header.pathHash = BSONPPKeySet::hash(m_fieldPath, &pathLength);
+    header.reserved = 0;
+    header.checkpoint = m_indexedSize;
+    header.count = m_entryCount + m_tailCount;
+    res = writeAllAt(fd, reinterpret_cast<uint8_t *>(&header), sizeof(header), 0);
+
+    // Merge the mapped index and the tail, both already sorted.
+    BSONPPStoreEntry buffer[BSONPP_STORE_WRITE_ENTRIES];
+    int32_t buffered = 0;
+    uint64_t fileOffset = sizeof(header);
+    uint64_t entry = 0;
+    int32_t tail = 0;
+    while (res == BSONPP_SUCCESS && (entry < m_entryCount || tail < m_tailCount)) {
+        if (tail >= m_tailCount || (entry < m_entryCount && entryLess(m_entries + entry, m_tail + tail))) {
+            buffer[buffered++] = m_entries[entry++];
+        } else {
+            buffer[buffered++] = m_tail[tail++];
+        }
+        if (buffered == BSONPP_STORE_WRITE_ENTRIES || (entry == m_entryCount && tail == m_tailCount)) {
+            res = writeAllAt(fd, reinterpret_cast<uint8_t *>(buffer), buffered * sizeof(BSONPPStoreEntry), fileOffset);
+            fileOffset += buffered * sizeof(BSONPPStoreEntry);
+            buffered = 0;
+        }
+    }
+
+    if (res == BSONPP_SUCCESS && fsync(fd) != 0) {
+        res = BSONPP_IO_ERROR;
+    }
+    ::close(fd);
+    // The rename replaces the old index atomically, a crash leaves one or the other.
+    if (res != BSONPP_SUCCESS || rename(tempPath, m_indexPath) != 0) {
+        unlink(tempPath);
+        return BSONPP_IO_ERROR;
+    }
+
+    uint64_t indexedSize = m_indexedSize;
+    this->unmapIndex();
+    m_tailCount = 0;
+    res = this->mapIndex();
+    m_indexedSize = indexedSize;
+    return res;
+}
+
+int32_t BSONPPStore::read(uint64_t offset, BSONPP *doc) {
+    if (offset + BSONPP_STORE_RECORD_HEADER + BSONPP_STORE_MIN_DOCUMENT > m_segmentSize) {
+        return BSONPP_KEY_NOT_FOUND;
+    }
+    int32_t res = this->mapSegment(m_segmentSize);
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    uint8_t *data = m_segmentMap + offset + BSONPP_STORE_RECORD_HEADER;
+    int32_t size = 0;
+    memcpy(&size, data, sizeof(int32_t));
+    size = letoh32(size);
+    if (size < BSONPP_STORE_MIN_DOCUMENT || offset + BSONPP_STORE_RECORD_HEADER + size > m_segmentSize) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+
+    *doc = BSONPP(data, size, false);
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPStore::lookup(BSONPP *value, BSONPPDocumentCallback callback, void *context) {
+    return this->search(value, value, true, callback, context);
+}
+
+int32_t BSONPPStore::scan(BSONPP *lower, BSONPP *upper, BSONPPDocumentCallback callback, void *context) {
+    return this->search(lower, upper, false, callback, context);
+}
+
+int32_t BSONPPStore::search(BSONPP *lower, BSONPP *upper, bool inclusive, BSONPPDocumentCallback callback, void *context) {
+    if (m_segmentFd < 0) {
+        return BSONPP_IO_ERROR;
+    }
+
+    // Bounds are the first element of each document.
+    uint64_t lowerKey = 0;
+    uint64_t upperKey = UINT64_MAX;
+    int32_t res = BSONPP_SUCCESS;
+    if (lower != nullptr) {
+        res = lower->getSortKey(sizeof(int32_t), &lowerKey);
+    }
+    if (res == BSONPP_SUCCESS && upper != nullptr) {
+        res = upper->getSortKey(sizeof(int32_t), &upperKey);
+    }
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    // Keys equal to either bound may or may not be in range so they're checked against the document.
+    uint64_t entry = lowerBound(m_entries, m_entryCount, lowerKey);
+    uint64_t tail = lowerBound(m_tail, m_tailCount, lowerKey);
+    while (true) {
+        bool entryValid = entry < m_entryCount && m_entries[entry].key <= upperKey;
+        bool tailValid = tail < static_cast<uint64_t>(m_tailCount) && m_tail[tail].key <= upperKey;
+        if (!entryValid && !tailValid) {
+            return BSONPP_SUCCESS;
+        }
+
+        uint64_t offset = 0;
+        if (!tailValid || (entryValid && entryLess(m_entries + entry, m_tail + tail))) {
+            offset = m_entries[entry++].offset;
+        } else {
+            offset = m_tail[tail++].offset;
+        }
+
+        res = this->visit(offset, lower, upper, inclusive, callback, context);
+        if (res != BSONPP_SUCCESS) {
+            return res;
+        }
+    }
+}
+
+int32_t BSONPPStore::visit(uint64_t offset, BSONPP *lower, BSONPP *upper, bool inclusive, BSONPPDocumentCallback callback, void *context) {
+    BSONPP doc;
+    BSONPP owner;
+    int32_t field = 0;
+    int32_t res = this->read(offset, &doc);
+    if (res == BSONPP_SUCCESS) {
+        res = doc.findPath(m_fieldPath, &owner, &field);
+    }
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+
+    int32_t result = 0;
+    if (lower != nullptr) {
+        res = owner.compareValue(field, lower, sizeof(int32_t), &result);
+        if (res != BSONPP_SUCCESS || result < 0) {
+            return res;
+        }
+    }
+    if (upper != nullptr) {
+        res = owner.compareValue(field, upper, sizeof(int32_t), &result);
+        if (res != BSONPP_SUCCESS || result > 0 || (!inclusive && result == 0)) {
+            return res;
+        }
+    }
+
+    callback(&doc, context);
+    return BSONPP_SUCCESS;
+}
+
+uint64_t BSONPPStore::getSize() {
+    return m_segmentSize;
+}
+
+uint64_t BSONPPStore::getCheckpoint() {
+    return m_checkpoint;
+}
+
+int32_t BSONPPStore::getTailCount() {
+    return m_tailCount;
+}
+
+#endif // __LINUX_BUILD
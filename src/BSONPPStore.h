@@ -0,0 +1,94 @@
+#ifndef __BSONPP_STORE_H__
+#define __BSONPP_STORE_H__
+
+#ifdef __LINUX_BUILD
+
+#include <limits.h>
+#include <stdint.h>
+#include "BSONPP.h"
+
+#define BSONPP_STORE_INDEX_MAGIC (0x58444942)
+#define BSONPP_STORE_INDEX_VERSION (1)
+
+// An index entry, the value's sort key and the segment offset of the document's record.
+struct BSONPPStoreEntry {
+    uint64_t key;
+    uint64_t offset;
+};
+
+/**
+ * Append only document store with a secondary index on one field.
+ *
+ * Documents are appended to a segment file, each preceded by a CRC32C of its bytes. The index
+ * holds a BSONPP::getSortKey entry per document that has the indexed field, sorted so lookups and
+ * range scans are a binary search. Keys only approximate values so candidates are checked against
+ * the document itself. Both files are read through mmap.
+ *
+ * Entries for documents appended since the last checkpoint are kept in a caller provided tail,
+ * when it fills the tail is merged into the index file which records how far into the segment it
+ * covers. On open only the segment past that checkpoint is rescanned, so recovery is bounded by the
+ * tail's size, and a torn record at the end of the segment is truncated.
+ */
+class BSONPPStore {
+public:
+    BSONPPStore(BSONPPStoreEntry *tail, int32_t tailCapacity);
+    ~BSONPPStore();
+
+    // fieldPath may name a field in a sub-document with dots, for example "device.id", and must
+    // outlive the store. An index built for a different field is discarded and rebuilt.
+    int32_t open(const char *segmentPath, const char *indexPath, const char *fieldPath);
+    // The tail isn't written, it's rebuilt from the segment when next opened.
+    void close();
+
+    // offset is set to the document's position in the segment if not null.
+    int32_t append(BSONPP *doc, uint64_t *offset = nullptr);
+    // Makes appended documents durable.
+    int32_t sync();
+    // Syncs the segment and merges the tail into the index file.
+    int32_t checkpoint();
+
+    // Documents point into the mapped segment and are valid until the store is next appended to.
+    // Records are checked against their CRC when appended or recovered, not when read.
+    int32_t read(uint64_t offset, BSONPP *doc);
+    // Calls back with every document whose indexed field equals the first element of value.
+    int32_t lookup(BSONPP *value, BSONPPDocumentCallback callback, void *context);
+    // Calls back with every document whose indexed field is at least the first element of lower and
+    // less than that of upper, in index order. Either bound may be null.
+    int32_t scan(BSONPP *lower, BSONPP *upper, BSONPPDocumentCallback callback, void *context);
+
+    uint64_t getSize();
+    uint64_t getCheckpoint();
+    int32_t getTailCount();
+
+private:
+    int32_t mapIndex();
+    void unmapIndex();
+    int32_t mapSegment(uint64_t size);
+    int32_t recover(uint64_t from);
+    int32_t index(BSONPP *doc, uint64_t offset, uint64_t end);
+    int32_t search(BSONPP *lower, BSONPP *upper, bool inclusive, BSONPPDocumentCallback callback, void *context);
+    int32_t visit(uint64_t offset, BSONPP *lower, BSONPP *upper, bool inclusive, BSONPPDocumentCallback callback, void *context);
+
+    BSONPPStoreEntry *m_tail;
+    int32_t m_tailCapacity;
+    int32_t m_tailCount;
+    const char *m_fieldPath;
+
+    int m_segmentFd;
+    uint64_t m_segmentSize;
+    uint8_t *m_segmentMap;
+    uint64_t m_segmentMapSize;
+
+    char m_indexPath[PATH_MAX];
+    uint8_t *m_indexMap;
+    uint64_t m_indexMapSize;
+    const BSONPPStoreEntry *m_entries;
+    uint64_t m_entryCount;
+    uint64_t m_checkpoint;
+    // Segment size covered by the index and tail together.
+    uint64_t m_indexedSize;
+};
+
+#endif // __LINUX_BUILD
+
+#endif // __BSONPP_STORE_H__
@@ -0,0 +1,154 @@
+#ifdef __LINUX_BUILD
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include "BSONPPStream.h"
+#include "BSONPPStats.h"
+#include "NetworkUtil.h"
+
+// Smallest possible document, 4 length bytes and a 0x00 suffix.
+#define BSONPP_STREAM_MIN_DOCUMENT (5)
+
+BSONPPStreamReader::BSONPPStreamReader(uint8_t *buffer, int32_t length): m_buffer(buffer), m_length(length) {
+    this->clear();
+}
+
+void BSONPPStreamReader::clear() {
+    m_start = 0;
+    m_end = 0;
+}
+
+int32_t BSONPPStreamReader::fill(int fd) {
+    // Move any partial document to the front so it can be completed contiguously.
+    if (m_start > 0) {
+        if (m_end > m_start) {
+            memmove(m_buffer, m_buffer + m_start, m_end - m_start);
+            BSONPP_COUNT(bytesMoved, m_end - m_start);
+        }
+        m_end -= m_start;
+        m_start = 0;
+    }
+
+    if (m_end >= m_length) {
+        return 0;
+    }
+
+    while (true) {
+        ssize_t res = read(fd, m_buffer + m_end, m_length - m_end);
+        if (res > 0) {
+            m_end += res;
+            return res;
+        }
+        if (res == 0) {
+            return BSONPP_END_OF_STREAM;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        return BSONPP_IO_ERROR;
+    }
+}
+
+int32_t BSONPPStreamReader::next(BSONPP *doc) {
+    int32_t available = m_end - m_start;
+    if (available < static_cast<int32_t>(sizeof(int32_t))) {
+        return BSONPP_INCOMPLETE;
+    }
+
+    int32_t size = 0;
+    memcpy(&size, m_buffer + m_start, sizeof(int32_t));
+    size = letoh32(size);
+    if (size < BSONPP_STREAM_MIN_DOCUMENT || size > m_length) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+    if (size > available) {
+        return BSONPP_INCOMPLETE;
+    }
+    if (m_buffer[m_start + size - 1] != 0x00) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+
+    *doc = BSONPP(m_buffer + m_start, size, false);
+    m_start += size;
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPStreamReader::getPending() {
+    return m_end - m_start;
+}
+
+BSONPPStreamWriter::BSONPPStreamWriter(struct iovec *iovecs, int32_t iovecCount): m_iovecs(iovecs), m_iovecCount(iovecCount) {
+    this->clear();
+}
+
+void BSONPPStreamWriter::clear() {
+    m_head = 0;
+    m_tail = 0;
+    m_pending = 0;
+}
+
+int32_t BSONPPStreamWriter::queue(BSONPP *doc) {
+    if (m_tail >= m_iovecCount) {
+        if (m_head == 0) {
+            return BSONPP_OUT_OF_SPACE;
+        }
+        // Reclaim iovecs already written.
+        memmove(m_iovecs, m_iovecs + m_head, (m_tail - m_head) * sizeof(struct iovec));
+        BSONPP_COUNT(bytesMoved, (m_tail - m_head) * sizeof(struct iovec));
+        m_tail -= m_head;
+        m_head = 0;
+    }
+
+    m_iovecs[m_tail].iov_base = doc->getBuffer();
+    m_iovecs[m_tail].iov_len = doc->getSize();
+    m_tail++;
+    m_pending += doc->getSize();
+
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPStreamWriter::flush(int fd) {
+    while (m_head < m_tail) {
+        int32_t count = m_tail - m_head;
+        if (count > IOV_MAX) {
+            count = IOV_MAX;
+        }
+
+        ssize_t written = writev(fd, m_iovecs + m_head, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return BSONPP_WOULD_BLOCK;
+            }
+            return BSONPP_IO_ERROR;
+        }
+
+        m_pending -= written;
+        while (m_head < m_tail && written >= static_cast<ssize_t>(m_iovecs[m_head].iov_len)) {
+            written -= m_iovecs[m_head].iov_len;
+            m_head++;
+        }
+        // Advance into a partially written document so the next writev resumes from there.
+        if (written > 0) {
+            m_iovecs[m_head].iov_base = static_cast<uint8_t *>(m_iovecs[m_head].iov_base) + written;
+            m_iovecs[m_head].iov_len -= written;
+        }
+    }
+
+    this->clear();
+    return BSONPP_SUCCESS;
+}
+
+int32_t BSONPPStreamWriter::getPending() {
+    return m_pending;
+}
+
+#endif // __LINUX_BUILD
@@ -0,0 +1,68 @@
+#ifndef __BSONPP_STREAM_H__
+#define __BSONPP_STREAM_H__
+
+#ifdef __LINUX_BUILD
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include "BSONPP.h"
+
+/**
+ * Reads length prefixed BSON documents from a stream socket or pipe into a reusable buffer.
+ * Each fill is a single read of as much as fits, next then yields every complete document as a
+ * view into the buffer without copying. Only a trailing partial document is moved, to the start
+ * of the buffer on the next fill, so documents are always contiguous.
+ *
+ * Views returned by next are only valid until the next call to fill.
+ */
+class BSONPPStreamReader {
+public:
+    // The buffer must be at least as large as the largest expected document.
+    BSONPPStreamReader(uint8_t *buffer, int32_t length);
+
+    void clear();
+    // Performs one read from fd. Returns the number of bytes read, 0 if the fd would block or the
+    // buffer is full, BSONPP_END_OF_STREAM on EOF or BSONPP_IO_ERROR.
+    int32_t fill(int fd);
+    // Returns BSONPP_SUCCESS and sets doc to the next complete document, BSONPP_INCOMPLETE if more
+    // data is needed or BSONPP_INVALID_DOCUMENT if the stream is corrupt or the document won't fit.
+    int32_t next(BSONPP *doc);
+    // Bytes buffered but not yet returned by next.
+    int32_t getPending();
+
+private:
+    uint8_t *m_buffer;
+    int32_t m_length;
+    int32_t m_start;
+    int32_t m_end;
+};
+
+/**
+ * Batches documents into writev calls for stream sockets. Documents are referenced rather than
+ * copied, so they must not change or go out of scope until flush reports they've been written.
+ * Works with both blocking and non-blocking descriptors.
+ */
+class BSONPPStreamWriter {
+public:
+    BSONPPStreamWriter(struct iovec *iovecs, int32_t iovecCount);
+
+    void clear();
+    // Returns BSONPP_OUT_OF_SPACE when every iovec is in use, flush and try again.
+    int32_t queue(BSONPP *doc);
+    // Writes as much as possible. Returns BSONPP_SUCCESS once everything queued is written,
+    // BSONPP_WOULD_BLOCK if the fd is full or BSONPP_IO_ERROR.
+    int32_t flush(int fd);
+    // Bytes queued but not yet written.
+    int32_t getPending();
+
+private:
+    struct iovec *m_iovecs;
+    int32_t m_iovecCount;
+    int32_t m_head;
+    int32_t m_tail;
+    int32_t m_pending;
+};
+
+#endif // __LINUX_BUILD
+
+#endif // __BSONPP_STREAM_H__
@@ -0,0 +1,154 @@
+#include <string.h>
+#include "BSONPP.h"
+#include "NetworkUtil.h"
+
+static int32_t read32(const uint8_t *data) {
+    int32_t val = 0;
+    memcpy(&val, data, sizeof(int32_t));
+    return letoh32(val);
+}
+
+static int32_t validateDocument(const uint8_t *data, int32_t length, int32_t depth, int32_t maxDepth);
+
+// A length prefixed, null terminated string. Returns its size or BSONPP_INVALID_DOCUMENT.
+static int32_t validateString(const uint8_t *value, int32_t remaining) {
+    if (remaining < static_cast<int32_t>(sizeof(int32_t))) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+    int32_t length = read32(value);
+    // The length includes the null terminator.
+    if (length < 1 || length > remaining - static_cast<int32_t>(sizeof(int32_t)) || value[sizeof(int32_t) + length - 1] != 0x00) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+    return sizeof(int32_t) + length;
+}
+
+// Returns the size of a value that fits in remaining bytes or BSONPP_INVALID_DOCUMENT.
+static int32_t validateValue(uint8_t type, const uint8_t *value, int32_t remaining, int32_t depth, int32_t maxDepth) {
+    int32_t size = 0;
+    switch (type) {
+        case BSONPP_UNDEFINED: // Fallthrough
+        case BSONPP_NULL: // Fallthrough
+        case BSONPP_MIN_KEY: // Fallthrough
+        case BSONPP_MAX_KEY:
+            size = 0;
+            break;
+        case BSONPP_BOOLEAN:
+            size = 1;
+            break;
+        case BSONPP_INT32:
+            size = sizeof(int32_t);
+            break;
+        case BSONPP_DOUBLE: // Fallthrough
+        case BSONPP_DATETIME: // Fallthrough
+        case BSONPP_TIMESTAMP: // Fallthrough
+        case BSONPP_INT64:
+            size = sizeof(int64_t);
+            break;
+        case BSONPP_OBJECT_ID:
+            size = 12;
+            break;
+        case BSONPP_DECIMAL128:
+            size = 16;
+            break;
+        case BSONPP_STRING: // Fallthrough
+        case BSONPP_JAVASCRIPT: // Fallthrough
+        case BSONPP_SYMBOL:
+            return validateString(value, remaining);
+        case BSONPP_DOCUMENT: // Fallthrough
+        case BSONPP_ARRAY:
+            return validateDocument(value, remaining, depth + 1, maxDepth);
+        case BSONPP_BINARY: {
+            // +1 for the subtype
+            if (remaining < static_cast<int32_t>(sizeof(int32_t)) + 1) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            int32_t length = read32(value);
+            if (length < 0 || length > remaining - static_cast<int32_t>(sizeof(int32_t)) - 1) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            return sizeof(int32_t) + 1 + length;
+        }
+        case BSONPP_REGEX: {
+            const uint8_t *pattern = static_cast<const uint8_t *>(memchr(value, 0, remaining));
+            if (pattern == nullptr) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            int32_t patternSize = pattern - value + 1;
+            const uint8_t *options = static_cast<const uint8_t *>(memchr(pattern + 1, 0, remaining - patternSize));
+            if (options == nullptr) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            return options - value + 1;
+        }
+        case BSONPP_DB_POINTER: {
+            int32_t stringSize = validateString(value, remaining);
+            if (stringSize < 0 || stringSize + 12 > remaining) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            return stringSize + 12;
+        }
+        case BSONPP_JAVASCRIPT_WITH_SCOPE: {
+            // Total length, then the code string and the scope document, which must fill it exactly.
+            if (remaining < static_cast<int32_t>(sizeof(int32_t))) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            int32_t total = read32(value);
+            if (total < static_cast<int32_t>(sizeof(int32_t)) || total > remaining) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            int32_t stringSize = validateString(value + sizeof(int32_t), total - sizeof(int32_t));
+            if (stringSize < 0) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            int32_t scopeOffset = sizeof(int32_t) + stringSize;
+            int32_t scopeSize = validateDocument(value + scopeOffset, total - scopeOffset, depth + 1, maxDepth);
+            if (scopeSize < 0 || scopeOffset + scopeSize != total) {
+                return BSONPP_INVALID_DOCUMENT;
+            }
+            return total;
+        }
+        default:
+            return BSONPP_INVALID_DOCUMENT;
+    }
+
+    return size > remaining ? BSONPP_INVALID_DOCUMENT : size;
+}
+
+// Returns the size of a document that fits in length bytes or BSONPP_INVALID_DOCUMENT.
+static int32_t validateDocument(const uint8_t *data, int32_t length, int32_t depth, int32_t maxDepth) {
+    // 4 length bytes and a 0x00 suffix.
+    if (depth > maxDepth || length < 5) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+    int32_t size = read32(data);
+    if (size < 5 || size > length || data[size - 1] != 0x00) {
+        return BSONPP_INVALID_DOCUMENT;
+    }
+
+    // Minus 1 for the object null terminator
+    int32_t end = size - 1;
+    int32_t offset = sizeof(int32_t);
+    while (offset < end) {
+        uint8_t type = data[offset++];
+        const uint8_t *keyEnd = static_cast<const uint8_t *>(memchr(data + offset, 0, end - offset));
+        if (keyEnd == nullptr) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+        offset = keyEnd - data + 1;
+        int32_t valueSize = validateValue(type, data + offset, end - offset, depth, maxDepth);
+        if (valueSize < 0) {
+            return BSONPP_INVALID_DOCUMENT;
+        }
+        offset += valueSize;
+    }
+    return size;
+}
+
+int32_t BSONPP::validate(int32_t maxDepth) {
+    if (m_buffer == nullptr) {
+        return BSONPP_NO_BUFFER;
+    }
+    int32_t size = validateDocument(m_buffer, m_length, 0, maxDepth);
+    return size < 0 ? size : BSONPP_SUCCESS;
+}
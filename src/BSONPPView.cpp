@@ -0,0 +1,199 @@
+#include <string.h>
+#include "BSONPPView.h"
+
+// FNV-1a like bsonppHash, over a path segment rather than a whole string.
+static uint32_t hashSegment(const char *key, int32_t length) {
+    uint32_t hash = 2166136261u;
+    for (int32_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<uint8_t>(key[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot for a key within a sub-document, parents are mixed in so the same key under each spreads out.
+static uint32_t getSlot(int32_t parent, uint32_t hash, int32_t maxEntries) {
+    return (hash ^ static_cast<uint32_t>(parent + 1) * 2654435761u) % static_cast<uint32_t>(maxEntries);
+}
+
+BSONPPView::BSONPPView(BSONPP *doc, BSONPPViewEntry *entries, int32_t maxEntries):
+    m_entries(entries), m_maxEntries(maxEntries) {
+    this->reset(doc);
+}
+
+void BSONPPView::reset(BSONPP *doc) {
+    m_doc = *doc;
+    m_scanned = 0;
+    m_count = 0;
+    // Offsets are never 0 so it marks an empty slot.
+    for (int32_t i = 0; i < m_maxEntries; i++) {
+        m_entries[i].offset = 0;
+    }
+}
+
+int32_t BSONPPView::getCount() {
+    return m_count;
+}
+
+int32_t BSONPPView::findEntry(int32_t parent, const char *key, int32_t length, uint32_t hash) {
+    if (m_maxEntries == 0) {
+        return BSONPP_KEY_NOT_FOUND;
+    }
+    // Linear probing, duplicate keys are added in document order so the first one is found first.
+    uint32_t slot = getSlot(parent, hash, m_maxEntries);
+    for (int32_t i = 0; i < m_maxEntries; i++) {
+        const BSONPPViewEntry *entry = &m_entries[slot];
+        if (entry->offset == 0) {
+            break;
+        }
+        if (entry->parent == parent && entry->hash == hash) {
+            // +1 to skip the type
+            const char *existing = reinterpret_cast<char *>(m_doc.getBuffer() + entry->offset + 1);
+            if (memcmp(existing, key, length) == 0 && existing[length] == 0x00) {
+                return slot;
+            }
+        }
+        slot = slot + 1 == static_cast<uint32_t>(m_maxEntries) ? 0 : slot + 1;
+    }
+    return BSONPP_KEY_NOT_FOUND;
+}
+
+int32_t BSONPPView::addEntry(int32_t parent, uint32_t hash, int32_t offset) {
+    // A quarter of the entries are left empty to keep probes short.
+    if (m_count >= m_maxEntries - m_maxEntries / 4) {
+        return BSONPP_VIEW_UNCACHED;
+    }
+    uint32_t slot = getSlot(parent, hash, m_maxEntries);
+    while (m_entries[slot].offset != 0) {
+        slot = slot + 1 == static_cast<uint32_t>(m_maxEntries) ? 0 : slot + 1;
+    }
+    m_entries[slot] = { static_cast<int16_t>(parent), hash, offset, 0 };
+    m_count++;
+    return slot;
+}
+
+int32_t BSONPPView::find(const char *path, BSONPP *owner, int32_t *offset) {
+    if (m_doc.getBuffer() == nullptr) {
+        return BSONPP_NO_BUFFER;
+    }
+
+    BSONPP current = m_doc;
+    int32_t parent = -1;
+    while (true) {
+        const char *dot = strchr(path, '.');
+        int32_t length = dot == nullptr ? strlen(path) : dot - path;
+        uint32_t hash = hashSegment(path, length);
+        // Offsets are kept from the start of the top level document.
+        int32_t base = current.getBuffer() - m_doc.getBuffer();
+
+        // Elements are cached as they're scanned past so a scan only covers what's new.
+        int32_t *scanned = nullptr;
+        if (parent != BSONPP_VIEW_UNCACHED) {
+            scanned = parent < 0 ? &m_scanned : &m_entries[parent].scanned;
+        }
+        int32_t entry = scanned == nullptr ? BSONPP_KEY_NOT_FOUND : this->findEntry(parent, path, length, hash);
+        int32_t found = 0;
+        if (entry >= 0) {
+            found = m_entries[entry].offset;
+        } else {
+            int32_t next = scanned != nullptr && *scanned > 0 ? *scanned - base : 0;
+            BSONPPElement element;
+            int32_t res = BSONPP_SUCCESS;
+            entry = BSONPP_VIEW_UNCACHED;
+            while ((res = current.nextElement(&next, &element)) == BSONPP_SUCCESS) {
+                bool match = element.keyLength == length && memcmp(element.key, path, length) == 0;
+                if (scanned != nullptr) {
+                    uint32_t elementHash = match ? hash : hashSegment(element.key, element.keyLength);
+                    int32_t added = this->addEntry(parent, elementHash, base + element.offset);
+                    if (added == BSONPP_VIEW_UNCACHED) {
+                        // Full, the rest of the scan can't be cached.
+                        scanned = nullptr;
+                    } else {
+                        entry = match ? added : entry;
+                        *scanned = base + next;
+                    }
+                }
+                if (match) {
+                    break;
+                }
+            }
+            if (res != BSONPP_SUCCESS) {
+                return res;
+            }
+            found = base + element.offset;
+        }
+
+        if (dot == nullptr) {
+            *owner = current;
+            *offset = found - base;
+            return BSONPP_SUCCESS;
+        }
+        uint8_t type = m_doc.getBuffer()[found];
+        if (type != BSONPP_DOCUMENT && type != BSONPP_ARRAY) {
+            return BSONPP_KEY_NOT_FOUND;
+        }
+
+        // getValue only reads at the offset so it works for elements of sub-documents too.
+        m_doc.getValue(found, &current);
+        parent = entry;
+        path = dot + 1;
+    }
+}
+
+int32_t BSONPPView::findValue(const char *path, BSONPP *owner) {
+    int32_t offset = 0;
+    int32_t res = this->find(path, owner, &offset);
+    if (res != BSONPP_SUCCESS) {
+        return res;
+    }
+    return owner->getBuffer()[offset] == BSONPP_NULL ? BSONPP_NULL_VALUE : offset;
+}
+
+int32_t BSONPPView::get(const char *path, int32_t *val) {
+    BSONPP owner;
+    return owner.getValue(this->findValue(path, &owner), val);
+}
+
+int32_t BSONPPView::get(const char *path, int64_t *val) {
+    BSONPP owner;
+    return owner.getValue(this->findValue(path, &owner), val);
+}
+
+int32_t BSONPPView::get(const char *path, double *val) {
+    BSONPP owner;
+    return owner.getValue(this->findValue(path, &owner), val);
+}
+
+int32_t BSONPPView::get(const char *path, BSONPP *val) {
+    BSONPP owner;
+    return owner.getValue(this->findValue(path, &owner), val);
+}
+
+int32_t BSONPPView::get(const char *path, char **val, int32_t *length) {
+    BSONPP owner;
+    return owner.getValue(this->findValue(path, &owner), val, length);
+}
+
+int32_t BSONPPView::get(const char *path, uint8_t **val, int32_t *length, uint8_t *subtype) {
+    BSONPP owner;
+    return owner.getValue(this->findValue(path, &owner), val, length, subtype);
+}
+
+int32_t BSONPPView::get(const char *path, bool *val) {
+    BSONPP owner;
+    return owner.getValue(this->findValue(path, &owner), val);
+}
+
+int32_t BSONPPView::get(const char *path, BSONPPObjectId *val) {
+    BSONPP owner;
+    return owner.getValue(this->findValue(path, &owner), val);
+}
+
+int32_t BSONPPView::get(const char *path, BSONPPTimestamp *val) {
+    BSONPP owner;
+    return owner.getValue(this->findValue(path, &owner), val);
+}
+
+int32_t BSONPPView::get(const char *path, BSONPPDecimal128 *val) {
+    BSONPP owner;
+    return owner.getValue(this->findValue(path, &owner), val);
+}
@@ -0,0 +1,73 @@
+#ifndef __BSONPP_VIEW_H__
+#define __BSONPP_VIEW_H__
+
+#include <stdint.h>
+#include "BSONPP.h"
+
+// Entry index for sub-documents found once the entries ran out, their elements aren't cached.
+#define BSONPP_VIEW_UNCACHED (-2)
+
+// An element the view has located, the key is read back from the document.
+struct BSONPPViewEntry {
+    // Entry of the sub-document holding the element, -1 for the top level.
+    int16_t parent;
+    uint32_t hash;
+    // Offsets are from the start of the top level document.
+    int32_t offset;
+    // For sub-documents, the end of the elements cached from it so far or 0 before the first scan.
+    int32_t scanned;
+};
+
+/**
+ * Read only dotted path access that remembers where it found things. Each element scanned past is
+ * cached against the entry of the sub-document holding it, and later scans of that sub-document
+ * carry on from where the last one stopped. After reading "a.b.c" the reads of "a.b.d" and "a.e"
+ * start from the cached "a.b" and "a" rather than from the top, and once a sub-document has been
+ * scanned to the end its keys are all found without touching the document again.
+ *
+ * Entries are provided by the caller and used as a hash table, filled to three quarters. Once that
+ * many are used lookups still work, uncached parts are just scanned every time. The document mustn't
+ * change while it's viewed, call reset after changing it or to view another. Resetting clears every
+ * entry so a view sized for the documents it reads costs least.
+ */
+class BSONPPView {
+public:
+    // maxEntries can be at most INT16_MAX.
+    BSONPPView(BSONPP *doc, BSONPPViewEntry *entries, int32_t maxEntries);
+
+    // Views doc, forgetting everything located in the previous document.
+    void reset(BSONPP *doc);
+    // Number of entries used.
+    int32_t getCount();
+
+    // Like BSONPP::findPath, owner is the (sub-)document holding the element and offset its offset there.
+    int32_t find(const char *path, BSONPP *owner, int32_t *offset);
+
+    // Like the BSONPP getters but with a path. Null values return BSONPP_NULL_VALUE.
+    int32_t get(const char *path, int32_t *val);
+    int32_t get(const char *path, int64_t *val);
+    int32_t get(const char *path, double *val);
+    int32_t get(const char *path, BSONPP *val);
+    int32_t get(const char *path, char **val, int32_t *length = nullptr);
+    int32_t get(const char *path, uint8_t **val, int32_t *length = nullptr, uint8_t *subtype = nullptr);
+    int32_t get(const char *path, bool *val);
+    int32_t get(const char *path, BSONPPObjectId *val);
+    int32_t get(const char *path, BSONPPTimestamp *val);
+    int32_t get(const char *path, BSONPPDecimal128 *val);
+
+private:
+    // Returns the element offset in owner, BSONPP_NULL_VALUE or an error.
+    int32_t findValue(const char *path, BSONPP *owner);
+    int32_t findEntry(int32_t parent, const char *key, int32_t length, uint32_t hash);
+    // Returns the new entry or BSONPP_VIEW_UNCACHED if the entries are used up.
+    int32_t addEntry(int32_t parent, uint32_t hash, int32_t offset);
+
+    BSONPP m_doc;
+    // How far the top level elements have been cached.
+    int32_t m_scanned;
+    BSONPPViewEntry *m_entries;
+    int32_t m_maxEntries;
+    int32_t m_count;
+};
+
+#endif // __BSONPP_VIEW_H__
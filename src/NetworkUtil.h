@@ -10,12 +10,12 @@
 
 #if BYTE_ORDER != LITTLE_ENDIAN
 
-int32_t swap_int32(int32_t val) {
+static inline int32_t swap_int32(int32_t val) {
     val = ((val << 8) & 0xFF00FF00) | ((val >> 8) & 0xFF00FF);
     return (val << 16) | ((val >> 16) & 0xFFFF);
 }
 
-int64_t swap_int64(int64_t val) {
+static inline int64_t swap_int64(int64_t val) {
     val = ((val << 8) & 0xFF00FF00FF00FF00ULL) | ((val >> 8) & 0x00FF00FF00FF00FFULL);
     val = ((val << 16) & 0xFFFF0000FFFF0000ULL) | ((val >> 16) & 0x0000FFFF0000FFFFULL);
     return (val << 32) | ((val >> 32) & 0xFFFFFFFFULL);
@@ -23,25 +23,33 @@ int64_t swap_int64(int64_t val) {
 
 #ifndef htole32
 #define htole32(val) swap_int32(val)
-#define letoh32(val) swap_int32(val)
 #endif // htole32
+#ifndef letoh32
+#define letoh32(val) swap_int32(val)
+#endif // letoh32
 
 #ifndef htole64
 #define htole64(val) swap_int64(val)
-#define letoh64(val) swap_int64(val)
 #endif // htole64
+#ifndef letoh64
+#define letoh64(val) swap_int64(val)
+#endif // letoh64
 
 #else // BYTE_ORDER != LITTLE_ENDIAN
 
 #ifndef htole32
 #define htole32(val) (val)
-#define letoh32(val) (val)
 #endif // htole32
+#ifndef letoh32
+#define letoh32(val) (val)
+#endif // letoh32
 
 #ifndef htole64
 #define htole64(val) (val)
-#define letoh64(val) (val)
 #endif // htole64
+#ifndef letoh64
+#define letoh64(val) (val)
+#endif // letoh64
 
 #endif // BYTE_ORDER != LITTLE_ENDIAN
 
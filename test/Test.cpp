@@ -6,6 +6,23 @@
 
 #include <gtest/gtest.h>
 #include <BSONPP.h>
+#include <BSONPPGather.h>
+#include <BSONPPStream.h>
+#include <BSONPPAsync.h>
+#include <BSONPPCodec.h>
+#include <BSONPPStore.h>
+#include <BSONPPSort.h>
+#include <BSONPPStats.h>
+#include <BSONPPObjectId.h>
+#include <BSONPPPool.h>
+#include <BSONPPView.h>
+#include <BSONPPMergeIndex.h>
+#include <algorithm>
+#include <thread>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 constexpr int32_t kBufferSize = 256;
 
@@ -100,6 +117,33 @@ TEST_F(Test, GetString) {
     ASSERT_EQ(0, strncmp(val, fetched, strlen(val) + 1));
 }
 
+TEST_F(Test, GetStringLength) {
+    const char *val = "stringy mc stringyson";
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("str", val));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("empty", ""));
+
+    char *fetched = nullptr;
+    int32_t length = -1;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("str", &fetched, &length));
+    ASSERT_EQ(static_cast<int32_t>(strlen(val)), length);
+    ASSERT_EQ(0, memcmp(val, fetched, length));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("empty", &fetched, &length));
+    ASSERT_EQ(0, length);
+
+    char *key = nullptr;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getKeyAt(1, &key, &length));
+    ASSERT_EQ(5, length);
+    ASSERT_EQ(0, memcmp("empty", key, length));
+
+#ifdef BSONPP_HAS_STRING_VIEW
+    std::string_view view;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("str", &view));
+    ASSERT_EQ(std::string_view(val), view);
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getKeyAt(0, &view));
+    ASSERT_EQ(std::string_view("str"), view);
+#endif // BSONPP_HAS_STRING_VIEW
+}
+
 TEST_F(Test, AppendStringAndNumber) {
     // It's a possibility variable length strings clobber crap.
     // This test makes sure that doesn't happen.
@@ -261,7 +305,87 @@ TEST_F(Test, AppendArray) {
 
 TEST_F(Test, DuplicateKey) {
     ASSERT_EQ(BSONPP_SUCCESS, bson.append("a", "asdfsdf"));
+#ifdef BSONPP_TRUSTED_INPUT
+    // Not checked, lookups find the first.
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("a", "s"));
+    char *str = nullptr;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("a", &str));
+    ASSERT_EQ(0, strcmp("asdfsdf", str));
+#else
     ASSERT_EQ(BSONPP_DUPLICATE_KEY, bson.append("a", "s"));
+#endif
+}
+
+#ifndef BSONPP_TRUSTED_INPUT
+TEST_F(Test, UnsupportedType) {
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("a", (int32_t) 1));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("b", (int32_t) 2));
+    // Turn "a" into a type that doesn't exist, the elements after it can't be found.
+    bson.getBuffer()[4] = 0x14;
+    int32_t value = 0;
+    ASSERT_EQ(BSONPP_INCORRECT_TYPE, bson.get("b", &value));
+    int32_t count = 0;
+    ASSERT_EQ(BSONPP_INCORRECT_TYPE, bson.getKeyCount(&count));
+    bson.getBuffer()[4] = 0x40;
+    ASSERT_EQ(BSONPP_INCORRECT_TYPE, bson.get("b", &value));
+}
+#endif
+
+TEST_F(Test, ValidateUntrustedInput) {
+    uint8_t childBuffer[kBufferSize];
+    uint8_t arrayBuffer[kBufferSize];
+    BSONPP child(childBuffer, kBufferSize);
+    BSONPP array(arrayBuffer, kBufferSize);
+    const uint8_t binary[] = { 1, 2, 3 };
+    ASSERT_EQ(BSONPP_SUCCESS, array.append("0", "zero"));
+    ASSERT_EQ(BSONPP_SUCCESS, child.append("bin", binary, sizeof(binary)));
+    ASSERT_EQ(BSONPP_SUCCESS, child.append("list", &array, true));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("name", "value"));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("child", &child));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("z", (int32_t) 1));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.validate());
+    uint8_t *buffer = bson.getBuffer();
+
+    // Nesting is child then list.
+    ASSERT_EQ(BSONPP_INVALID_DOCUMENT, bson.validate(1));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.validate(2));
+
+    // Every truncation is caught.
+    int32_t size = bson.getSize();
+    for (int32_t length = 0; length < size; length++) {
+        BSONPP truncated(buffer, length, false);
+        ASSERT_EQ(BSONPP_INVALID_DOCUMENT, truncated.validate());
+    }
+
+    // "name" string length, past the end then shorter than its terminator.
+    buffer[10] = 0x7F;
+    ASSERT_EQ(BSONPP_INVALID_DOCUMENT, bson.validate());
+    buffer[10] = 0x05;
+    ASSERT_EQ(BSONPP_INVALID_DOCUMENT, bson.validate());
+    buffer[10] = 0x06;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.validate());
+
+    // The child's size running past the document.
+    buffer[27] = 0x7F;
+    ASSERT_EQ(BSONPP_INVALID_DOCUMENT, bson.validate());
+    buffer[27] = childBuffer[0];
+
+    // An unknown type and a missing document terminator.
+    buffer[4] = 0x14;
+    ASSERT_EQ(BSONPP_INVALID_DOCUMENT, bson.validate());
+    buffer[4] = BSONPP_STRING;
+    buffer[size - 1] = 0x01;
+    ASSERT_EQ(BSONPP_INVALID_DOCUMENT, bson.validate());
+    buffer[size - 1] = 0x00;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.validate());
+
+    // A key without its terminator.
+    uint8_t unterminated[] = { 0x08, 0x00, 0x00, 0x00, BSONPP_NULL, 'a', 'b', 0x00 };
+    BSONPP key(unterminated, sizeof(unterminated), false);
+    ASSERT_EQ(BSONPP_INVALID_DOCUMENT, key.validate());
+
+    BSONPP empty;
+    ASSERT_EQ(BSONPP_NO_BUFFER, empty.validate());
 }
 
 TEST_F(Test, AppendBinary) {
@@ -285,6 +409,394 @@ TEST_F(Test, GetBinary) {
     ASSERT_EQ(0, memcmp(binary, fetched, sizeof(binary)));
 }
 
+TEST_F(Test, MongoTypes) {
+    BSONPPObjectId id = {{ 0x5d, 0x30, 0x8e, 0x84, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x00, 0x2a }};
+    BSONPPTimestamp timestamp = { 7, 1563463300 };
+    BSONPPDecimal128 decimal = {{ 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x40, 0x30 }};
+    uint8_t uuid[16] = { 0x12, 0x34 };
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("_id", &id));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("ts", &timestamp));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("price", &decimal));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("uuid", uuid, sizeof(uuid), BSONPP_BINARY_SUBTYPE_UUID));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("last", (int32_t) 1));
+
+    // Timestamps are a little endian uint64 with the seconds in the high half.
+    uint8_t expectedTimestamp[] = { 0x11, 't', 's', 0x00, 0x07, 0x00, 0x00, 0x00, 0x84, 0x8e, 0x30, 0x5d };
+    ASSERT_EQ(0, memcmp(expectedTimestamp, bson.getBuffer() + 4 + 17, sizeof(expectedTimestamp)));
+
+    BSONPPObjectId fetchedId;
+    BSONPPTimestamp fetchedTimestamp;
+    BSONPPDecimal128 fetchedDecimal;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("_id", &fetchedId));
+    ASSERT_EQ(0, memcmp(id.bytes, fetchedId.bytes, sizeof(id.bytes)));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("ts", &fetchedTimestamp));
+    ASSERT_EQ(7u, fetchedTimestamp.increment);
+    ASSERT_EQ(1563463300u, fetchedTimestamp.seconds);
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("price", &fetchedDecimal));
+    ASSERT_EQ(0, memcmp(decimal.bytes, fetchedDecimal.bytes, sizeof(decimal.bytes)));
+    ASSERT_EQ(BSONPP_INCORRECT_TYPE, bson.get("ts", &fetchedId));
+
+    uint8_t *data = nullptr;
+    int32_t length = 0;
+    uint8_t subtype = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("uuid", &data, &length, &subtype));
+    ASSERT_EQ(16, length);
+    ASSERT_EQ(BSONPP_BINARY_SUBTYPE_UUID, subtype);
+    ASSERT_EQ(0x34, data[1]);
+
+    int32_t count = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getKeyCount(&count));
+    ASSERT_EQ(5, count);
+}
+
+TEST_F(Test, ScanPastEveryType) {
+    // Types without typed accessors, written by hand.
+    uint8_t raw[] = {
+        0x00, 0x00, 0x00, 0x00,
+        BSONPP_REGEX, 'r', 0x00, '^', 'a', 0x00, 'i', 0x00,
+        BSONPP_DB_POINTER, 'p', 0x00, 0x02, 0x00, 0x00, 0x00, 'c', 0x00, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12,
+        BSONPP_JAVASCRIPT, 'j', 0x00, 0x03, 0x00, 0x00, 0x00, 'f', '(', 0x00,
+        BSONPP_SYMBOL, 's', 0x00, 0x02, 0x00, 0x00, 0x00, 'x', 0x00,
+        BSONPP_JAVASCRIPT_WITH_SCOPE, 'w', 0x00, 0x16, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 'f', 0x00,
+        0x0c, 0x00, 0x00, 0x00, BSONPP_INT32, 'v', 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        BSONPP_MIN_KEY, 'm', 0x00,
+        BSONPP_MAX_KEY, 'M', 0x00,
+        BSONPP_INT32, 'z', 0x00, 0x2a, 0x00, 0x00, 0x00,
+        0x00
+    };
+    raw[0] = sizeof(raw);
+    BSONPP doc(raw, sizeof(raw), false);
+
+    int32_t value = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, doc.get("z", &value));
+    ASSERT_EQ(42, value);
+    int32_t count = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, doc.getKeyCount(&count));
+    ASSERT_EQ(8, count);
+
+    // Symbols compare with strings, min and max key sort around everything.
+    uint8_t buffer[kBufferSize];
+    BSONPP other(buffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("x", "x"));
+    auto offsetOf = [](BSONPP *owner, const char *key) {
+        BSONPP found;
+        int32_t offset = 0;
+        return owner->findPath(key, &found, &offset) == BSONPP_SUCCESS ? offset : BSONPP_KEY_NOT_FOUND;
+    };
+    int32_t result = 0;
+    uint64_t symbolKey = 0;
+    uint64_t stringKey = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, doc.compareValue(offsetOf(&doc, "s"), &other, offsetOf(&other, "x"), &result));
+    ASSERT_EQ(0, result);
+    ASSERT_EQ(BSONPP_SUCCESS, doc.getSortKey(offsetOf(&doc, "s"), &symbolKey));
+    ASSERT_EQ(BSONPP_SUCCESS, other.getSortKey(offsetOf(&other, "x"), &stringKey));
+    ASSERT_EQ(stringKey, symbolKey);
+    ASSERT_EQ(BSONPP_SUCCESS, doc.compareValue(offsetOf(&doc, "m"), &doc, offsetOf(&doc, "r"), &result));
+    ASSERT_EQ(-1, result);
+    ASSERT_EQ(BSONPP_SUCCESS, doc.compareValue(offsetOf(&doc, "M"), &doc, offsetOf(&doc, "w"), &result));
+    ASSERT_EQ(1, result);
+
+    // The key codec keeps every type.
+    char storage[128];
+    uint16_t offsets[16];
+    uint16_t slots[32];
+    BSONPPKeyDictionary dictionary(storage, sizeof(storage), offsets, 16, slots, 32);
+    BSONPPKeyEncoder encoder(&dictionary);
+    uint8_t encoded[256];
+    int32_t written = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, encoder.encode(&doc, encoded, sizeof(encoded), &written));
+    char decoderStorage[128];
+    uint16_t decoderOffsets[16];
+    BSONPPKeyDictionary decoderDictionary(decoderStorage, sizeof(decoderStorage), decoderOffsets, 16);
+    BSONPPKeyDecoder decoder(&decoderDictionary);
+    uint8_t decoded[256];
+    BSONPP decodedDoc;
+    int32_t consumed = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, decoder.decode(encoded, written, decoded, sizeof(decoded), &decodedDoc, &consumed));
+    ASSERT_EQ(written, consumed);
+    ASSERT_EQ(static_cast<int32_t>(sizeof(raw)), decodedDoc.getSize());
+    ASSERT_EQ(0, memcmp(raw, decoded, sizeof(raw)));
+}
+
+TEST_F(Test, ObjectIdGenerator) {
+    const uint8_t processUnique[5] = { 1, 2, 3, 4, 5 };
+    BSONPPObjectIdGenerator fixed(processUnique, 0xFFFFFE);
+    BSONPPObjectId id;
+    fixed.next(&id, 0x5d308e84);
+    uint8_t expected[] = { 0x5d, 0x30, 0x8e, 0x84, 1, 2, 3, 4, 5, 0xFF, 0xFF, 0xFE };
+    ASSERT_EQ(0, memcmp(expected, id.bytes, sizeof(expected)));
+    // The counter wraps at 24 bits.
+    fixed.next(&id, 0x5d308e84);
+    fixed.next(&id, 0x5d308e84);
+    ASSERT_EQ(0, id.bytes[9] | id.bytes[10] | id.bytes[11]);
+
+    // Threads sharing a generator never repeat an id.
+    constexpr int32_t kThreads = 4;
+    constexpr int32_t kIds = 5000;
+    BSONPPObjectIdGenerator generator;
+    static BSONPPObjectId ids[kThreads * kIds];
+    std::thread workers[kThreads];
+    for (int32_t i = 0; i < kThreads; i++) {
+        workers[i] = std::thread([&generator, i]() {
+            for (int32_t j = 0; j < kIds; j++) {
+                generator.next(&ids[i * kIds + j], 1000);
+            }
+        });
+    }
+    for (int32_t i = 0; i < kThreads; i++) {
+        workers[i].join();
+    }
+    std::sort(ids, ids + kThreads * kIds, [](const BSONPPObjectId &a, const BSONPPObjectId &b) {
+        return memcmp(a.bytes, b.bytes, sizeof(a.bytes)) < 0;
+    });
+    for (int32_t i = 1; i < kThreads * kIds; i++) {
+        ASSERT_NE(0, memcmp(ids[i - 1].bytes, ids[i].bytes, sizeof(ids[i].bytes)));
+    }
+
+    // This thread reserves a block and goes idle while another wraps the counter, then both make ids
+    // in the same second. The block reserved in an earlier second mustn't be used.
+    BSONPPObjectIdGenerator wrapped(processUnique, 0);
+    wrapped.next(&id, 2000);
+    static BSONPPObjectId late[2][BSONPP_OBJECT_ID_BLOCK];
+    std::thread other([&wrapped]() {
+        BSONPPObjectId discard;
+        for (int32_t j = BSONPP_OBJECT_ID_BLOCK; j < (1 << 24); j++) {
+            wrapped.next(&discard, 2001);
+        }
+        for (int32_t j = 0; j < BSONPP_OBJECT_ID_BLOCK; j++) {
+            wrapped.next(&late[0][j], 2002);
+        }
+    });
+    other.join();
+    for (int32_t j = 0; j < BSONPP_OBJECT_ID_BLOCK; j++) {
+        wrapped.next(&late[1][j], 2002);
+    }
+    for (int32_t i = 0; i < BSONPP_OBJECT_ID_BLOCK; i++) {
+        for (int32_t j = 0; j < BSONPP_OBJECT_ID_BLOCK; j++) {
+            ASSERT_NE(0, memcmp(late[0][i].bytes, late[1][j].bytes, sizeof(id.bytes)));
+        }
+    }
+}
+
+TEST_F(Test, ClearLeavesBufferAlone) {
+    uint8_t buffer[32];
+    memset(buffer, 0xAA, sizeof(buffer));
+    BSONPP doc(buffer, sizeof(buffer));
+    ASSERT_EQ(5, doc.getSize());
+    ASSERT_EQ(0xAA, buffer[5]);
+    // Appends terminate the document themselves.
+    ASSERT_EQ(BSONPP_SUCCESS, doc.append("a", (int32_t) 1));
+    uint8_t expected[] = { 0x0c, 0x00, 0x00, 0x00, 0x10, 0x61, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0xAA };
+    ASSERT_EQ(0, memcmp(expected, buffer, sizeof(expected)));
+}
+
+TEST_F(Test, BufferPoolReuse) {
+    BSONPPBufferPool pool(100, 3);
+    ASSERT_EQ(128, pool.getClassSize(0));
+    ASSERT_EQ(512, pool.getClassSize(2));
+
+    BSONPP doc;
+    ASSERT_EQ(BSONPP_OUT_OF_SPACE, pool.acquire(513, &doc));
+    ASSERT_EQ(BSONPP_SUCCESS, pool.acquire(200, &doc));
+    ASSERT_EQ(256, doc.getBufferSize());
+    ASSERT_EQ(BSONPP_SUCCESS, doc.append("a", "value"));
+    uint8_t *first = doc.getBuffer();
+    pool.release(&doc);
+    ASSERT_EQ(nullptr, doc.getBuffer());
+
+    // The same thread gets the buffer back, empty.
+    ASSERT_EQ(BSONPP_SUCCESS, pool.acquire(129, &doc));
+    ASSERT_EQ(first, doc.getBuffer());
+    ASSERT_EQ(5, doc.getSize());
+    pool.release(&doc);
+
+    // Releasing more than a thread caches moves batches to the shared list, which refills the cache.
+    BSONPP docs[BSONPP_POOL_CACHE_SIZE + 1];
+    for (int32_t i = 0; i < BSONPP_POOL_CACHE_SIZE + 1; i++) {
+        ASSERT_EQ(BSONPP_SUCCESS, pool.acquire(64, &docs[i]));
+    }
+    for (int32_t i = 0; i < BSONPP_POOL_CACHE_SIZE + 1; i++) {
+        pool.release(&docs[i]);
+    }
+    for (int32_t i = 0; i < BSONPP_POOL_CACHE_SIZE + 1; i++) {
+        ASSERT_EQ(BSONPP_SUCCESS, pool.acquire(64, &docs[i]));
+    }
+
+    BSONPPBufferPoolStats stats;
+    pool.getStats(&stats);
+    ASSERT_EQ(2u + 2 * (BSONPP_POOL_CACHE_SIZE + 1), stats.acquires);
+    ASSERT_EQ(1u, stats.spills);
+    ASSERT_EQ(1u, stats.sharedHits);
+    ASSERT_EQ(1u + BSONPP_POOL_CACHE_SIZE + 1, stats.allocations);
+    ASSERT_EQ(stats.acquires, stats.localHits + stats.sharedHits + stats.allocations);
+    for (int32_t i = 0; i < BSONPP_POOL_CACHE_SIZE + 1; i++) {
+        pool.release(&docs[i]);
+    }
+}
+
+TEST_F(Test, BufferPoolThreads) {
+    constexpr int32_t kThreads = 4;
+    BSONPPBufferPool pool;
+    std::thread workers[kThreads];
+    bool failed[kThreads] = {};
+    for (int32_t t = 0; t < kThreads; t++) {
+        workers[t] = std::thread([&pool, &failed, t]() {
+            BSONPP held[48];
+            for (int32_t round = 0; round < 200; round++) {
+                // Hold enough buffers to spill so buffers move between threads.
+                for (int32_t i = 0; i < 48; i++) {
+                    if (pool.acquire(256, &held[i]) != BSONPP_SUCCESS || held[i].append("t", t * 1000 + i) != BSONPP_SUCCESS) {
+                        failed[t] = true;
+                        return;
+                    }
+                }
+                for (int32_t i = 0; i < 48; i++) {
+                    int32_t value = 0;
+                    if (held[i].get("t", &value) != BSONPP_SUCCESS || value != t * 1000 + i) {
+                        failed[t] = true;
+                    }
+                    pool.release(&held[i]);
+                }
+            }
+        });
+    }
+    for (int32_t t = 0; t < kThreads; t++) {
+        workers[t].join();
+        ASSERT_FALSE(failed[t]);
+    }
+
+    BSONPPBufferPoolStats stats;
+    pool.getStats(&stats);
+    ASSERT_EQ(static_cast<uint64_t>(kThreads) * 200 * 48, stats.acquires);
+    ASSERT_GT(stats.localHits, stats.allocations);
+}
+
+TEST_F(Test, CopyElements) {
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("id", (int32_t) 7));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("name", "probe"));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("secret", "hunter2"));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("ok", true));
+
+    uint8_t buffer[kBufferSize];
+    BSONPP copy(buffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, copy.appendAllFrom(&bson));
+    ASSERT_EQ(bson.getSize(), copy.getSize());
+    ASSERT_EQ(0, memcmp(bson.getBuffer(), copy.getBuffer(), bson.getSize()));
+
+    // Everything but the excluded key, in two runs.
+    static const BSONPPKey keys[] = { BSONPP_KEY("secret") };
+    static const BSONPPStaticKeySet<1> keySet(keys);
+    copy.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, copy.appendAllFrom(&bson, &keySet, true));
+    int32_t count = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, copy.getKeyCount(&count));
+    ASSERT_EQ(3, count);
+    ASSERT_FALSE(copy.exists("secret"));
+    bool ok = false;
+    ASSERT_EQ(BSONPP_SUCCESS, copy.get("ok", &ok));
+    ASSERT_TRUE(ok);
+
+#ifndef BSONPP_TRUSTED_INPUT
+    // Failures leave the document as it was.
+    int32_t size = copy.getSize();
+    ASSERT_EQ(BSONPP_SUCCESS, copy.appendElement(&bson, "secret"));
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, copy.appendElement(&bson, "secret"));
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, copy.appendAllFrom(&bson, &keySet));
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, copy.appendElement(&bson, "missing"));
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, copy.appendAllFrom(&bson));
+    // Type, key, length and value of "secret" only.
+    ASSERT_EQ(size + 20, copy.getSize());
+
+    // The same checks with the existing keys indexed, which needs an entry for each of them.
+    BSONPPStaticMergeIndex<4> index;
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, copy.appendAllFrom(&bson, &keySet, false, &index));
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, copy.appendAllFrom(&bson, nullptr, false, &index));
+    BSONPPStaticMergeIndex<3> smallIndex;
+    ASSERT_EQ(BSONPP_OUT_OF_SPACE, copy.appendAllFrom(&bson, &keySet, true, &smallIndex));
+    ASSERT_EQ(size + 20, copy.getSize());
+    copy.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, copy.append("extra", (int32_t) 1));
+    ASSERT_EQ(BSONPP_SUCCESS, copy.appendAllFrom(&bson, &keySet, true, &index));
+    ASSERT_EQ(BSONPP_SUCCESS, copy.getKeyCount(&count));
+    ASSERT_EQ(4, count);
+#endif
+
+    uint8_t small[24];
+    BSONPP smallDoc(small, sizeof(small));
+    ASSERT_EQ(BSONPP_OUT_OF_SPACE, smallDoc.appendAllFrom(&bson));
+    ASSERT_EQ(5, smallDoc.getSize());
+}
+
+TEST_F(Test, MergeDocuments) {
+    uint8_t aBuffer[kBufferSize];
+    uint8_t bBuffer[kBufferSize];
+    BSONPP a(aBuffer, kBufferSize);
+    BSONPP b(bBuffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, a.append("type", "reading"));
+    ASSERT_EQ(BSONPP_SUCCESS, a.append("version", (int32_t) 1));
+    ASSERT_EQ(BSONPP_SUCCESS, a.append("source", "gateway"));
+    ASSERT_EQ(BSONPP_SUCCESS, b.append("version", (int32_t) 2));
+    ASSERT_EQ(BSONPP_SUCCESS, b.append("value", 21.5));
+
+    BSONPPStaticMergeIndex<8> index;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.merge(&a, &b, &index));
+    char *key = nullptr;
+    const char *order[] = { "type", "version", "source", "value" };
+    for (int32_t i = 0; i < 4; i++) {
+        ASSERT_EQ(BSONPP_SUCCESS, bson.getKeyAt(i, &key));
+        ASSERT_STREQ(order[i], key);
+    }
+    int32_t version = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("version", &version));
+    ASSERT_EQ(2, version);
+
+    bson.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.merge(&a, &b, &index, BSONPP_MERGE_KEEP_FIRST));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("version", &version));
+    ASSERT_EQ(1, version);
+    int32_t count = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getKeyCount(&count));
+    ASSERT_EQ(4, count);
+
+    bson.clear();
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, bson.merge(&a, &b, &index, BSONPP_MERGE_FAIL));
+    ASSERT_EQ(5, bson.getSize());
+
+    // Runs of b's keys either side of the one taken by a.
+    ASSERT_EQ(BSONPP_SUCCESS, b.append("unit", "C"));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.merge(&a, &b, &index, BSONPP_MERGE_KEEP_FIRST));
+    const char *keptOrder[] = { "type", "version", "source", "value", "unit" };
+    for (int32_t i = 0; i < 5; i++) {
+        ASSERT_EQ(BSONPP_SUCCESS, bson.getKeyAt(i, &key));
+        ASSERT_STREQ(keptOrder[i], key);
+    }
+
+    // The index holds b's elements and those already here.
+    BSONPPStaticMergeIndex<2> smallIndex;
+    bson.clear();
+    ASSERT_EQ(BSONPP_OUT_OF_SPACE, bson.merge(&a, &b, &smallIndex));
+    ASSERT_EQ(5, bson.getSize());
+
+#ifndef BSONPP_TRUSTED_INPUT
+    // Keys already in the destination clash whichever document they come from.
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("source", "relay"));
+    int32_t size = bson.getSize();
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, bson.merge(&a, &b, &index));
+    ASSERT_EQ(size, bson.getSize());
+    bson.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("unit", "F"));
+    size = bson.getSize();
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, bson.merge(&a, &b, &index, BSONPP_MERGE_KEEP_FIRST));
+    ASSERT_EQ(size, bson.getSize());
+    ASSERT_EQ(BSONPP_SUCCESS, bson.validate());
+#endif
+    bson.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("id", (int32_t) 3));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.merge(&a, &b, &index));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getKeyCount(&count));
+    ASSERT_EQ(6, count);
+}
+
 TEST_F(Test, AppendBoolean) {
     ASSERT_EQ(BSONPP_SUCCESS, bson.append("truthy", true));
     ASSERT_EQ(BSONPP_SUCCESS, bson.append("falsey", false));
@@ -331,4 +843,988 @@ TEST_F(Test, CopeWithNull) {
     ASSERT_EQ(10, val);
 }
 
+TEST_F(Test, KeyPrefixDoesNotMatch) {
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("fishA", 10));
+    int32_t val = 0;
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, bson.get("fish", &val));
+    ASSERT_FALSE(bson.exists("fish"));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("fish", 20));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("fish", &val));
+    ASSERT_EQ(20, val);
+}
+
+TEST_F(Test, FindKeySet) {
+    static const BSONPPKey keys[] = { BSONPP_KEY("fish"), BSONPP_KEY("str"), BSONPP_KEY("missing"), BSONPP_KEY("val") };
+    static const BSONPPStaticKeySet<4> keySet(keys);
+    ASSERT_TRUE(keySet.isValid());
+
+    uint8_t data[] = { 0x15, 0x0, 0x0, 0x0, 0xa, 0x76, 0x61, 0x6c, 0x0, 0x10, 0x74, 0x68, 0x69, 0x6e, 0x67, 0x0, 0xa, 0x0, 0x0, 0x0, 0x0 };
+    BSONPP doc(data, sizeof(data), false);
+    int32_t nullOffsets[4];
+    ASSERT_EQ(BSONPP_SUCCESS, doc.find(&keySet, nullOffsets));
+    ASSERT_EQ(BSONPP_NULL_VALUE, nullOffsets[3]);
+
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("fishA", 10));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("str", "stringy"));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("fish", 30));
+
+    int32_t offsets[4];
+    ASSERT_EQ(BSONPP_SUCCESS, bson.find(&keySet, offsets));
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, offsets[2]);
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, offsets[3]);
+
+    int32_t val = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getValue(offsets[0], &val));
+    ASSERT_EQ(30, val);
+    char *str = nullptr;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getValue(offsets[1], &str));
+    ASSERT_EQ(0, strcmp("stringy", str));
+    ASSERT_EQ(BSONPP_INCORRECT_TYPE, bson.getValue(offsets[1], &val));
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, bson.getValue(offsets[2], &val));
+}
+
+TEST_F(Test, KeySetLayout) {
+    static const BSONPPKey duplicates[] = { BSONPP_KEY("a"), BSONPP_KEY("b"), BSONPP_KEY("a") };
+    BSONPPStaticKeySet<3> duplicateSet(duplicates);
+    ASSERT_FALSE(duplicateSet.isValid());
+
+    static const BSONPPKey keys[] = {
+        BSONPP_KEY("deviceId"), BSONPP_KEY("ts"), BSONPP_KEY("temperature"), BSONPP_KEY("humidity"),
+        BSONPP_KEY("pressure"), BSONPP_KEY("battery"), BSONPP_KEY("rssi"), BSONPP_KEY("uptime"),
+        BSONPP_KEY("firmware"), BSONPP_KEY("lat"), BSONPP_KEY("lon"), BSONPP_KEY("alt"),
+        BSONPP_KEY("speed"), BSONPP_KEY("heading"), BSONPP_KEY("status"), BSONPP_KEY("errors")
+    };
+    BSONPPStaticKeySet<16> keySet(keys);
+    ASSERT_TRUE(keySet.isValid());
+    for (int32_t i = 0; i < 16; i++) {
+        int32_t length = 0;
+        uint32_t hash = BSONPPKeySet::hash(keys[i].name, &length);
+        ASSERT_EQ(keys[i].hash, hash);
+        ASSERT_EQ(i, keySet.indexOf(keys[i].name, length, hash));
+    }
+    int32_t length = 0;
+    uint32_t hash = BSONPPKeySet::hash("speedy", &length);
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, keySet.indexOf("speedy", length, hash));
+}
+
+TEST_F(Test, GatherMatchesAppend) {
+    uint8_t blob[200];
+    for (uint32_t i = 0; i < sizeof(blob); i++) {
+        blob[i] = i;
+    }
+    uint8_t subBuffer[kBufferSize];
+    BSONPP subdoc(subBuffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, subdoc.append("num", 10));
+
+    uint8_t buffer[512];
+    BSONPP doc(buffer, sizeof(buffer));
+    ASSERT_EQ(BSONPP_SUCCESS, doc.append("a", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, doc.append("blob", blob, sizeof(blob)));
+    ASSERT_EQ(BSONPP_SUCCESS, doc.append("str", "short"));
+    ASSERT_EQ(BSONPP_SUCCESS, doc.append("doc", &subdoc));
+    ASSERT_EQ(BSONPP_SUCCESS, doc.append("fl", 0.5));
+    ASSERT_EQ(BSONPP_SUCCESS, doc.append("b", true));
+
+    struct iovec iovecs[8];
+    uint8_t scratch[128];
+    BSONPPGather gather(iovecs, 8, scratch, sizeof(scratch));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.append("a", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.append("blob", blob, sizeof(blob)));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.append("str", "short"));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.append("doc", &subdoc));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.append("fl", 0.5));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.append("b", true));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.finish());
+
+    ASSERT_EQ(doc.getSize(), gather.getSize());
+    // The blob is referenced rather than copied, everything else shares scratch.
+    ASSERT_EQ(3, gather.getIovecCount());
+    ASSERT_EQ(blob, iovecs[1].iov_base);
+
+    uint8_t flattened[512];
+    int32_t offset = 0;
+    for (int32_t i = 0; i < gather.getIovecCount(); i++) {
+        memcpy(flattened + offset, iovecs[i].iov_base, iovecs[i].iov_len);
+        offset += iovecs[i].iov_len;
+    }
+    ASSERT_EQ(doc.getSize(), offset);
+    ASSERT_EQ(0, memcmp(buffer, flattened, offset));
+
+    FILE *file = tmpfile();
+    ASSERT_NE(nullptr, file);
+    ASSERT_EQ(BSONPP_SUCCESS, gather.writeTo(fileno(file)));
+    rewind(file);
+    ASSERT_EQ(static_cast<size_t>(offset), fread(flattened, 1, sizeof(flattened), file));
+    ASSERT_EQ(0, memcmp(buffer, flattened, offset));
+    fclose(file);
+}
+
+TEST_F(Test, GatherOutOfSpace) {
+    struct iovec iovecs[2];
+    uint8_t scratch[16];
+    BSONPPGather gather(iovecs, 2, scratch, sizeof(scratch));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.append("a", 1));
+    ASSERT_EQ(BSONPP_OUT_OF_SPACE, gather.append("b", 2));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.finish());
+    ASSERT_EQ(12, gather.getSize());
+}
+
+TEST_F(Test, GatherFileRange) {
+    uint8_t payload[10000];
+    for (uint32_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = i * 7;
+    }
+    FILE *source = tmpfile();
+    ASSERT_NE(nullptr, source);
+    // Prefix some bytes so the range doesn't start at the beginning of the file.
+    ASSERT_EQ(3u, fwrite("abc", 1, 3, source));
+    ASSERT_EQ(sizeof(payload), fwrite(payload, 1, sizeof(payload), source));
+    fflush(source);
+
+    uint8_t *expectedBuffer = new uint8_t[sizeof(payload) + 64];
+    BSONPP expected(expectedBuffer, sizeof(payload) + 64);
+    ASSERT_EQ(BSONPP_SUCCESS, expected.append("a", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, expected.append("file", payload, sizeof(payload)));
+    ASSERT_EQ(BSONPP_SUCCESS, expected.append("b", 2));
+
+    struct iovec iovecs[8];
+    uint8_t scratch[64];
+    BSONPPFileRange ranges[1];
+    BSONPPGather gather(iovecs, 8, scratch, sizeof(scratch));
+    ASSERT_EQ(BSONPP_OUT_OF_SPACE, gather.appendFile("file", fileno(source), 3, sizeof(payload)));
+    gather.setFileRanges(ranges, 1);
+    ASSERT_EQ(BSONPP_SUCCESS, gather.append("a", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.appendFile("file", fileno(source), 3, sizeof(payload)));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.append("b", 2));
+    ASSERT_EQ(BSONPP_SUCCESS, gather.finish());
+    ASSERT_EQ(expected.getSize(), gather.getSize());
+
+    FILE *output = tmpfile();
+    ASSERT_NE(nullptr, output);
+    ASSERT_EQ(BSONPP_SUCCESS, gather.writeTo(fileno(output)));
+    rewind(output);
+    uint8_t *written = new uint8_t[sizeof(payload) + 64];
+    ASSERT_EQ(static_cast<size_t>(expected.getSize()), fread(written, 1, sizeof(payload) + 64, output));
+    ASSERT_EQ(0, memcmp(expectedBuffer, written, expected.getSize()));
+
+    fclose(source);
+    fclose(output);
+    delete[] expectedBuffer;
+    delete[] written;
+}
+
+TEST_F(Test, StreamRoundTrip) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    ASSERT_EQ(0, fcntl(fds[0], F_SETFL, O_NONBLOCK));
+    ASSERT_EQ(0, fcntl(fds[1], F_SETFL, O_NONBLOCK));
+
+    constexpr int32_t kDocs = 100;
+    uint8_t buffers[kDocs][32];
+    BSONPP docs[kDocs];
+    struct iovec iovecs[16];
+    BSONPPStreamWriter writer(iovecs, 16);
+    for (int32_t i = 0; i < kDocs; i++) {
+        docs[i] = BSONPP(buffers[i], sizeof(buffers[i]));
+        ASSERT_EQ(BSONPP_SUCCESS, docs[i].append("i", i));
+        if (writer.queue(&docs[i]) == BSONPP_OUT_OF_SPACE) {
+            ASSERT_EQ(BSONPP_SUCCESS, writer.flush(fds[0]));
+            ASSERT_EQ(BSONPP_SUCCESS, writer.queue(&docs[i]));
+        }
+    }
+    ASSERT_EQ(BSONPP_SUCCESS, writer.flush(fds[0]));
+    ASSERT_EQ(0, writer.getPending());
+
+    // A buffer smaller than the total forces partial documents to be carried between fills.
+    uint8_t readBuffer[100];
+    BSONPPStreamReader reader(readBuffer, sizeof(readBuffer));
+    int32_t received = 0;
+    BSONPP doc;
+    while (received < kDocs) {
+        ASSERT_GT(reader.fill(fds[1]), 0);
+        while (reader.next(&doc) == BSONPP_SUCCESS) {
+            int32_t val = -1;
+            ASSERT_EQ(BSONPP_SUCCESS, doc.get("i", &val));
+            ASSERT_EQ(received++, val);
+        }
+    }
+    ASSERT_EQ(0, reader.getPending());
+    ASSERT_EQ(0, reader.fill(fds[1]));
+    ASSERT_EQ(BSONPP_INCOMPLETE, reader.next(&doc));
+
+    close(fds[0]);
+    ASSERT_EQ(BSONPP_END_OF_STREAM, reader.fill(fds[1]));
+    close(fds[1]);
+}
+
+TEST_F(Test, StreamInvalidDocument) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    uint8_t huge[] = { 0xff, 0xff, 0x0, 0x0, 0x0 };
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(huge)), write(fds[1], huge, sizeof(huge)));
+
+    uint8_t readBuffer[64];
+    BSONPPStreamReader reader(readBuffer, sizeof(readBuffer));
+    BSONPP doc;
+    ASSERT_EQ(static_cast<int32_t>(sizeof(huge)), reader.fill(fds[0]));
+    ASSERT_EQ(BSONPP_INVALID_DOCUMENT, reader.next(&doc));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void countDocument(BSONPP *doc, void *context) {
+    int32_t *expected = static_cast<int32_t *>(context);
+    int32_t val = -1;
+    ASSERT_EQ(BSONPP_SUCCESS, doc->get("i", &val));
+    ASSERT_EQ(*expected, val);
+    (*expected)++;
+}
+
+TEST_F(Test, AsyncRoundTrip) {
+    for (int32_t forceSync = 0; forceSync < 2; forceSync++) {
+        FILE *file = tmpfile();
+        ASSERT_NE(nullptr, file);
+
+        // Odd sized documents and small buffers so documents regularly span chunks.
+        uint8_t pool[4 * 64];
+        BSONPPAsyncWriter writer(pool, 64, 4);
+        writer.init(forceSync);
+        writer.begin(fileno(file), 0);
+        constexpr int32_t kDocs = 500;
+        for (int32_t i = 0; i < kDocs; i++) {
+            uint8_t buffer[64];
+            BSONPP doc(buffer, sizeof(buffer));
+            ASSERT_EQ(BSONPP_SUCCESS, doc.append("i", i));
+            ASSERT_EQ(BSONPP_SUCCESS, doc.append("s", i % 2 ? "odd" : "even"));
+            ASSERT_EQ(BSONPP_SUCCESS, writer.write(&doc));
+        }
+        ASSERT_EQ(BSONPP_SUCCESS, writer.flush());
+
+        uint8_t readPool[3 * 50];
+        uint8_t carry[64];
+        BSONPPAsyncReader reader(readPool, 50, 3, carry, sizeof(carry));
+        reader.init(forceSync);
+        int32_t expected = 0;
+        ASSERT_EQ(BSONPP_SUCCESS, reader.read(fileno(file), 0, countDocument, &expected));
+        ASSERT_EQ(kDocs, expected);
+
+        // Truncating the file part way through a document is reported.
+        ASSERT_EQ(0, ftruncate(fileno(file), 100));
+        expected = 0;
+        ASSERT_EQ(BSONPP_INVALID_DOCUMENT, reader.read(fileno(file), 0, countDocument, &expected));
+        fclose(file);
+    }
+}
+
+TEST_F(Test, GetAfterSubdocument) {
+    uint8_t buffer[kBufferSize];
+    BSONPP subdoc(buffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, subdoc.append("num", 10));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("doc", &subdoc));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("after", 20));
+
+    int32_t val = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("after", &val));
+    ASSERT_EQ(20, val);
+    int32_t count = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getKeyCount(&count));
+    ASSERT_EQ(2, count);
+}
+
+TEST_F(Test, NextElement) {
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("a", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("bb", "str"));
+
+    int32_t offset = 0;
+    BSONPPElement element;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.nextElement(&offset, &element));
+    ASSERT_EQ(BSONPP_INT32, element.type);
+    ASSERT_EQ(1, element.keyLength);
+    ASSERT_EQ(4, element.valueSize);
+    ASSERT_EQ(BSONPP_SUCCESS, bson.nextElement(&offset, &element));
+    ASSERT_EQ(BSONPP_STRING, element.type);
+    ASSERT_EQ(0, strcmp("bb", element.key));
+    ASSERT_EQ(8, element.valueSize);
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, bson.nextElement(&offset, &element));
+
+    uint8_t buffer[kBufferSize];
+    BSONPP copy(buffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, copy.appendElement(&element));
+#ifndef BSONPP_TRUSTED_INPUT
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, copy.appendElement(&element));
+#endif
+    char *str = nullptr;
+    ASSERT_EQ(BSONPP_SUCCESS, copy.get("bb", &str));
+    ASSERT_EQ(0, strcmp("str", str));
+}
+
+TEST_F(Test, BeginDocument) {
+    BSONPP child;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("a", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.beginDocument("doc", &child));
+    ASSERT_EQ(BSONPP_SUCCESS, child.append("num", 10));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.endDocument(&child));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("b", 2));
+
+    uint8_t buffer[kBufferSize];
+    BSONPP subdoc(buffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, subdoc.append("num", 10));
+    uint8_t expectedBuffer[kBufferSize];
+    BSONPP expected(expectedBuffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, expected.append("a", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, expected.append("doc", &subdoc));
+    ASSERT_EQ(BSONPP_SUCCESS, expected.append("b", 2));
+    ASSERT_EQ(expected.getSize(), bson.getSize());
+    compare(expectedBuffer, expected.getSize());
+
+    // Not ending a document discards it.
+    ASSERT_EQ(BSONPP_SUCCESS, bson.beginDocument("discarded", &child));
+    ASSERT_EQ(BSONPP_SUCCESS, child.append("num", 10));
+    ASSERT_EQ(expected.getSize(), bson.getSize());
+    ASSERT_EQ(0x00, bson.getBuffer()[bson.getSize() - 1]);
+    ASSERT_EQ(BSONPP_SUCCESS, bson.validate());
+    ASSERT_FALSE(bson.exists("discarded"));
+    compare(expectedBuffer, expected.getSize());
+
+    // A document begun after a discarded one still ends up with the right type.
+    ASSERT_EQ(BSONPP_SUCCESS, bson.beginDocument("list", &child, true));
+    ASSERT_EQ(BSONPP_SUCCESS, child.append("0", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.endDocument(&child));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.validate());
+    uint8_t type = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getTypeAt(3, &type));
+    ASSERT_EQ(BSONPP_ARRAY, type);
+
+#ifdef BSONPP_TRUSTED_INPUT
+    // Not checked, lookups find the first.
+    ASSERT_EQ(BSONPP_SUCCESS, bson.beginDocument("doc", &child));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.endDocument(&child));
+    BSONPP found;
+    int32_t num = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("doc", &found));
+    ASSERT_EQ(BSONPP_SUCCESS, found.get("num", &num));
+    ASSERT_EQ(10, num);
+#else
+    int32_t size = bson.getSize();
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, bson.beginDocument("doc", &child));
+    ASSERT_EQ(size, bson.getSize());
+#endif
+}
+
+TEST_F(Test, ViewCachesPaths) {
+    BSONPP a;
+    BSONPP b;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("top", true));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.beginDocument("a", &a));
+    ASSERT_EQ(BSONPP_SUCCESS, a.beginDocument("b", &b, true));
+    ASSERT_EQ(BSONPP_SUCCESS, b.append("0", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, b.append("1", "two"));
+    ASSERT_EQ(BSONPP_SUCCESS, a.endDocument(&b));
+    ASSERT_EQ(BSONPP_SUCCESS, a.append("e", 2.5));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.endDocument(&a));
+
+    BSONPPViewEntry entries[8];
+    BSONPPView view(&bson, entries, 8);
+    int32_t number = 0;
+    char *str = nullptr;
+    double real = 0;
+    // "top" is cached on the way to "a".
+    ASSERT_EQ(BSONPP_SUCCESS, view.get("a.b.0", &number));
+    ASSERT_EQ(1, number);
+    ASSERT_EQ(4, view.getCount());
+    // "a" and "a.b" are reused, only the new leaves are added.
+    ASSERT_EQ(BSONPP_SUCCESS, view.get("a.b.1", &str));
+    ASSERT_EQ(0, strcmp("two", str));
+    ASSERT_EQ(5, view.getCount());
+    ASSERT_EQ(BSONPP_SUCCESS, view.get("a.b.0", &number));
+    ASSERT_EQ(BSONPP_SUCCESS, view.get("a.e", &real));
+    ASSERT_EQ(2.5, real);
+    ASSERT_EQ(6, view.getCount());
+    BSONPP owner;
+    int32_t offset = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, view.find("a.b.1", &owner, &offset));
+    ASSERT_EQ(BSONPP_SUCCESS, owner.getValue(offset, &str));
+    ASSERT_EQ(0, strcmp("two", str));
+
+    ASSERT_EQ(BSONPP_INCORRECT_TYPE, view.get("a.b.1", &number));
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, view.get("a.missing", &number));
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, view.get("top.x", &number));
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, view.get("a.b.0.x", &number));
+    ASSERT_EQ(6, view.getCount());
+
+    // Once the entries are used up lookups still work.
+    BSONPPView small(&bson, entries, 2);
+    ASSERT_EQ(BSONPP_SUCCESS, small.get("a.e", &real));
+    ASSERT_EQ(2.5, real);
+    ASSERT_EQ(BSONPP_SUCCESS, small.get("a.b.1", &str));
+    ASSERT_EQ(0, strcmp("two", str));
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, small.get("a.missing", &number));
+    ASSERT_EQ(2, small.getCount());
+
+    uint8_t buffer[kBufferSize];
+    BSONPP other(buffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("a", 3));
+    view.reset(&other);
+    ASSERT_EQ(0, view.getCount());
+    ASSERT_EQ(BSONPP_SUCCESS, view.get("a", &number));
+    ASSERT_EQ(3, number);
+}
+
+TEST_F(Test, DiffAndPatch) {
+    uint8_t fromBuffer[kBufferSize];
+    uint8_t toBuffer[kBufferSize];
+    uint8_t subBuffer[kBufferSize];
+    BSONPP from(fromBuffer, kBufferSize);
+    BSONPP to(toBuffer, kBufferSize);
+    BSONPP sub(subBuffer, kBufferSize);
+
+    ASSERT_EQ(BSONPP_SUCCESS, from.append("id", 7));
+    ASSERT_EQ(BSONPP_SUCCESS, from.append("temp", 20.5));
+    ASSERT_EQ(BSONPP_SUCCESS, from.append("gone", "bye"));
+    ASSERT_EQ(BSONPP_SUCCESS, sub.append("lat", 1.5));
+    ASSERT_EQ(BSONPP_SUCCESS, sub.append("lon", 2.5));
+    ASSERT_EQ(BSONPP_SUCCESS, from.append("pos", &sub));
+    ASSERT_EQ(BSONPP_SUCCESS, from.append("name", "sensor"));
+
+    ASSERT_EQ(BSONPP_SUCCESS, to.append("id", 7));
+    ASSERT_EQ(BSONPP_SUCCESS, to.append("temp", 21.0));
+    sub.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, sub.append("lat", 1.5));
+    ASSERT_EQ(BSONPP_SUCCESS, sub.append("lon", 3.5));
+    ASSERT_EQ(BSONPP_SUCCESS, to.append("pos", &sub));
+    ASSERT_EQ(BSONPP_SUCCESS, to.append("name", "sensor"));
+    ASSERT_EQ(BSONPP_SUCCESS, to.append("new", true));
+
+    ASSERT_EQ(BSONPP_SUCCESS, bson.diff(&from, &to));
+    ASSERT_LT(bson.getSize(), to.getSize());
+    int32_t count = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getKeyCount(&count));
+    // temp, pos, new and gone.
+    ASSERT_EQ(4, count);
+    uint8_t type = BSONPP_INVALID_TYPE;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.getTypeAt(3, &type));
+    ASSERT_EQ(BSONPP_UNDEFINED, type);
+    BSONPP nested;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.get("pos", &nested));
+    ASSERT_EQ(BSONPP_SUCCESS, nested.getKeyCount(&count));
+    ASSERT_EQ(1, count);
+
+    uint8_t outBuffer[kBufferSize];
+    BSONPP out(outBuffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, out.applyPatch(&from, &bson));
+    ASSERT_EQ(to.getSize(), out.getSize());
+    ASSERT_EQ(0, memcmp(toBuffer, outBuffer, to.getSize()));
+
+    // Identical documents give an empty patch.
+    bson.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.diff(&to, &to));
+    ASSERT_EQ(5, bson.getSize());
+}
+
+TEST_F(Test, DiffReordered) {
+    uint8_t fromBuffer[kBufferSize];
+    uint8_t toBuffer[kBufferSize];
+    BSONPP from(fromBuffer, kBufferSize);
+    BSONPP to(toBuffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, from.append("a", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, from.append("b", 2));
+    ASSERT_EQ(BSONPP_SUCCESS, from.append("c", 3));
+    ASSERT_EQ(BSONPP_SUCCESS, to.append("c", 3));
+    ASSERT_EQ(BSONPP_SUCCESS, to.append("a", 10));
+
+    ASSERT_EQ(BSONPP_SUCCESS, bson.diff(&from, &to));
+    uint8_t outBuffer[kBufferSize];
+    BSONPP out(outBuffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, out.applyPatch(&from, &bson));
+
+    int32_t count = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, out.getKeyCount(&count));
+    ASSERT_EQ(2, count);
+    int32_t val = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, out.get("a", &val));
+    ASSERT_EQ(10, val);
+    ASSERT_EQ(BSONPP_SUCCESS, out.get("c", &val));
+    ASSERT_EQ(3, val);
+    ASSERT_FALSE(out.exists("b"));
+
+    // Sub-documents differing only in key order give an empty, valid patch.
+    BSONPP fromChild;
+    BSONPP toChild;
+    from.clear();
+    to.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, from.beginDocument("d", &fromChild));
+    ASSERT_EQ(BSONPP_SUCCESS, fromChild.append("x", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, fromChild.append("y", 2));
+    ASSERT_EQ(BSONPP_SUCCESS, from.endDocument(&fromChild));
+    ASSERT_EQ(BSONPP_SUCCESS, to.beginDocument("d", &toChild));
+    ASSERT_EQ(BSONPP_SUCCESS, toChild.append("y", 2));
+    ASSERT_EQ(BSONPP_SUCCESS, toChild.append("x", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, to.endDocument(&toChild));
+    bson.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.diff(&from, &to));
+    ASSERT_EQ(5, bson.getSize());
+    ASSERT_EQ(0x00, bson.getBuffer()[4]);
+    ASSERT_EQ(BSONPP_SUCCESS, bson.validate());
+}
+
+TEST_F(Test, HashCanonicalNumbers) {
+    uint8_t otherBuffer[kBufferSize];
+    BSONPP other(otherBuffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("a", static_cast<int32_t>(1)));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("b", "str"));
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("a", 1.0));
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("b", "str"));
+
+    uint64_t hash = 0;
+    uint64_t otherHash = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.hash(&hash));
+    ASSERT_EQ(BSONPP_SUCCESS, other.hash(&otherHash));
+    ASSERT_EQ(hash, otherHash);
+
+    int32_t result = 1;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.compare(&other, &result));
+    ASSERT_EQ(0, result);
+
+    other.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("a", 1.5));
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("b", "str"));
+    ASSERT_EQ(BSONPP_SUCCESS, other.hash(&otherHash));
+    ASSERT_NE(hash, otherHash);
+    ASSERT_EQ(BSONPP_SUCCESS, bson.compare(&other, &result));
+    ASSERT_LT(result, 0);
+}
+
+TEST_F(Test, HashIgnoreKeyOrder) {
+    uint8_t childBuffer[kBufferSize];
+    uint8_t otherBuffer[kBufferSize];
+    BSONPP child(childBuffer, kBufferSize);
+    BSONPP other(otherBuffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, child.append("x", static_cast<int32_t>(1)));
+    ASSERT_EQ(BSONPP_SUCCESS, child.append("y", true));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("a", "long enough value to use the wide hash loop for sure"));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("b", &child));
+
+    BSONPP otherChild;
+    ASSERT_EQ(BSONPP_SUCCESS, other.beginDocument("b", &otherChild));
+    ASSERT_EQ(BSONPP_SUCCESS, otherChild.append("y", true));
+    ASSERT_EQ(BSONPP_SUCCESS, otherChild.append("x", static_cast<int64_t>(1)));
+    ASSERT_EQ(BSONPP_SUCCESS, other.endDocument(&otherChild));
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("a", "long enough value to use the wide hash loop for sure"));
+
+    uint64_t hash = 0;
+    uint64_t otherHash = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, bson.hash(&hash));
+    ASSERT_EQ(BSONPP_SUCCESS, other.hash(&otherHash));
+    ASSERT_NE(hash, otherHash);
+    ASSERT_EQ(BSONPP_SUCCESS, bson.hash(&hash, true));
+    ASSERT_EQ(BSONPP_SUCCESS, other.hash(&otherHash, true));
+    ASSERT_EQ(hash, otherHash);
+    // Different seeds give different hashes.
+    ASSERT_EQ(BSONPP_SUCCESS, other.hash(&otherHash, true, 1));
+    ASSERT_NE(hash, otherHash);
+}
+
+TEST_F(Test, CompareOrder) {
+    uint8_t otherBuffer[kBufferSize];
+    BSONPP other(otherBuffer, kBufferSize);
+    int32_t result = 0;
+
+    // Shorter documents come first.
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("a", static_cast<int32_t>(1)));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.compare(&other, &result));
+    ASSERT_LT(result, 0);
+    ASSERT_EQ(BSONPP_SUCCESS, other.compare(&bson, &result));
+    ASSERT_GT(result, 0);
+
+    // Numbers come before strings whatever the key.
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("z", "a"));
+    ASSERT_EQ(BSONPP_SUCCESS, other.compare(&bson, &result));
+    ASSERT_LT(result, 0);
+
+    // Then keys, then values.
+    bson.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("b", static_cast<int32_t>(0)));
+    ASSERT_EQ(BSONPP_SUCCESS, other.compare(&bson, &result));
+    ASSERT_LT(result, 0);
+    bson.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("a", static_cast<int64_t>(9007199254740993LL)));
+    other.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("a", 9007199254740992.0));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.compare(&other, &result));
+    ASSERT_GT(result, 0);
+
+    // Strings compare bytewise, a prefix first.
+    bson.clear();
+    other.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("a", "ab"));
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("a", "abc"));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.compare(&other, &result));
+    ASSERT_LT(result, 0);
+
+#ifndef BSONPP_TRUSTED_INPUT
+    // Unknown types aren't ordered at all, comparing them fails wherever they are.
+    other.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("a", "ab"));
+    ASSERT_EQ(BSONPP_SUCCESS, other.append("b", static_cast<int32_t>(1)));
+    other.getBuffer()[other.getSize() - 8] = 0x14;
+    ASSERT_EQ(BSONPP_INCORRECT_TYPE, bson.compare(&other, &result));
+    ASSERT_EQ(BSONPP_INCORRECT_TYPE, other.compare(&bson, &result));
+    uint64_t key = 0;
+    ASSERT_EQ(BSONPP_INCORRECT_TYPE, other.getSortKey(other.getSize() - 8, &key));
+#endif
+}
+
+static void collectDevice(BSONPP *doc, void *context) {
+    int32_t *ids = static_cast<int32_t *>(context);
+    BSONPP device;
+    doc->get("device", &device);
+    device.get("n", &ids[++ids[0]]);
+}
+
+TEST_F(Test, StoreLookupScanAndRecover) {
+    char dir[] = "/tmp/bsonppXXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(dir));
+    char segmentPath[64];
+    char indexPath[64];
+    snprintf(segmentPath, sizeof(segmentPath), "%s/segment", dir);
+    snprintf(indexPath, sizeof(indexPath), "%s/index", dir);
+
+    BSONPPStoreEntry tail[4];
+    uint8_t childBuffer[kBufferSize];
+    {
+        BSONPPStore store(tail, 4);
+        ASSERT_EQ(BSONPP_SUCCESS, store.open(segmentPath, indexPath, "device.id"));
+        for (int32_t i = 0; i < 10; i++) {
+            bson.clear();
+            BSONPP child(childBuffer, kBufferSize);
+            // Mixed numeric types, ids 0 to 4 each twice.
+            if (i % 2 == 0) {
+                ASSERT_EQ(BSONPP_SUCCESS, child.append("id", static_cast<int32_t>(i / 2)));
+            } else {
+                ASSERT_EQ(BSONPP_SUCCESS, child.append("id", static_cast<double>(i / 2)));
+            }
+            ASSERT_EQ(BSONPP_SUCCESS, child.append("n", i));
+            ASSERT_EQ(BSONPP_SUCCESS, bson.append("device", &child));
+            ASSERT_EQ(BSONPP_SUCCESS, store.append(&bson));
+        }
+        // Not indexed.
+        bson.clear();
+        ASSERT_EQ(BSONPP_SUCCESS, bson.append("other", 1));
+        ASSERT_EQ(BSONPP_SUCCESS, store.append(&bson));
+        ASSERT_GT(store.getCheckpoint(), 0u);
+        ASSERT_GT(store.getTailCount(), 0);
+
+        int32_t ids[16] = {0};
+        bson.clear();
+        ASSERT_EQ(BSONPP_SUCCESS, bson.append("id", static_cast<int64_t>(3)));
+        ASSERT_EQ(BSONPP_SUCCESS, store.lookup(&bson, collectDevice, ids));
+        ASSERT_EQ(2, ids[0]);
+        ASSERT_EQ(6, ids[1]);
+        ASSERT_EQ(7, ids[2]);
+
+        uint8_t upperBuffer[kBufferSize];
+        BSONPP upper(upperBuffer, kBufferSize);
+        memset(ids, 0, sizeof(ids));
+        bson.clear();
+        ASSERT_EQ(BSONPP_SUCCESS, bson.append("id", 1.5));
+        ASSERT_EQ(BSONPP_SUCCESS, upper.append("id", 4));
+        ASSERT_EQ(BSONPP_SUCCESS, store.scan(&bson, &upper, collectDevice, ids));
+        ASSERT_EQ(4, ids[0]);
+        ASSERT_EQ(4, ids[1]);
+        ASSERT_EQ(5, ids[2]);
+        ASSERT_EQ(6, ids[3]);
+        ASSERT_EQ(7, ids[4]);
+        ASSERT_EQ(BSONPP_SUCCESS, store.sync());
+    }
+
+    // A torn write at the end is dropped on recovery and the tail is rebuilt.
+    struct stat info;
+    ASSERT_EQ(0, stat(segmentPath, &info));
+    int fd = open(segmentPath, O_WRONLY | O_APPEND);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(7, write(fd, "garbage", 7));
+    close(fd);
+
+    BSONPPStore store(tail, 4);
+    ASSERT_EQ(BSONPP_SUCCESS, store.open(segmentPath, indexPath, "device.id"));
+    ASSERT_EQ(static_cast<uint64_t>(info.st_size), store.getSize());
+    int32_t ids[16] = {0};
+    bson.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("id", 4));
+    ASSERT_EQ(BSONPP_SUCCESS, store.lookup(&bson, collectDevice, ids));
+    ASSERT_EQ(2, ids[0]);
+    ASSERT_EQ(8, ids[1]);
+    ASSERT_EQ(9, ids[2]);
+    store.close();
+
+    unlink(segmentPath);
+    unlink(indexPath);
+    rmdir(dir);
+}
+
+static void sortAndCheck(uint8_t *memory, size_t memoryLength, int32_t threads, int32_t documents, bool expectRuns) {
+    BSONPPSorter sorter(memory, memoryLength, "v.k", "/tmp", threads);
+    uint8_t buffer[kBufferSize];
+    uint8_t childBuffer[kBufferSize];
+    BSONPP doc(buffer, kBufferSize);
+    for (int32_t i = 0; i < documents; i++) {
+        doc.clear();
+        BSONPP child(childBuffer, kBufferSize);
+        // Repeating keys of mixed numeric types, every seventh document without one.
+        int32_t key = (i * 7919) % 97;
+        if (i % 7 != 0) {
+            if (i % 2 == 0) {
+                ASSERT_EQ(BSONPP_SUCCESS, child.append("k", key));
+            } else {
+                ASSERT_EQ(BSONPP_SUCCESS, child.append("k", static_cast<double>(key)));
+            }
+        }
+        ASSERT_EQ(BSONPP_SUCCESS, doc.append("i", i));
+        ASSERT_EQ(BSONPP_SUCCESS, doc.append("v", &child));
+        ASSERT_EQ(BSONPP_SUCCESS, sorter.add(&doc));
+    }
+    ASSERT_EQ(expectRuns, sorter.getRunCount() > 0);
+
+    FILE *file = tmpfile();
+    int fd = fileno(file);
+    ASSERT_EQ(BSONPP_SUCCESS, sorter.finish(fd));
+    ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
+
+    uint8_t readBuffer[4096];
+    BSONPPStreamReader reader(readBuffer, sizeof(readBuffer));
+    int32_t count = 0;
+    double previousKey = -1;
+    int32_t previousIndex = -1;
+    while (reader.fill(fd) > 0) {
+        BSONPP sorted;
+        while (BSONPP_SUCCESS == reader.next(&sorted)) {
+            BSONPP child;
+            int32_t index = 0;
+            double key = -1;
+            int32_t intKey = 0;
+            ASSERT_EQ(BSONPP_SUCCESS, sorted.get("i", &index));
+            ASSERT_EQ(BSONPP_SUCCESS, sorted.get("v", &child));
+            if (BSONPP_SUCCESS == child.get("k", &intKey)) {
+                key = intKey;
+            } else {
+                child.get("k", &key);
+            }
+            ASSERT_LE(previousKey, key);
+            // Stable for equal keys.
+            if (previousKey == key) {
+                ASSERT_LT(previousIndex, index);
+            }
+            previousKey = key;
+            previousIndex = index;
+            count++;
+        }
+    }
+    ASSERT_EQ(documents, count);
+    fclose(file);
+}
+
+TEST_F(Test, SortInMemoryThreaded) {
+    size_t memoryLength = 1 << 20;
+    uint8_t *memory = new uint8_t[memoryLength];
+    sortAndCheck(memory, memoryLength, 4, 20000, false);
+    delete[] memory;
+}
+
+TEST_F(Test, SortExternalMerge) {
+    uint8_t memory[4096];
+    // Enough runs to fold them together part way through.
+    sortAndCheck(memory, sizeof(memory), 2, 7000, true);
+}
+
+TEST_F(Test, SortRejectsDocumentsTooLargeToMerge) {
+    uint8_t memory[4096];
+    BSONPPSorter sorter(memory, sizeof(memory), "v.k", "/tmp");
+    // Each of the 64 runs and the output get 4096 / 65 = 63 bytes, a 55 byte document and its key fit.
+    uint8_t childBuffer[kBufferSize];
+    BSONPP child(childBuffer, kBufferSize);
+    ASSERT_EQ(BSONPP_SUCCESS, child.append("k", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("v", &child));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("p", "012345678901234567890123456"));
+    ASSERT_EQ(55, bson.getSize());
+    ASSERT_EQ(BSONPP_SUCCESS, sorter.add(&bson));
+
+    bson.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("v", &child));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("p", "0123456789012345678901234567"));
+    ASSERT_EQ(56, bson.getSize());
+    ASSERT_EQ(BSONPP_OUT_OF_SPACE, sorter.add(&bson));
+    sorter.clear();
+}
+
+TEST_F(Test, KeyCodecRoundTrip) {
+    char encoderStorage[128];
+    uint16_t encoderOffsets[8];
+    uint16_t slots[16];
+    BSONPPKeyDictionary encoderDictionary(encoderStorage, sizeof(encoderStorage), encoderOffsets, 8, slots, 16);
+    char decoderStorage[128];
+    uint16_t decoderOffsets[8];
+    BSONPPKeyDictionary decoderDictionary(decoderStorage, sizeof(decoderStorage), decoderOffsets, 8);
+    BSONPPKeyEncoder encoder(&encoderDictionary);
+    BSONPPKeyDecoder decoder(&decoderDictionary);
+
+    uint8_t childBuffer[kBufferSize];
+    uint8_t arrayBuffer[kBufferSize];
+    BSONPP child(childBuffer, kBufferSize);
+    BSONPP array(arrayBuffer, kBufferSize);
+    const uint8_t binary[] = {1, 2, 3};
+    ASSERT_EQ(BSONPP_SUCCESS, array.append("0", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, array.append("1", "two"));
+    ASSERT_EQ(BSONPP_SUCCESS, child.append("temperature", 21.5));
+    ASSERT_EQ(BSONPP_SUCCESS, child.append("readings", &array, true));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("deviceId", "sensor-1"));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("timestamp", static_cast<int64_t>(1563464196213), true));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("payload", binary, sizeof(binary)));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("enabled", true));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("sample", &child));
+
+    uint8_t encoded[kBufferSize];
+    uint8_t decoded[kBufferSize];
+    int32_t firstSize = 0;
+    int32_t secondSize = 0;
+    int32_t consumed = 0;
+    BSONPP result;
+    for (int32_t i = 0; i < 2; i++) {
+        int32_t written = 0;
+        ASSERT_EQ(BSONPP_SUCCESS, encoder.encode(&bson, encoded, sizeof(encoded), &written));
+        ASSERT_EQ(BSONPP_SUCCESS, decoder.decode(encoded, written, decoded, sizeof(decoded), &result, &consumed));
+        ASSERT_EQ(written, consumed);
+        ASSERT_EQ(bson.getSize(), result.getSize());
+        ASSERT_EQ(0, memcmp(bson.getBuffer(), result.getBuffer(), bson.getSize()));
+        (i == 0 ? firstSize : secondSize) = written;
+    }
+    // Keys are only sent in full the first time.
+    ASSERT_LT(secondSize, firstSize);
+    ASSERT_LT(secondSize, bson.getSize() / 2 + 10);
+    ASSERT_EQ(7, encoderDictionary.getCount());
+    ASSERT_EQ(7, decoderDictionary.getCount());
+
+    // Truncated input leaves the dictionary as it was.
+    bson.clear();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("newKey", 1));
+    int32_t written = 0;
+    ASSERT_EQ(BSONPP_SUCCESS, encoder.encode(&bson, encoded, sizeof(encoded), &written));
+    ASSERT_EQ(BSONPP_INVALID_DOCUMENT, decoder.decode(encoded, written - 1, decoded, sizeof(decoded), &result, &consumed));
+    ASSERT_EQ(7, decoderDictionary.getCount());
+    ASSERT_EQ(BSONPP_OUT_OF_SPACE, decoder.decode(encoded, written, decoded, 8, &result, &consumed));
+    ASSERT_EQ(BSONPP_SUCCESS, decoder.decode(encoded, written, decoded, sizeof(decoded), &result, &consumed));
+    ASSERT_EQ(8, decoderDictionary.getCount());
+}
+
+TEST_F(Test, KeyCodecSuppliedDictionary) {
+    char storage[64];
+    uint16_t offsets[4];
+    uint16_t slots[8];
+    BSONPPKeyDictionary encoderDictionary(storage, sizeof(storage), offsets, 4, slots, 8);
+    char decoderStorage[64];
+    uint16_t decoderOffsets[4];
+    BSONPPKeyDictionary decoderDictionary(decoderStorage, sizeof(decoderStorage), decoderOffsets, 4);
+    ASSERT_EQ(0, encoderDictionary.add("known", 5));
+    ASSERT_EQ(0, decoderDictionary.add("known", 5));
+
+    // Without learning unknown keys are always sent in full.
+    BSONPPKeyEncoder encoder(&encoderDictionary, false);
+    BSONPPKeyDecoder decoder(&decoderDictionary);
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("known", 1));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("unknown", 2));
+
+    uint8_t encoded[kBufferSize];
+    uint8_t decoded[kBufferSize];
+    int32_t written = 0;
+    int32_t consumed = 0;
+    BSONPP result;
+    ASSERT_EQ(BSONPP_SUCCESS, encoder.encode(&bson, encoded, sizeof(encoded), &written));
+    ASSERT_EQ(BSONPP_SUCCESS, decoder.decode(encoded, written, decoded, sizeof(decoded), &result, &consumed));
+    ASSERT_EQ(0, memcmp(bson.getBuffer(), result.getBuffer(), bson.getSize()));
+    ASSERT_EQ(1, encoderDictionary.getCount());
+    ASSERT_EQ(1, decoderDictionary.getCount());
+}
+
+TEST_F(Test, BlockCompressRoundTrip) {
+    uint8_t input[2048];
+    for (int32_t i = 0; i < static_cast<int32_t>(sizeof(input)); i++) {
+        // Repetitive with some variation.
+        input[i] = (i % 37) < 30 ? "telemetry sample "[i % 17] : static_cast<uint8_t>(i);
+    }
+    uint16_t table[1 << 10];
+    uint8_t compressed[sizeof(input) + 64];
+    uint8_t output[sizeof(input)];
+    int32_t size = BSONPPBlock::compress(input, sizeof(input), compressed, sizeof(compressed), table, 10);
+    ASSERT_GT(size, 0);
+    ASSERT_LT(size, static_cast<int32_t>(sizeof(input)) / 2);
+    ASSERT_EQ(static_cast<int32_t>(sizeof(input)), BSONPPBlock::decompress(compressed, size, output, sizeof(output)));
+    ASSERT_EQ(0, memcmp(input, output, sizeof(input)));
+
+    ASSERT_EQ(BSONPP_OUT_OF_SPACE, BSONPPBlock::decompress(compressed, size, output, sizeof(output) - 1));
+    ASSERT_EQ(BSONPP_INVALID_DOCUMENT, BSONPPBlock::decompress(compressed, size - 1, output, sizeof(output)));
+
+    // Short and incompressible input is stored as literals.
+    size = BSONPPBlock::compress(input, 5, compressed, sizeof(compressed), table, 10);
+    ASSERT_EQ(6, size);
+    ASSERT_EQ(5, BSONPPBlock::decompress(compressed, size, output, sizeof(output)));
+}
+
+#ifdef BSONPP_INSTRUMENT
+struct TraceCount {
+    int32_t begins;
+    int32_t ends;
+    int32_t lastResult;
+};
+
+static void countTrace(const char *event, bool begin, int32_t value, void *context) {
+    TraceCount *count = static_cast<TraceCount *>(context);
+    if (strcmp(event, "lookup") != 0) {
+        return;
+    }
+    if (begin) {
+        count->begins++;
+    } else {
+        count->ends++;
+        count->lastResult = value;
+    }
+}
+
+TEST_F(Test, InstrumentationCounters) {
+    bsonppResetStats();
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("a", (int32_t) 1));
+    ASSERT_EQ(BSONPP_SUCCESS, bson.append("b", "two"));
+    ASSERT_EQ(BSONPP_DUPLICATE_KEY, bson.append("a", (int32_t) 3));
+    uint8_t small[8];
+    BSONPP full(small, sizeof(small));
+    ASSERT_EQ(BSONPP_OUT_OF_SPACE, full.append("long", (int64_t) 4));
+
+    BSONPPStats *stats = bsonppGetStats();
+    ASSERT_EQ(4u, stats->appends);
+    ASSERT_EQ(1u, stats->appendsDuplicateKey);
+    ASSERT_EQ(1u, stats->appendsOutOfSpace);
+    // The three duplicate checks found nothing, nothing and "a".
+    ASSERT_EQ(3u, stats->scans);
+    ASSERT_EQ(2u, stats->lookupsNotFound);
+    ASSERT_EQ(1u, stats->lookupsFound);
+    // Element headers and values, type + "a\0" + 4 and type + "b\0" + length + "two\0".
+    ASSERT_EQ(7u + 11u, stats->bytesCopied);
+
+    TraceCount count = {0, 0, 0};
+    bsonppSetTraceHook(countTrace, &count);
+    int32_t value = 0;
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, bson.get("c", &value));
+    bsonppSetTraceHook(nullptr, nullptr);
+    ASSERT_EQ(1, count.begins);
+    ASSERT_EQ(1, count.ends);
+    ASSERT_EQ(BSONPP_KEY_NOT_FOUND, count.lastResult);
+    ASSERT_EQ(3u, stats->lookupsNotFound);
+    // None, one and one element for the duplicate checks then both for the miss.
+    ASSERT_EQ(4u, stats->elementsVisited);
+
+    // Scans saw documents of 5, 12, 23 and 23 bytes.
+    ASSERT_EQ(1u, stats->documentSizes[2]);
+    ASSERT_EQ(1u, stats->documentSizes[3]);
+    ASSERT_EQ(2u, stats->documentSizes[4]);
+}
+#endif // BSONPP_INSTRUMENT
+
 #endif // __LINUX_BUILD